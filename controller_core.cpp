@@ -0,0 +1,1419 @@
+#include "controller_core.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+
+#include "hot_path.hpp"
+
+// Nothing here may touch the heap once the board is running
+#pragma GCC poison malloc calloc realloc free strdup
+
+using namespace protocol;
+
+// Per-command debug output: text with V1, a deferred log record with V2
+#define DEBUG_LOG(format, ...)                                   \
+    do {                                                         \
+        if (debug_output == DEBUG_DEFERRED) {                    \
+            LOG_SITE(site, format);                              \
+            LOG_SITE_CHECK(format, ##__VA_ARGS__);               \
+            logDeferred(site, ##__VA_ARGS__);                    \
+        } else if (debug_output == DEBUG_TEXT) {                 \
+            print(format, ##__VA_ARGS__);                        \
+        }                                                        \
+    } while (0)
+
+const int SEQ_REORDER_WINDOW = 32;  // Older frames than this count as a host restart
+
+// Built-in poses, all neutral until taught with the save command
+static const Pose default_poses[] = {
+    {"open",  {0}},
+    {"power", {0}},
+    {"pinch", {0}},
+    {"point", {0}},
+};
+static const unsigned NUM_DEFAULT_POSES = sizeof(default_poses) / sizeof(default_poses[0]);
+
+HOT_PATH uint16_t cpuCopy(const uint8_t* src, unsigned src_index, unsigned src_mask, uint8_t* dst,
+                          unsigned count, uint16_t crc, bool with_crc) {
+    for (auto i = 0u; i < count; i++) {
+        uint8_t c = src[(src_index + i) & src_mask];
+        dst[i] = c;
+        if (with_crc) {
+            crc = crc16_update(crc, c);
+        }
+    }
+    return crc;
+}
+
+HOT_PATH static int hexDigit(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+
+// atoi() for the hot path, which can't call into the C library in flash:
+// leading spaces, an optional sign, then digits up to the first non-digit
+HOT_PATH static int parseInt(const char* text) {
+    while (*text == ' ') {
+        text++;
+    }
+    bool negative = *text == '-';
+    if (*text == '-' || *text == '+') {
+        text++;
+    }
+    int value = 0;
+    while (*text >= '0' && *text <= '9') {
+        value = value * 10 + (*text++ - '0');
+    }
+    return negative ? -value : value;
+}
+
+ControllerCore::ControllerCore(ControllerHal& hal) : hal(hal) {
+}
+
+void ControllerCore::begin() {
+    loadPoses();
+    resetChannels();
+}
+
+void ControllerCore::print(const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    hal.vprint(format, args);
+    va_end(args);
+}
+
+// Centred, full range, default calibration (-140→+140° to 1000→2000µs)
+void ControllerCore::resetChannels() {
+    for (auto s = 0u; s < NUM_SERVOS; s++) {
+        channels.target[s] = 0;
+        channels.current[s] = 0;
+        channels.pulse_q4[s] = PULSE_CENTRE_Q4;
+        channels.min_angle[s] = MIN_ANGLE;
+        channels.max_angle[s] = MAX_ANGLE;
+        channels.scale_q16[s] = PULSE_PER_DEGREE_Q16;
+        channels.centre_q4[s] = PULSE_CENTRE_Q4;
+        channels.last_step[s] = 0;
+        channels.step_us[s] = 0;
+        channels.changed_us[s] = 0;
+        channels.flags[s] = 0;
+    }
+}
+
+// The control tick: take new targets for the channels in mask, clamp them to
+// the limits, then map every channel to a pulse in one pass of the kernel.
+// Ticks also come from interrupts (the sync edge, the schedule alarm), so the
+// table and the outputs are only touched with interrupts off.
+HOT_PATH void ControllerCore::applyPositions(const int16_t* positions, uint32_t mask) {
+    uint32_t ints = hal.disableInterrupts();
+    uint32_t start = hal.cycleCount();
+    uint32_t now_us = (uint32_t)hal.timeUs();
+    for (auto s = 0u; s < NUM_SERVOS; s++) {
+        if (!(mask & (1u << s))) {
+            continue;
+        }
+        int16_t target = positions[s];
+        int16_t limited = target;
+        if (limited < channels.min_angle[s]) {
+            limited = channels.min_angle[s];
+        } else if (limited > channels.max_angle[s]) {
+            limited = channels.max_angle[s];
+        }
+        if (limited != target) {
+            channels.flags[s] |= CHANNEL_CLAMPED;
+        } else if (channels.flags[s] & CHANNEL_CLAMPED) {
+            channels.flags[s] &= ~CHANNEL_CLAMPED;
+        }
+        if (limited != channels.current[s]) {
+            channels.last_step[s] = limited - channels.current[s];
+            channels.step_us[s] = now_us - channels.changed_us[s];
+            channels.changed_us[s] = now_us;
+        }
+        channels.target[s] = target;
+        channels.current[s] = limited;
+    }
+    computePulses(channels.current, channels.scale_q16, channels.centre_q4, channels.pulse_q4, NUM_SERVOS);
+    hal.setPulses(channels.pulse_q4, mask);
+    tick_count++;
+    tick_targets += __builtin_popcount(mask);
+    tick_cycles += hal.cyclesSince(start);
+    hal.restoreInterrupts(ints);
+}
+
+HOT_PATH void ControllerCore::applyJointFrame(const JointFrame& frame) {
+    applyPositions(frame.positions, frame.mask);
+}
+
+// From the sync edge interrupt, or the main loop when not synced or on a bus
+HOT_PATH void ControllerCore::commitStagedFrame() {
+    uint32_t ints = hal.disableInterrupts();
+    uint64_t now = hal.timeUs();
+    if (sync_align_pending) {
+        hal.alignPwmPhase();
+        sync_align_pending = false;
+    }
+    if (staged_pending) {
+        applyJointFrame(staged_frame);
+        staged_pending = false;
+    }
+    last_commit_us = now;
+    sync_commits++;
+    hal.restoreInterrupts(ints);
+}
+
+HOT_PATH void ControllerCore::syncEdge() {
+    if (sync_role != SYNC_OFF) {
+        commitStagedFrame();
+    }
+}
+
+void ControllerCore::setSyncRole(SyncRole role) {
+    hal.setSyncRole(role);
+    sync_role = role;
+}
+
+// Stage a frame for the next commit, merging with anything already staged
+HOT_PATH void ControllerCore::stageFrame(const JointFrame& frame) {
+    uint32_t ints = hal.disableInterrupts();
+    if (!staged_pending) {
+        staged_frame.mask = 0;
+    }
+    for (auto s = 0u; s < NUM_SERVOS; s++) {
+        if (frame.mask & (1u << s)) {
+            staged_frame.positions[s] = frame.positions[s];
+        }
+    }
+    staged_frame.mask |= frame.mask;
+    staged_pending = true;
+    hal.restoreInterrupts(ints);
+}
+
+HOT_PATH void ControllerCore::requestCommit() {
+    switch (sync_role) {
+    case SYNC_OFF:
+        commitStagedFrame();
+        break;
+    case SYNC_MASTER:
+        hal.pulseSyncLine();
+        break;
+    case SYNC_SLAVE:
+        break; // Waits for the master's pulse
+    }
+}
+
+// Send a binary frame to the host
+HOT_PATH void ControllerCore::sendBinaryFrame(uint8_t type, const uint8_t* payload, uint8_t length) {
+    if (bus_reply != 0) {
+        sendBusReply(type, payload, length, 0);
+        return;
+    }
+    uint8_t frame[3 + MAX_FRAME_PAYLOAD];
+    frame[0] = FRAME_SYNC;
+    frame[1] = type;
+    frame[2] = length;
+    memcpy(frame + 3, payload, length);
+    if (type == FRAME_TELEMETRY) {
+        hal.writeTelemetry(frame, 3 + length);
+    } else {
+        hal.write(frame, 3 + length);
+    }
+}
+
+// Answer a time sync request and take the host's latest estimate
+HOT_PATH void ControllerCore::handleTimeRequest(const SerialFrame& frame) {
+    const uint8_t* data = frame.data;
+    if (data[20] & TIME_ESTIMATE_VALID) {
+        host_clock.valid = true;
+        host_clock.host_ref_us = get_u64(data);
+        host_clock.offset_us = (int64_t)get_u64(data + 8);
+        host_clock.drift_ppb = (int32_t)get_u32(data + 16);
+    }
+
+    uint8_t reply[TIME_REPLY_LENGTH];
+    memcpy(reply, data, 8);
+    put_u64(reply + 8, frame.rx_time_us);
+    put_u64(reply + 16, hal.timeUs());
+    sendBinaryFrame(FRAME_TIME_REPLY, reply, sizeof(reply));
+}
+
+// Send positions and command bookkeeping so the host can measure latency
+HOT_PATH void ControllerCore::fillTelemetry(uint8_t* payload) {
+    put_u64(payload + TELEMETRY_TIME, hal.timeUs());
+    put_u64(payload + TELEMETRY_LAST_SET_RX, last_set_rx_us);
+    put_u32(payload + TELEMETRY_SET_COUNT, set_count);
+    put_u32(payload + TELEMETRY_MERGED_FRAMES, merged_frames);
+    put_u32(payload + TELEMETRY_DROPPED_TARGETS, dropped_targets);
+    for (auto s = 0u; s < NUM_SERVOS; s++) {
+        put_u16(payload + TELEMETRY_POSITIONS + s * 2, (uint16_t)channels.current[s]);
+    }
+}
+
+HOT_PATH void ControllerCore::sendTelemetry() {
+    uint8_t payload[TELEMETRY_LENGTH];
+    fillTelemetry(payload);
+    sendBinaryFrame(FRAME_TELEMETRY, payload, sizeof(payload));
+}
+
+HOT_PATH void ControllerCore::updateTelemetry() {
+    uint64_t now = hal.timeUs();
+    if (telemetry_period_ms == 0 || now < next_telemetry_us) {
+        return;
+    }
+    next_telemetry_us += (uint64_t)telemetry_period_ms * 1000;
+    // Don't try to catch up after a stall, just carry on from now
+    if (next_telemetry_us < now) {
+        next_telemetry_us = now + (uint64_t)telemetry_period_ms * 1000;
+    }
+    sendTelemetry();
+}
+
+// Convert a host timestamp to device time using the host's estimate
+HOT_PATH uint64_t ControllerCore::hostToDeviceTime(uint64_t host_us) {
+    int64_t since_ref = (int64_t)(host_us - host_clock.host_ref_us);
+    return host_us + host_clock.offset_us + since_ref * host_clock.drift_ppb / 1000000000;
+}
+
+// From the schedule alarm, or scheduleFrame(). The queue and the apply are
+// under one lock, so the main loop never sees a frame applied but still queued.
+HOT_PATH void ControllerCore::runScheduledFrames() {
+    uint32_t ints = hal.disableInterrupts();
+    while (schedule_count > 0) {
+        uint64_t due = schedule_queue[0].time_us;
+        if (due > hal.timeUs()) {
+            if (!hal.setAlarm(due)) {
+                break;
+            }
+            continue;
+        }
+        applyJointFrame(schedule_queue[0].joints);
+        schedule_count--;
+        for (auto i = 0u; i < schedule_count; i++) {
+            schedule_queue[i] = schedule_queue[i + 1];
+        }
+    }
+    hal.restoreInterrupts(ints);
+}
+
+HOT_PATH void ControllerCore::scheduleFrame(uint64_t time_us, const JointFrame& joints) {
+    uint32_t ints = hal.disableInterrupts();
+    if (time_us <= hal.timeUs()) {
+        schedule_late++;
+        applyJointFrame(joints);
+    } else if (schedule_count >= SCHEDULE_QUEUE_LEN) {
+        schedule_rejected++;
+    } else {
+        // Insert after any frame with the same time so equal times keep arrival order
+        unsigned i = schedule_count;
+        while (i > 0 && schedule_queue[i - 1].time_us > time_us) {
+            schedule_queue[i] = schedule_queue[i - 1];
+            i--;
+        }
+        schedule_queue[i].time_us = time_us;
+        schedule_queue[i].joints = joints;
+        schedule_count++;
+        if (i == 0) {
+            hal.cancelAlarm();
+            runScheduledFrames();
+        }
+    }
+    hal.restoreInterrupts(ints);
+}
+
+// Sync commands:
+//   YM / YS / Y0   sync master / slave / off
+//   YP             align PWM periods on the next commit
+//   YC             commit the staged frame
+//   Y?             sync status
+void ControllerCore::handleSyncCommand(const char* command) {
+    switch (command[1]) {
+    case 'M': setSyncRole(SYNC_MASTER); break;
+    case 'S': setSyncRole(SYNC_SLAVE); break;
+    case '0': setSyncRole(SYNC_OFF); break;
+    case 'P': sync_align_pending = true; break;
+    case 'C': requestCommit(); return;
+    case '?':
+        print("Sync role %d, %lu commits, last at %llu us\n", sync_role,
+              (unsigned long)sync_commits, (unsigned long long)last_commit_us);
+        print("Schedule: %d queued, %lu late, %lu rejected, now %llu us\n", schedule_count,
+              (unsigned long)schedule_late, (unsigned long)schedule_rejected,
+              (unsigned long long)hal.timeUs());
+        if (host_clock.valid) {
+            print("Host clock: offset %lld us, drift %ld ppb\n",
+                  (long long)host_clock.offset_us, (long)host_clock.drift_ppb);
+        }
+        return;
+    default:
+        print("Invalid sync command: %s\n", command);
+        return;
+    }
+    print("Sync role %d%s\n", sync_role, sync_align_pending ? ", PWM align pending" : "");
+}
+
+void ControllerCore::setBusNode(unsigned node) {
+    bus_node = (uint8_t)node;
+    hal.setBusMode(node != 0);
+}
+
+// Unwrap a frame for this node (or all of them) and handle it
+HOT_PATH void ControllerCore::handleBusFrame(const SerialFrame& frame) {
+    uint8_t node = frame.data[0];
+    if (node != bus_node && node != BUS_BROADCAST) {
+        bus_stats.others++;
+        return;
+    }
+    bus_stats.frames++;
+    bus_frame.binary = true;
+    bus_frame.type = frame.data[1];
+    bus_frame.length = (uint8_t)(frame.length - BUS_HEADER);
+    bus_frame.rx_time_us = frame.rx_time_us;
+    memcpy(bus_frame.data, frame.data + BUS_HEADER, bus_frame.length);
+    bus_reply = node;
+    handleBinaryFrame(bus_frame);
+    bus_reply = 0;
+}
+
+// Every node commits as the frame arrives, then answers in its own slot. The
+// slot is timed from when the frame was read, so the schedule allows for
+// BUS_JITTER_US of lateness.
+HOT_PATH void ControllerCore::handleBusCommit(const SerialFrame& frame) {
+    commitStagedFrame();
+    bus_stats.commits++;
+    if (frame.data[4] & BUS_COMMIT_TELEMETRY) {
+        uint64_t slot_us = frame.rx_time_us + get_u16(frame.data) + (uint64_t)(bus_node - 1) * get_u16(frame.data + 2);
+        uint8_t payload[TELEMETRY_LENGTH];
+        fillTelemetry(payload);
+        sendBusReply(FRAME_TELEMETRY, payload, sizeof(payload), slot_us);
+    }
+}
+
+// Answer on the bus as this node, at device time at_us (0 = now). Nothing
+// answers a broadcast, so nodes never talk over each other.
+HOT_PATH void ControllerCore::sendBusReply(uint8_t type, const uint8_t* payload, uint8_t length, uint64_t at_us) {
+    if (bus_reply == BUS_BROADCAST || length > MAX_FRAME_PAYLOAD - BUS_HEADER) {
+        bus_stats.dropped_replies++;
+        return;
+    }
+    uint8_t frame[3 + MAX_FRAME_PAYLOAD];
+    frame[0] = FRAME_SYNC;
+    frame[1] = FRAME_BUS_REPLY;
+    frame[2] = (uint8_t)(BUS_HEADER + length);
+    frame[3] = bus_node;
+    frame[4] = type;
+    memcpy(frame + 3 + BUS_HEADER, payload, length);
+    hal.busTransmit(frame, 3 + BUS_HEADER + length, at_us);
+    bus_stats.replies++;
+}
+
+// N<node> joins a bus, N0 leaves it, N? shows the counters
+void ControllerCore::handleBusCommand(const char* command) {
+    if (command[1] != '?') {
+        int node = atoi(&command[1]);
+        if (node < 0 || node > (int)BUS_MAX_NODES) {
+            print("Invalid bus node: %s\n", command);
+            return;
+        }
+        setBusNode((unsigned)node);
+    }
+    print("Bus node %d: %lu frames, %lu for other nodes, %lu commits, %lu replies, %lu dropped\n", bus_node,
+          (unsigned long)bus_stats.frames, (unsigned long)bus_stats.others, (unsigned long)bus_stats.commits,
+          (unsigned long)bus_stats.replies, (unsigned long)bus_stats.dropped_replies);
+}
+
+// Load the stored pose table, falling back to the built-in defaults
+void ControllerCore::loadPoses() {
+    if (hal.loadPoses(pose_table) && pose_table.magic == POSE_MAGIC && pose_table.count == NUM_POSES) {
+        return;
+    }
+
+    memset(&pose_table, 0, sizeof(PoseTable));
+    pose_table.magic = POSE_MAGIC;
+    pose_table.count = NUM_POSES;
+    for (auto p = 0u; p < NUM_DEFAULT_POSES; p++) {
+        pose_table.poses[p] = default_poses[p];
+    }
+}
+
+// Find a pose by index ("2") or by name ("pinch"), returns -1 if not found
+int ControllerCore::findPose(const char* ref) {
+    if (*ref >= '0' && *ref <= '9') {
+        int index = atoi(ref);
+        return (index >= 0 && index < (int)NUM_POSES) ? index : -1;
+    }
+    for (auto p = 0u; p < NUM_POSES; p++) {
+        if (pose_table.poses[p].name[0] != '\0' && strcmp(pose_table.poses[p].name, ref) == 0) {
+            return p;
+        }
+    }
+    return -1;
+}
+
+// Move all servos to a blend of two poses: a + (b - a) * t / 255
+void ControllerCore::applyPoseBlend(unsigned a, unsigned b, int t) {
+    const Pose& from = pose_table.poses[a];
+    const Pose& to = pose_table.poses[b];
+    int16_t positions[NUM_SERVOS];
+    for (auto s = 0u; s < NUM_SERVOS; s++) {
+        int delta = to.positions[s] - from.positions[s];
+        positions[s] = from.positions[s] + (delta * t) / 255;
+    }
+    applyPositions(positions, ALL_SERVOS);
+}
+
+// Pose commands:
+//   P<a>            recall pose a (index or name)
+//   P<a>,<b>,<t>    blend from pose a to pose b, t = 0..255
+//   S<n>[,<name>]   save current positions as pose n
+//   L               list poses
+void ControllerCore::handlePoseCommand(const char* command) {
+    char args[64];
+    strncpy(args, command + 1, sizeof(args) - 1);
+    args[sizeof(args) - 1] = '\0';
+
+    char* fields[3] = {args, NULL, NULL};
+    int num_fields = 1;
+    for (char* c = args; *c != '\0' && num_fields < 3; c++) {
+        if (*c == ',') {
+            *c = '\0';
+            fields[num_fields++] = c + 1;
+        }
+    }
+
+    switch (command[0]) {
+    case 'P': {
+        // P<a> or P<a>,<b>,<t>: a blend without its factor is malformed, not a recall
+        int a = findPose(fields[0]);
+        int b = (num_fields == 3) ? findPose(fields[1]) : a;
+        int t = (num_fields == 3) ? atoi(fields[2]) : 0;
+        if (num_fields == 2 || a < 0 || b < 0 || t < 0 || t > 255) {
+            print("Invalid pose command: %s\n", command);
+            return;
+        }
+        applyPoseBlend(a, b, t);
+        print("Pose %d → %d at %d/255\n", a, b, t);
+        break;
+    }
+    case 'S': {
+        int n = atoi(fields[0]);
+        if (fields[0][0] < '0' || fields[0][0] > '9' || n >= (int)NUM_POSES) {
+            print("Invalid pose slot: %s\n", fields[0]);
+            return;
+        }
+        Pose& pose = pose_table.poses[n];
+        for (auto s = 0u; s < NUM_SERVOS; s++) {
+            pose.positions[s] = channels.current[s];
+        }
+        if (num_fields > 1) {
+            strncpy(pose.name, fields[1], POSE_NAME_LEN - 1);
+            pose.name[POSE_NAME_LEN - 1] = '\0';
+        }
+        hal.storePoses(pose_table);
+        print("Saved pose %d (%s)\n", n, pose.name);
+        break;
+    }
+    case 'L':
+        for (auto p = 0u; p < NUM_POSES; p++) {
+            print("Pose %2d %-11s", p, pose_table.poses[p].name);
+            for (auto s = 0u; s < NUM_SERVOS; s++) {
+                print(" %4d", pose_table.poses[p].positions[s]);
+            }
+            print("\n");
+        }
+        break;
+    }
+}
+
+// Decode keyframe records from a FRAME_TRAJ_DATA payload and append them.
+// Each record is:
+//   u16 dt_ms     time since the previous keyframe
+//   u32 mask      channels that change in this keyframe (bit n = channel n)
+//   int8 delta    per set bit, relative to the previous keyframe
+//                 (TRAJ_ABSOLUTE is followed by an int16 absolute position)
+// All multi-byte values are little endian. Returns false on a malformed payload.
+bool ControllerCore::decodeKeyframes(const uint8_t* data, unsigned length) {
+    unsigned i = 0;
+    while (i < length) {
+        if (num_keyframes >= MAX_KEYFRAMES || length - i < 6) {
+            return false;
+        }
+
+        uint16_t dt_ms = get_u16(data + i);
+        uint32_t mask = get_u32(data + i + 2);
+        i += 6;
+
+        Keyframe& kf = keyframes[num_keyframes];
+        if (num_keyframes == 0) {
+            memset(&kf, 0, sizeof(Keyframe));
+            kf.time_ms = dt_ms;
+        } else {
+            kf = keyframes[num_keyframes - 1];
+            kf.time_ms += dt_ms;
+        }
+
+        for (auto s = 0u; s < NUM_SERVOS; s++) {
+            if (!(mask & (1u << s))) {
+                continue;
+            }
+            if (i >= length) {
+                return false;
+            }
+            int8_t delta = (int8_t)data[i++];
+            if (delta == TRAJ_ABSOLUTE) {
+                if (length - i < 2) {
+                    return false;
+                }
+                kf.positions[s] = (int16_t)get_u16(data + i);
+                i += 2;
+            } else {
+                kf.positions[s] += delta;
+            }
+            if (kf.positions[s] < MIN_ANGLE || kf.positions[s] > MAX_ANGLE) {
+                return false;
+            }
+        }
+        num_keyframes++;
+    }
+    return true;
+}
+
+void ControllerCore::startTrajectory(bool loop) {
+    if (num_keyframes == 0) {
+        print("No trajectory loaded\n");
+        return;
+    }
+    if (num_keyframes != expected_keyframes) {
+        print("Trajectory incomplete (%d of %d keyframes)\n", num_keyframes, expected_keyframes);
+        return;
+    }
+    traj_loop = loop;
+    traj_segment = 0;
+    traj_start_us = hal.timeUs();
+    traj_state = TRAJ_PLAYING;
+}
+
+void ControllerCore::controlTrajectory(uint8_t op) {
+    switch (op) {
+    case TRAJ_STOP:
+        traj_state = TRAJ_IDLE;
+        print("Trajectory stopped\n");
+        break;
+    case TRAJ_PLAY:
+    case TRAJ_LOOP:
+        startTrajectory(op == TRAJ_LOOP);
+        break;
+    case TRAJ_ARM:
+        traj_state = TRAJ_ARMED;
+        print("Trajectory armed\n");
+        break;
+    case TRAJ_TRIGGER:
+        if (traj_state == TRAJ_ARMED) {
+            startTrajectory(false);
+        }
+        break;
+    default:
+        print("Unknown trajectory op %d\n", op);
+        break;
+    }
+}
+
+// Advance trajectory playback from the device clock.
+// Called every pass of the main loop, so timing is accurate to the loop period
+// no matter when (or whether) the host sends anything.
+HOT_PATH void ControllerCore::updateTrajectory() {
+    if (traj_state != TRAJ_PLAYING) {
+        return;
+    }
+
+    uint64_t elapsed_us = hal.timeUs() - traj_start_us;
+    uint64_t duration_us = (uint64_t)keyframes[num_keyframes - 1].time_ms * 1000;
+
+    if (elapsed_us >= duration_us) {
+        if (traj_loop && duration_us > 0) {
+            // Keep the phase exact rather than restarting from "now"
+            traj_start_us += duration_us * (elapsed_us / duration_us);
+            elapsed_us %= duration_us;
+            traj_segment = 0;
+        } else {
+            applyPositions(keyframes[num_keyframes - 1].positions, ALL_SERVOS);
+            traj_state = TRAJ_IDLE;
+            print("Trajectory finished\n");
+            return;
+        }
+    }
+
+    // Hold the first keyframe until its start time
+    if (elapsed_us < (uint64_t)keyframes[0].time_ms * 1000) {
+        applyPositions(keyframes[0].positions, ALL_SERVOS);
+        return;
+    }
+
+    while (traj_segment + 1 < num_keyframes && (uint64_t)keyframes[traj_segment + 1].time_ms * 1000 <= elapsed_us) {
+        traj_segment++;
+    }
+
+    // Every channel shares the segment, so interpolate them in one batch
+    const Keyframe& a = keyframes[traj_segment];
+    const Keyframe& b = keyframes[traj_segment + 1];
+    uint32_t span_us = (b.time_ms - a.time_ms) * 1000;
+    uint32_t into_us = (uint32_t)(elapsed_us - (uint64_t)a.time_ms * 1000);
+    int16_t positions[NUM_SERVOS];
+    interpolatePositions(a.positions, b.positions, interpolationFraction(into_us, span_us), positions, NUM_SERVOS);
+    applyPositions(positions, ALL_SERVOS);
+}
+
+// Trajectory commands:
+//   T0  stop            T1  play once        TL  play looping
+//   TA  arm             TG  trigger armed trajectory
+void ControllerCore::handleTrajectoryCommand(const char* command) {
+    switch (command[1]) {
+    case '0': controlTrajectory(TRAJ_STOP); break;
+    case '1': controlTrajectory(TRAJ_PLAY); break;
+    case 'L': controlTrajectory(TRAJ_LOOP); break;
+    case 'A': controlTrajectory(TRAJ_ARM); break;
+    case 'G': controlTrajectory(TRAJ_TRIGGER); break;
+    default:
+        print("Invalid trajectory command: %s\n", command);
+        break;
+    }
+}
+
+// Apply an absolute keyframe, resynchronising the delta stream
+HOT_PATH void ControllerCore::applyKeyframe(const uint8_t* data) {
+    delta_seq = data[0];
+    delta_synced = true;
+    int16_t positions[NUM_SERVOS];
+    uint32_t mask = 0;
+    for (auto s = 0u; s < NUM_SERVOS; s++) {
+        positions[s] = (int16_t)get_u16(data + 1 + s * 2);
+        if (positions[s] >= MIN_ANGLE && positions[s] <= MAX_ANGLE) {
+            mask |= 1u << s;
+        }
+    }
+    applyPositions(positions, mask);
+}
+
+// Apply a delta frame. bits is 8 (one int8 per servo) or 4 (packed nibbles).
+HOT_PATH void ControllerCore::applyDeltas(const uint8_t* data, unsigned bits) {
+    uint8_t seq = data[0];
+    if (!delta_synced) {
+        return;
+    }
+    if (seq != (uint8_t)(delta_seq + 1)) {
+        print("Delta frame %d received, expected %d, waiting for keyframe\n", seq, (uint8_t)(delta_seq + 1));
+        delta_synced = false;
+        return;
+    }
+
+    int16_t targets[NUM_SERVOS];
+    for (auto s = 0u; s < NUM_SERVOS; s++) {
+        int delta;
+        if (bits == 8) {
+            delta = (int8_t)data[1 + s];
+        } else {
+            uint8_t nibble = (data[1 + s / 2] >> ((s & 1) * 4)) & 0x0F;
+            delta = (nibble & 0x08) ? (int)nibble - 16 : nibble;
+        }
+        int target = channels.target[s] + delta;
+        if (target < MIN_ANGLE || target > MAX_ANGLE) {
+            print("Delta frame %d out of range on ch %d, waiting for keyframe\n", seq, s);
+            delta_synced = false;
+            return;
+        }
+        targets[s] = target;
+    }
+
+    delta_seq = seq;
+    uint32_t changed = 0;
+    for (auto s = 0u; s < NUM_SERVOS; s++) {
+        if (targets[s] != channels.target[s]) {
+            changed |= 1u << s;
+        }
+    }
+    applyPositions(targets, changed);
+}
+
+// Decode a FRAME_SET/FRAME_STAGE payload: u32 mask, int16 position per set bit
+HOT_PATH bool ControllerCore::decodeJointFrame(const uint8_t* data, unsigned length, JointFrame& frame) {
+    if (length < 4) {
+        return false;
+    }
+    frame.mask = get_u32(data);
+    unsigned i = 4;
+    for (auto s = 0u; s < NUM_SERVOS; s++) {
+        if (!(frame.mask & (1u << s))) {
+            continue;
+        }
+        if (length - i < 2) {
+            return false;
+        }
+        frame.positions[s] = (int16_t)get_u16(data + i);
+        if (frame.positions[s] < MIN_ANGLE || frame.positions[s] > MAX_ANGLE) {
+            return false;
+        }
+        i += 2;
+    }
+    return i == length && (frame.mask & ~ALL_SERVOS) == 0;
+}
+
+HOT_PATH void ControllerCore::handleBinaryFrame(const SerialFrame& frame) {
+    switch (frame.type) {
+    case FRAME_TRAJ_BEGIN:
+        if (frame.length != 2) {
+            break;
+        }
+        traj_state = TRAJ_IDLE;
+        num_keyframes = 0;
+        expected_keyframes = get_u16(frame.data);
+        if (expected_keyframes > MAX_KEYFRAMES) {
+            print("Trajectory too long (%d keyframes, max %d)\n", expected_keyframes, MAX_KEYFRAMES);
+            expected_keyframes = 0;
+        }
+        return;
+    case FRAME_TRAJ_DATA:
+        if (!decodeKeyframes(frame.data, frame.length)) {
+            print("Bad trajectory data after keyframe %d\n", num_keyframes);
+            expected_keyframes = 0;
+        } else if (num_keyframes == expected_keyframes) {
+            print("Trajectory loaded: %d keyframes, %lu ms\n", num_keyframes,
+                  (unsigned long)keyframes[num_keyframes - 1].time_ms);
+        }
+        return;
+    case FRAME_TRAJ_CONTROL:
+        if (frame.length == 1) {
+            controlTrajectory(frame.data[0]);
+            return;
+        }
+        break;
+    case FRAME_KEYFRAME:
+        if (frame.length == 1 + NUM_SERVOS * 2) {
+            applyKeyframe(frame.data);
+            return;
+        }
+        break;
+    case FRAME_DELTA8:
+        if (frame.length == 1 + NUM_SERVOS) {
+            applyDeltas(frame.data, 8);
+            return;
+        }
+        break;
+    case FRAME_DELTA4:
+        if (frame.length == 1 + (NUM_SERVOS + 1) / 2) {
+            applyDeltas(frame.data, 4);
+            return;
+        }
+        break;
+    case FRAME_SET: {
+        JointFrame joints;
+        if (decodeJointFrame(frame.data, frame.length, joints)) {
+            // Counted first, as when merged, so the tick sees its own SET
+            set_count++;
+            last_set_rx_us = frame.rx_time_us;
+            applyJointFrame(joints);
+            return;
+        }
+        break;
+    }
+    case FRAME_STAGE: {
+        JointFrame joints;
+        if (decodeJointFrame(frame.data, frame.length, joints)) {
+            stageFrame(joints);
+            return;
+        }
+        break;
+    }
+    case FRAME_COMMIT:
+        if (frame.length == 0) {
+            requestCommit();
+            return;
+        }
+        break;
+    case FRAME_SCHEDULE:
+    case FRAME_SCHEDULE_HOST: {
+        JointFrame joints;
+        if (frame.length >= 8 && decodeJointFrame(frame.data + 8, frame.length - 8, joints)) {
+            uint64_t time_us = get_u64(frame.data);
+            if (frame.type == FRAME_SCHEDULE_HOST) {
+                if (!host_clock.valid) {
+                    print("Host-time frame before time sync, dropped\n");
+                    return;
+                }
+                time_us = hostToDeviceTime(time_us);
+            }
+            scheduleFrame(time_us, joints);
+            return;
+        }
+        break;
+    }
+    case FRAME_TELEMETRY_RATE:
+        if (frame.length == 2) {
+            telemetry_period_ms = get_u16(frame.data);
+            next_telemetry_us = hal.timeUs() + (uint64_t)telemetry_period_ms * 1000;
+            return;
+        }
+        break;
+    case FRAME_TIME_REQUEST:
+        if (frame.length == TIME_REQUEST_LENGTH) {
+            handleTimeRequest(frame);
+            return;
+        }
+        break;
+    // Bus frames don't nest
+    case FRAME_BUS:
+        if (bus_node != 0 && bus_reply == 0 && frame.length >= BUS_HEADER) {
+            handleBusFrame(frame);
+            return;
+        }
+        break;
+    case FRAME_BUS_COMMIT:
+        if (bus_node != 0 && bus_reply == 0 && frame.length == BUS_COMMIT_LENGTH) {
+            handleBusCommit(frame);
+            return;
+        }
+        break;
+    case FRAME_BUS_REPLY:
+        if (bus_node != 0 && bus_reply == 0) {
+            bus_stats.others++;  // Another node talking
+            return;
+        }
+        break;
+    default:
+        break;
+    }
+    print("Invalid binary frame (type 0x%02x, %d bytes)\n", frame.type, frame.length);
+}
+
+// Parse an ASCII joint command (ch1,pos1;ch2,pos2;...) into a frame.
+// Invalid entries are reported and skipped.
+HOT_PATH void ControllerCore::parseJointCommand(const char* command, JointFrame& frame) {
+    const char* token = command;
+    frame.mask = 0;
+
+    // Walk the line in place, parseInt() stops at the ',' or ';' after each number
+    while (*token != '\0') {
+        const char* end = token;
+        const char* comma = NULL;
+        for (; *end != '\0' && *end != ';'; end++) {
+            if (*end == ',' && comma == NULL) {
+                comma = end;
+            }
+        }
+        if (comma != NULL) {
+            int channel = parseInt(token);
+            int position = parseInt(comma + 1);
+
+            // Validate channel and position
+            if (channel >= 0 && channel < (int)NUM_SERVOS &&
+                position >= MIN_ANGLE && position <= MAX_ANGLE) {
+                frame.positions[channel] = position;
+                frame.mask |= 1u << channel;
+            } else {
+                print("Invalid channel (%d) or angle (%d) out of range\n", channel, position);
+            }
+        }
+        token = (*end == ';') ? end + 1 : end;
+    }
+}
+
+HOT_PATH void ControllerCore::handleCommands(const char* command) {
+    JointFrame frame;
+    parseJointCommand(command, frame);
+    applyJointCommand(frame);
+}
+
+// Apply joint command lines' targets, with the command LED and debug output
+HOT_PATH void ControllerCore::applyJointCommand(const JointFrame& frame) {
+    // Flash the command LED to indicate command received
+    hal.indicateCommand();
+    if (frame.mask == 0) {
+        return;
+    }
+
+    // Debug: print what we're about to send
+    for (auto channel = 0u; channel < NUM_SERVOS; channel++) {
+        if (frame.mask & (1u << channel)) {
+            DEBUG_LOG("Setting Ch %d to %d° (before: %.1f°)\n", (int)channel, frame.positions[channel],
+                      hal.servoValue(channel));
+        }
+    }
+
+    // Move the servos using direct pulse mapping, the whole line in one tick
+    // as for a SET frame (servoValue() is only used for debug output)
+    applyJointFrame(frame);
+
+    // Debug: print what the servos think they're at now
+    for (auto channel = 0u; channel < NUM_SERVOS; channel++) {
+        if (frame.mask & (1u << channel)) {
+            DEBUG_LOG("Ch %d → %4d° (actual: %.1f°)\n", (int)channel, frame.positions[channel],
+                      hal.servoValue(channel));
+        }
+    }
+}
+
+// Fold a joint frame into merged_frame, newest target per channel wins
+HOT_PATH void ControllerCore::mergeJointFrame(const JointFrame& frame) {
+    for (auto s = 0u; s < NUM_SERVOS; s++) {
+        if (!(frame.mask & (1u << s))) {
+            continue;
+        }
+        if (merged_frame.mask & (1u << s)) {
+            dropped_targets++;
+        }
+        merged_frame.positions[s] = frame.positions[s];
+    }
+    merged_frame.mask |= frame.mask;
+    merged_pending++;
+}
+
+// Merge a joint command into merged_frame, returns false for any other frame
+HOT_PATH bool ControllerCore::coalesceFrame(const SerialFrame& frame) {
+    JointFrame joints;
+    if (frame.binary) {
+        if (frame.type != FRAME_SET || !decodeJointFrame(frame.data, frame.length, joints)) {
+            return false;
+        }
+        set_count++;
+        last_set_rx_us = frame.rx_time_us;
+    } else {
+        char first = frame.data[0];
+        if (!(first >= '0' && first <= '9') && first != '-') {
+            return false;
+        }
+        parseJointCommand((const char*)frame.data, joints);
+        merged_lines++;
+    }
+    mergeJointFrame(joints);
+    return true;
+}
+
+// Apply the merged joint commands, if any. Lines among them show on the LED
+// and console once, as a single line would.
+HOT_PATH void ControllerCore::flushMergedFrame() {
+    if (merged_pending == 0) {
+        return;
+    }
+    if (merged_lines > 0) {
+        applyJointCommand(merged_frame);
+    } else {
+        applyJointFrame(merged_frame);
+    }
+    merged_frames += merged_pending - 1;
+    merged_frame.mask = 0;
+    merged_pending = 0;
+    merged_lines = 0;
+}
+
+// Move everything received into the RX ring
+HOT_PATH void ControllerCore::fillRxRing() {
+    while (rx_head - rx_tail < RX_RING_SIZE) {
+        int c = hal.readByte();
+        if (c < 0) {
+            return; // No more data available
+        }
+        rx_ring[rx_head++ & (RX_RING_SIZE - 1)] = (uint8_t)c;
+        rx_stats.bytes++;
+    }
+    rx_stats.ring_full++;
+}
+
+// Check a frame's sequence number, returns false if it should be dropped
+HOT_PATH bool ControllerCore::checkSequence(uint8_t seq) {
+    int8_t diff = (int8_t)(seq - rx_seq_expected);
+    if (!rx_seq_valid || diff <= -SEQ_REORDER_WINDOW) {
+        if (rx_seq_valid) {
+            rx_stats.seq_resync++;
+        }
+        rx_seq_valid = true;
+    } else if (diff < 0) {
+        rx_stats.seq_stale++;
+        return false;
+    } else {
+        rx_stats.seq_lost += diff;
+    }
+    rx_seq_expected = seq + 1;
+    return true;
+}
+
+// Verify and strip the "#seq" / "*XX" suffix of an ASCII line
+HOT_PATH bool ControllerCore::acceptLine(SerialFrame& frame, unsigned length) {
+    char* line = (char*)frame.data;
+    char* star = (length >= 3 && line[length - 3] == '*') ? &line[length - 3] : NULL;
+    if (star == NULL) {
+        if (require_integrity) {
+            rx_stats.unchecked++;
+            return false;
+        }
+    } else {
+        int high = hexDigit(star[1]);
+        int low = hexDigit(star[2]);
+        if (high < 0 || low < 0 || line_checksum(line, star - line) != (high << 4 | low)) {
+            rx_stats.crc_errors++;
+            return false;
+        }
+        *star = '\0';
+    }
+
+    char* hash = NULL;
+    for (char* c = line; *c != '\0'; c++) {
+        if (*c == '#') {
+            hash = c;
+        }
+    }
+    if (hash != NULL) {
+        *hash = '\0';
+        return checkSequence((uint8_t)parseInt(hash + 1));
+    }
+    return true;
+}
+
+// Check a completed binary frame's CRC and sequence number
+HOT_PATH bool ControllerCore::acceptBinaryFrame(SerialFrame& frame, uint8_t seq, bool crc_ok) {
+    if (!(frame.type & FRAME_CHECKED)) {
+        if (require_integrity) {
+            rx_stats.unchecked++;
+            return false;
+        }
+        return true;
+    }
+    if (!crc_ok) {
+        rx_stats.crc_errors++;
+        return false;
+    }
+    if (!checkSequence(seq)) {
+        return false;
+    }
+    frame.type &= ~FRAME_CHECKED;
+    return true;
+}
+
+// Read ASCII lines and binary frames from the input.
+// Returns a complete frame, or NULL if none is available yet.
+HOT_PATH SerialFrame* ControllerCore::readSerialFrame() {
+    SerialFrame& frame = rx_frame;
+
+    fillRxRing();
+    unsigned buffered = rx_head - rx_tail;
+    if (buffered > rx_stats.ring_high_water) {
+        rx_stats.ring_high_water = buffered;
+    }
+
+    uint64_t now = hal.timeUs();
+    // Every frame may be answered, so none is parsed without room for the reply
+    if ((buffered > 0 || rx_state == RX_COPYING) && !hal.replyRoom()) {
+        rx_stats.reply_held++;
+        return NULL;
+    }
+    if (rx_state == RX_COPYING) {
+        // The copy's bytes stay in the ring (rx_tail holds them) until it is
+        // done. The frame arrived when it was started.
+        if (!hal.ringCopyDone(rx_crc) || !payloadCopied(rx_copying)) {
+            return NULL;
+        }
+        if (!rx_checked) {
+            SerialFrame* complete = completeBinaryFrame(rx_copy_us);
+            if (complete != NULL) {
+                return complete;
+            }
+        }
+        buffered = rx_head - rx_tail;
+    }
+    bool in_binary = rx_state != RX_LINE && rx_state != RX_DISCARD_LINE;
+    if (buffered == 0) {
+        // Drop a binary frame the host stopped sending part way through
+        if (in_binary && now - rx_last_byte_us > hal.frameTimeoutUs()) {
+            rx_stats.timeouts++;
+            rx_pos = 0;
+            rx_state = RX_LINE;
+        }
+        return NULL;
+    }
+    rx_last_byte_us = now;
+
+    while (rx_tail != rx_head) {
+        // Payloads are copied in bulk rather than a byte at a time
+        if (rx_state == RX_PAYLOAD) {
+            unsigned count = frame.length - rx_pos;
+            if (count > rx_head - rx_tail) {
+                count = rx_head - rx_tail;
+            }
+            // In the background if the HAL can, while the main loop gets on
+            // with the trajectory
+            if (hal.startRingCopy(rx_ring, rx_tail, RX_RING_SIZE - 1, frame.data + rx_pos, count, rx_crc)) {
+                rx_copying = count;
+                rx_copy_us = now;
+                rx_state = RX_COPYING;
+                return NULL;
+            }
+            rx_crc = hal.copyFromRing(rx_ring, rx_tail, RX_RING_SIZE - 1, frame.data + rx_pos, count,
+                                      rx_crc, rx_checked);
+            if (!payloadCopied(count)) {
+                break;
+            }
+            if (rx_checked) {
+                continue;
+            }
+        } else {
+            uint8_t c = rx_ring[rx_tail++ & (RX_RING_SIZE - 1)];
+
+            switch (rx_state) {
+            case RX_LINE:
+                if (c == '\n' || c == '\r') {
+                    if (rx_line_corrupt) {
+                        rx_stats.corrupt_lines++;
+                        rx_line_corrupt = false;
+                        rx_pos = 0;
+                    } else if (rx_pos > 0) {
+                        unsigned length = rx_pos;
+                        rx_pos = 0;
+                        frame.binary = false;
+                        frame.rx_time_us = now;
+                        frame.data[length] = '\0';
+                        rx_stats.lines++;
+                        if (acceptLine(frame, length)) {
+                            return &frame;
+                        }
+                    }
+                } else if (c == FRAME_SYNC && rx_pos == 0) {
+                    // Only noise since the last line: the frame is not part of it
+                    rx_line_corrupt = false;
+                    rx_state = RX_TYPE;
+                } else if (c < 32 || c > 126) { // Printable characters only, anywhere in the line
+                    rx_stats.nonprintable++;
+                    rx_line_corrupt = true;
+                } else if (rx_pos < RX_LINE_MAX) {
+                    frame.data[rx_pos++] = c;
+                } else {
+                    rx_stats.overlong++;
+                    rx_pos = 0;
+                    rx_line_corrupt = false;
+                    rx_state = RX_DISCARD_LINE;
+                }
+                continue;
+            case RX_DISCARD_LINE:
+                if (c == '\n' || c == '\r') {
+                    rx_state = RX_LINE;
+                }
+                continue;
+            case RX_TYPE:
+                frame.type = c;
+                rx_checked = (c & FRAME_CHECKED) != 0;
+                rx_crc = crc16_update(CRC16_INIT, c);
+                rx_state = RX_LENGTH;
+                continue;
+            case RX_LENGTH:
+                frame.length = c;
+                rx_crc = crc16_update(rx_crc, c);
+                rx_pos = 0;
+                rx_state = rx_checked ? RX_SEQ : (frame.length > 0 ? RX_PAYLOAD : RX_LINE);
+                if (rx_state != RX_LINE) {
+                    continue;
+                }
+                break;
+            case RX_SEQ:
+                rx_seq = c;
+                rx_crc = crc16_update(rx_crc, c);
+                rx_state = frame.length > 0 ? RX_PAYLOAD : RX_CRC;
+                continue;
+            case RX_CRC:
+                if (rx_pos == 0) {
+                    rx_crc_received = c;
+                    rx_pos = 1;
+                    continue;
+                }
+                rx_crc_received |= c << 8;
+                rx_pos = 0;
+                rx_state = RX_LINE;
+                break;
+            case RX_PAYLOAD:
+            case RX_COPYING:
+                continue; // Handled above
+            }
+        }
+
+        SerialFrame* complete = completeBinaryFrame(now);
+        if (complete != NULL) {
+            return complete;
+        }
+    }
+
+    return NULL; // No complete frame yet
+}
+
+// count more payload bytes are in the frame. Returns true once it has all of them.
+HOT_PATH bool ControllerCore::payloadCopied(unsigned count) {
+    rx_tail += count;
+    rx_pos += count;
+    if (rx_pos < rx_frame.length) {
+        rx_state = RX_PAYLOAD;
+        return false;
+    }
+    rx_pos = 0;
+    rx_state = rx_checked ? RX_CRC : RX_LINE;
+    return true;
+}
+
+// A binary frame is complete: the frame, or NULL if it was rejected
+HOT_PATH SerialFrame* ControllerCore::completeBinaryFrame(uint64_t now) {
+    SerialFrame& frame = rx_frame;
+    frame.binary = true;
+    frame.rx_time_us = now;
+    rx_stats.binary_frames++;
+    return acceptBinaryFrame(frame, rx_seq, rx_crc == rx_crc_received) ? &frame : NULL;
+}
+
+// Print receive path counters
+void ControllerCore::printStats() {
+    print("RX: %lu bytes, %lu lines, %lu binary frames, ring %d/%d (high water %d, full %lu, held for replies %lu)\n",
+          (unsigned long)rx_stats.bytes, (unsigned long)rx_stats.lines, (unsigned long)rx_stats.binary_frames,
+          rx_head - rx_tail, RX_RING_SIZE, rx_stats.ring_high_water, (unsigned long)rx_stats.ring_full,
+          (unsigned long)rx_stats.reply_held);
+    print("RX errors: %lu overlong (max %d), %lu non-printable bytes, %lu corrupt lines, %lu timeouts\n",
+          (unsigned long)rx_stats.overlong, RX_LINE_MAX, (unsigned long)rx_stats.nonprintable,
+          (unsigned long)rx_stats.corrupt_lines, (unsigned long)rx_stats.timeouts);
+    print("Integrity%s: %lu CRC errors, %lu unchecked rejected, seq %lu lost, %lu stale, %lu resync\n",
+          require_integrity ? " (required)" : "", (unsigned long)rx_stats.crc_errors,
+          (unsigned long)rx_stats.unchecked, (unsigned long)rx_stats.seq_lost,
+          (unsigned long)rx_stats.seq_stale, (unsigned long)rx_stats.seq_resync);
+    print("Control tick: %lu updates (%lu targets), %lu cycles each, %lu per channel\n",
+          (unsigned long)tick_count, (unsigned long)tick_targets,
+          (unsigned long)(tick_count ? tick_cycles / tick_count : 0),
+          (unsigned long)(tick_count ? tick_cycles / tick_count / NUM_SERVOS : 0));
+    hal.printStats();
+}
+
+// Channel commands:
+//   J?                                         channel table
+//   J<ch>,<min>,<max>                          limit the output range (degrees)
+//   J<ch>,<min>,<max>,<centre_us>,<range_us>   ... and calibrate: pulse at 0°, change per 140°
+void ControllerCore::handleChannelCommand(const char* command) {
+    if (command[1] == '?') {
+        for (auto s = 0u; s < NUM_SERVOS; s++) {
+            print("Ch %2u: target %4d current %4d %6d°/s limits %4d..%-4d pulse %7.2fµs (0° %7.2fµs, x%.4f)%s\n", s,
+                  channels.target[s], channels.current[s], (int)channels.velocity(s), channels.min_angle[s],
+                  channels.max_angle[s], channels.pulse_q4[s] / 16.0f, channels.centre_q4[s] / 16.0f,
+                  (float)channels.scale_q16[s] / PULSE_PER_DEGREE_Q16,
+                  (channels.flags[s] & CHANNEL_CLAMPED) ? " clamped" : "");
+        }
+        return;
+    }
+
+    int fields[5] = {0, 0, 0, 1500, 500};
+    unsigned num_fields = 0;
+    for (const char* c = command + 1; num_fields < 5; c++) {
+        fields[num_fields++] = atoi(c);
+        c = strchr(c, ',');
+        if (c == NULL) {
+            break;
+        }
+    }
+    int channel = fields[0];
+    int min_angle = fields[1];
+    int max_angle = fields[2];
+    int centre_us = fields[3];
+    int range_us = fields[4];
+    if ((num_fields != 3 && num_fields != 5) || channel < 0 || channel >= (int)NUM_SERVOS ||
+        min_angle < MIN_ANGLE || max_angle > MAX_ANGLE || min_angle > max_angle ||
+        range_us <= 0 || centre_us - range_us < 500 || centre_us + range_us > 2500) {
+        print("Invalid channel command: %s\n", command);
+        return;
+    }
+
+    // An interrupt's tick must see the old calibration or the new one, not half of each
+    uint32_t ints = hal.disableInterrupts();
+    channels.min_angle[channel] = min_angle;
+    channels.max_angle[channel] = max_angle;
+    channels.centre_q4[channel] = centre_us << PULSE_FRAC_BITS;
+    channels.scale_q16[channel] = pulseScaleForRange(range_us);
+    bool calibrated = centre_us != 1500 || range_us != 500;
+    channels.flags[channel] = calibrated ? (channels.flags[channel] | CHANNEL_CALIBRATED)
+                                         : (channels.flags[channel] & ~CHANNEL_CALIBRATED);
+    // Re-apply the last target under the new limits and calibration
+    applyPositions(channels.target, 1u << channel);
+    hal.restoreInterrupts(ints);
+    print("Ch %d: limits %d..%d°, 0° at %dµs, %dµs per 140°\n", channel, min_angle, max_angle, centre_us, range_us);
+}
+
+// Everything the core needs is a member, so its RAM is fixed at build time
+void ControllerCore::printMemory() {
+    print("Controller core: %u bytes\n", (unsigned)sizeof(*this));
+    print("  RX ring %u, frame buffers %u, keyframes %u, pose table %u, schedule queue %u, other %u\n",
+          (unsigned)sizeof(rx_ring), (unsigned)(sizeof(rx_frame) + sizeof(bus_frame)), (unsigned)sizeof(keyframes),
+          (unsigned)sizeof(pose_table), (unsigned)sizeof(schedule_queue),
+          (unsigned)(sizeof(*this) - sizeof(rx_ring) - sizeof(rx_frame) - sizeof(bus_frame) - sizeof(keyframes) -
+                     sizeof(pose_table) - sizeof(schedule_queue)));
+    hal.printMemory();
+}
+
+// Dispatch an ASCII command line on its first character
+HOT_PATH void ControllerCore::handleLine(const char* command) {
+    switch (command[0]) {
+    case 'P':
+    case 'S':
+    case 'L':
+        handlePoseCommand(command);
+        break;
+    case 'T':
+        handleTrajectoryCommand(command);
+        break;
+    case 'Y':
+        handleSyncCommand(command);
+        break;
+    case 'V':
+        debug_output = command[1] == '0' ? DEBUG_OFF : command[1] == '2' ? DEBUG_DEFERRED : DEBUG_TEXT;
+        break;
+    case '?':
+        printStats();
+        break;
+    case 'M':
+        printMemory();
+        break;
+    case 'J':
+        handleChannelCommand(command);
+        break;
+    case 'K':
+        require_integrity = (command[1] != '0');
+        print("Integrity checks %s\n", require_integrity ? "required" : "optional");
+        break;
+    case 'C':
+        coalesce_input = (command[1] != '0');
+        print("Input coalescing %s\n", coalesce_input ? "on" : "off");
+        break;
+    case 'N':
+        handleBusCommand(command);
+        break;
+    default:
+        if (!hal.handleCommand(command)) {
+            handleCommands(command);
+        }
+        break;
+    }
+}
+
+HOT_PATH bool ControllerCore::poll() {
+    // Advance trajectory playback before handling new input
+    updateTrajectory();
+    updateTelemetry();
+
+    bool had_input = false;
+
+    // Process all available input without delays
+    for (int i = 0; i < 100; i++) { // Check up to 100 times per cycle
+        SerialFrame* frame = readSerialFrame();
+        if (frame == NULL) {
+            break; // No more input available
+        }
+        if (coalesce_input && coalesceFrame(*frame)) {
+            // Applied with the rest of the batch below
+        } else if (frame->binary) {
+            flushMergedFrame();
+            handleBinaryFrame(*frame);
+        } else {
+            flushMergedFrame();
+            handleLine((const char*)frame->data);
+        }
+        had_input = true;
+    }
+
+    flushMergedFrame();
+    return had_input || rx_state == RX_COPYING;
+}
@@ -0,0 +1,510 @@
+#pragma once
+#include <cstdarg>
+#include <cstdint>
+
+#include "deferred_log.hpp"
+#include "protocol.hpp"
+#include "pulse_kernel.hpp"
+
+/*
+Servo2040 controller core
+
+Everything the firmware does with the command stream: input framing and
+integrity checks, poses, trajectories, delta streams, multi-board sync,
+scheduled frames, host time sync, telemetry and input coalescing. It only
+reaches the board through ControllerHal, so the same code builds on the host
+for trace replay and simulation.
+*/
+
+const unsigned NUM_SERVOS = protocol::NUM_CHANNELS;
+const unsigned NUM_BOARD_SERVOS = protocol::NUM_BOARD_CHANNELS;   // The rest are expansion channels
+const uint32_t ALL_SERVOS = protocol::ALL_CHANNELS;
+
+// Per-channel state
+// One array per field with the channels contiguous, so the control tick scans
+// each field linearly and hands whole arrays to the pulse kernel. The table is
+// part of the core object, which lives in the RP2040's striped main SRAM.
+// Limits clamp what is output (commands outside the protocol's ±140° are still
+// rejected); calibration maps degrees to pulse widths.
+enum ChannelFlags : uint8_t {
+    CHANNEL_CLAMPED = 0x01,     // Target is outside the limits, output is clamped
+    CHANNEL_CALIBRATED = 0x02,  // Calibration differs from the default mapping
+};
+
+struct ChannelTable {
+    // Hot: every tick
+    int16_t target[NUM_SERVOS];      // Last commanded position (degrees)
+    int16_t current[NUM_SERVOS];     // Position being output: target clamped to the limits
+    uint16_t pulse_q4[NUM_SERVOS];   // Pulse width being output (1/16 µs)
+    int16_t min_angle[NUM_SERVOS];
+    int16_t max_angle[NUM_SERVOS];
+    int32_t scale_q16[NUM_SERVOS];   // Calibration, see pulseFromPosition()
+    uint16_t centre_q4[NUM_SERVOS];
+    // When current changes. Velocity is kept as the last step and how long it
+    // took, so the tick never divides.
+    int16_t last_step[NUM_SERVOS];   // Degrees
+    uint32_t step_us[NUM_SERVOS];    // Time since the change before it
+    uint32_t changed_us[NUM_SERVOS]; // Low 32 bits of the device time of the last change
+    uint8_t flags[NUM_SERVOS];
+
+    // °/s over the last change
+    int32_t velocity(unsigned s) const {
+        return step_us[s] ? (int32_t)((int64_t)last_step[s] * 1000000 / step_us[s]) : 0;
+    }
+};
+
+// Receive path
+// Bytes are drained into a ring buffer and framed from there. Lines longer
+// than RX_LINE_MAX, lines containing non-printable bytes and binary frames
+// that stall part way are discarded whole and counted, never truncated.
+// Sizes can be set from CMake (SERVO2040_RX_RING_SIZE / SERVO2040_RX_LINE_MAX).
+#ifndef SERVO2040_RX_RING_SIZE
+#define SERVO2040_RX_RING_SIZE 2048
+#endif
+#ifndef SERVO2040_RX_LINE_MAX
+#define SERVO2040_RX_LINE_MAX 512
+#endif
+const unsigned RX_RING_SIZE = SERVO2040_RX_RING_SIZE;
+const unsigned RX_LINE_MAX = SERVO2040_RX_LINE_MAX;  // Longest ASCII line, excluding the line ending
+const unsigned RX_FRAME_DATA_SIZE = (RX_LINE_MAX > protocol::MAX_FRAME_PAYLOAD ? RX_LINE_MAX : protocol::MAX_FRAME_PAYLOAD) + 1;
+const uint64_t RX_FRAME_TIMEOUT_US = 20000;          // Max gap between bytes of a binary frame (USB)
+static_assert((RX_RING_SIZE & (RX_RING_SIZE - 1)) == 0, "RX ring size must be a power of two");
+static_assert(RX_RING_SIZE <= 32768, "DMA can only wrap reads within 32 KB");
+
+// A complete frame as returned by readSerialFrame()
+struct SerialFrame {
+    bool binary;
+    uint8_t type;       // Binary frames only
+    uint8_t length;     // Binary payload length
+    uint64_t rx_time_us; // When the last byte arrived
+    uint8_t data[RX_FRAME_DATA_SIZE]; // Payload, or null-terminated line for ASCII
+};
+
+struct RxStats {
+    uint32_t bytes;
+    uint32_t lines;
+    uint32_t binary_frames;
+    uint32_t overlong;      // Lines discarded for exceeding RX_LINE_MAX
+    uint32_t nonprintable;  // Non-printable bytes seen in ASCII input
+    uint32_t corrupt_lines; // Lines discarded for containing non-printable bytes
+    uint32_t timeouts;      // Binary frames discarded after stalling
+    uint32_t ring_full;     // Times the ring filled up (input is back-pressured, nothing is lost)
+    uint32_t reply_held;    // Passes that left input unparsed for lack of reply space
+    unsigned ring_high_water;
+    uint32_t crc_errors;    // Checked binary frames / ASCII lines that failed their CRC/checksum
+    uint32_t unchecked;     // Frames without a CRC/checksum rejected because K1 is on
+    uint32_t seq_lost;      // Sequence numbers skipped
+    uint32_t seq_stale;     // Reordered or duplicated frames dropped
+    uint32_t seq_resync;    // Sequence jumped back (host restarted)
+};
+
+// RS-485 bus mode (N<node>), see protocol.hpp
+struct BusStats {
+    uint32_t frames;        // FRAME_BUS addressed to this node or broadcast
+    uint32_t others;        // Frames for other nodes, and their replies
+    uint32_t commits;
+    uint32_t replies;       // Sent on the bus, slot telemetry included
+    uint32_t dropped_replies; // Answers to broadcasts, which nobody may send
+};
+
+// Pose library
+// The board keeps the table in non-volatile storage so it survives a power
+// cycle. Until a pose is saved the built-in defaults are used.
+const unsigned NUM_POSES = 16;          // Addressable pose slots (0-15)
+const unsigned POSE_NAME_LEN = 12;      // Including terminating null
+// "POSE", changed by expansion channels so a table saved for another channel
+// count is not loaded
+const uint32_t POSE_MAGIC = 0x45534F50 + (protocol::NUM_EXPANSION_CHANNELS << 24);
+
+struct Pose {
+    char name[POSE_NAME_LEN];
+    int16_t positions[NUM_SERVOS];
+};
+
+struct PoseTable {
+    uint32_t magic;
+    uint32_t count;
+    Pose poses[NUM_POSES];
+};
+
+// Trajectory buffer
+// Keyframes are stored decoded (absolute positions) so playback only interpolates
+const unsigned MAX_KEYFRAMES = 512;
+
+struct Keyframe {
+    uint32_t time_ms;                // Time since trajectory start
+    int16_t positions[NUM_SERVOS];
+};
+
+enum TrajectoryState {
+    TRAJ_IDLE,
+    TRAJ_ARMED,
+    TRAJ_PLAYING,
+};
+
+// Multi-board synchronisation
+// Frames are staged on every board, then the master pulses a shared sync line
+// and all boards commit the staged frame from the rising-edge interrupt.
+enum SyncRole {
+    SYNC_OFF,      // Commit immediately on the commit command
+    SYNC_MASTER,   // Commit command drives the sync line
+    SYNC_SLAVE,    // Commit only on the sync line
+};
+
+// Positions for a subset of channels
+struct JointFrame {
+    uint32_t mask;   // bit n = channel n
+    int16_t positions[NUM_SERVOS];
+};
+
+// Scheduled frames
+// Frames stamped with a device time wait in a time-ordered queue and are
+// applied from an alarm at that instant, so input jitter only affects when
+// they arrive, not when they take effect.
+const unsigned SCHEDULE_QUEUE_LEN = 8;
+
+struct ScheduledFrame {
+    uint64_t time_us;
+    JointFrame joints;
+};
+
+// Host clock synchronisation
+// The host runs an NTP-style ping/pong (FRAME_TIME_REQUEST/REPLY) and filters
+// the offset and drift between its clock and the device clock. It sends its
+// current estimate back with every request, so the device can convert host
+// timestamps (FRAME_SCHEDULE_HOST) without any filtering of its own.
+struct ClockEstimate {
+    bool valid;
+    uint64_t host_ref_us;  // Host time the estimate refers to
+    int64_t offset_us;     // device time - host time at host_ref_us
+    int32_t drift_ppb;     // Device clock rate relative to host, parts per billion
+};
+
+// Copy with the CPU, updating crc if with_crc is set.
+// src is masked with src_mask so the copy can wrap around the RX ring.
+uint16_t cpuCopy(const uint8_t* src, unsigned src_index, unsigned src_mask, uint8_t* dst, unsigned count,
+                 uint16_t crc, bool with_crc);
+
+// What the core needs from the board (or from a host-side stand-in)
+class ControllerHal {
+public:
+    virtual ~ControllerHal() = default;
+
+    // Monotonic device clock
+    virtual uint64_t timeUs() = 0;
+
+    // Next received byte, or -1 if none is waiting
+    virtual int readByte() = 0;
+
+    // Longest gap allowed inside a binary frame on the link input is coming from
+    virtual uint64_t frameTimeoutUs() { return RX_FRAME_TIMEOUT_US; }
+
+    // Raw output to the host (binary frames, no CR/LF translation)
+    virtual void write(const uint8_t* data, unsigned length) = 0;
+
+    // Telemetry frames, which a board may send on a separate channel so they
+    // never queue ahead of a reply
+    virtual void writeTelemetry(const uint8_t* data, unsigned length) { write(data, length); }
+
+    // Console text to the host
+    virtual void vprint(const char* format, va_list args) = 0;
+
+    // A deferred log record (see deferred_log.hpp): the site's format string
+    // and its packed argument words. Dropped if the board has nowhere to put it.
+    virtual void logRecord(const char* site, const uint32_t* words, unsigned count) {
+        (void)site;
+        (void)words;
+        (void)count;
+    }
+
+    // Drive servo outputs (pulse widths in 1/16 µs, see pulse_kernel.hpp), and
+    // read back what a servo reports (debug output only)
+    virtual void setPulse(unsigned channel, uint16_t pulse_q4) = 0;
+    virtual void setPulses(const uint16_t* pulses_q4, uint32_t mask) {
+        for (auto s = 0u; s < NUM_SERVOS; s++) {
+            if (mask & (1u << s)) {
+                setPulse(s, pulses_q4[s]);
+            }
+        }
+    }
+    virtual float servoValue(unsigned channel) = 0;
+
+    // Free-running counter for timing the control tick: CPU cycles on the
+    // board, nanoseconds on the host. 0 if there is none.
+    virtual uint32_t cycleCount() { return 0; }
+    virtual uint32_t cyclesSince(uint32_t start) { return cycleCount() - start; }
+
+    // Non-volatile pose storage. loadPoses returns false if nothing valid is stored.
+    virtual bool loadPoses(PoseTable& table) = 0;
+    virtual void storePoses(const PoseTable& table) = 0;
+
+    // Guard state shared with commitStagedFrame()/runScheduledFrames() when
+    // those run from interrupts
+    virtual uint32_t disableInterrupts() { return 0; }
+    virtual void restoreInterrupts(uint32_t state) { (void)state; }
+
+    // RS-485 bus: turn bus mode on or off, and send a frame at device time at_us
+    // (as soon as possible if that has passed), driving the transceiver around it
+    virtual void setBusMode(bool on) { (void)on; }
+    virtual void busTransmit(const uint8_t* data, unsigned length, uint64_t at_us) {
+        (void)at_us;
+        write(data, length);
+    }
+
+    // Sync line: configure for a role, pulse it (master), restart PWM counters
+    virtual void setSyncRole(SyncRole role) { (void)role; }
+    virtual void pulseSyncLine() {}
+    virtual void alignPwmPhase() {}
+
+    // Call runScheduledFrames() at time_us. Returns true if that time has
+    // already passed, in which case no alarm is set.
+    virtual bool setAlarm(uint64_t time_us) = 0;
+    virtual void cancelAlarm() = 0;
+
+    // Copy count bytes starting at ring[index & mask], returning the updated CRC
+    virtual uint16_t copyFromRing(const uint8_t* ring, unsigned index, unsigned mask, uint8_t* dst,
+                                  unsigned count, uint16_t crc, bool with_crc) {
+        return cpuCopy(ring, index, mask, dst, count, crc, with_crc);
+    }
+
+    // Start the same copy in the background (the CRC always carried on), for
+    // ringCopyDone() to finish. Returns false if it must be done by copyFromRing.
+    virtual bool startRingCopy(const uint8_t* ring, unsigned index, unsigned mask, uint8_t* dst,
+                               unsigned count, uint16_t crc) {
+        (void)ring; (void)index; (void)mask; (void)dst; (void)count; (void)crc;
+        return false;
+    }
+
+    // True once the background copy has finished, with its updated CRC
+    virtual bool ringCopyDone(uint16_t& crc) { (void)crc; return true; }
+
+    // Room to send the replies to one more frame. While false the core leaves
+    // its input unparsed, so replies are held back per frame, not per byte read.
+    virtual bool replyRoom() { return true; }
+
+    // Board-specific ASCII commands, returns false if command isn't one
+    virtual bool handleCommand(const char* command) { (void)command; return false; }
+
+    // Extra lines for the ? command
+    virtual void printStats() {}
+
+    // Board RAM use for the M command, after the core's own
+    virtual void printMemory() {}
+
+    // An ASCII joint command arrived (command LED)
+    virtual void indicateCommand() {}
+};
+
+// Per-command debug output (V0/V1/V2)
+enum DebugOutput {
+    DEBUG_OFF,
+    DEBUG_TEXT,       // Formatted on the device
+    DEBUG_DEFERRED,   // Sent as FRAME_LOG records, formatted by the host
+};
+
+class ControllerCore {
+public:
+    explicit ControllerCore(ControllerHal& hal);
+
+    ControllerCore(const ControllerCore&) = delete;
+    ControllerCore& operator=(const ControllerCore&) = delete;
+
+    // Load stored poses and centre every servo
+    void begin();
+
+    // One pass of the main loop: advance trajectory and telemetry, then handle
+    // all waiting input. Returns true if any input was handled, or a payload
+    // is still being copied in the background (the loop shouldn't sleep).
+    bool poll();
+
+    // Apply the staged frame. Called from syncEdge(), or directly when sync is off.
+    void commitStagedFrame();
+
+    // The sync line's rising-edge interrupt, on the master and the slaves
+    void syncEdge();
+
+    // Apply every queued frame that is due, then re-arm the alarm for the next one.
+    // Called from the alarm, and with interrupts disabled after inserting.
+    void runScheduledFrames();
+
+    void handleLine(const char* command);
+    void handleBinaryFrame(const SerialFrame& frame);
+
+    // Join an RS-485 bus as node 1-BUS_MAX_NODES, or leave it with 0
+    void setBusNode(unsigned node);
+    unsigned busNode() const { return bus_node; }
+    const BusStats& busStats() const { return bus_stats; }
+
+    int position(unsigned channel) const { return channels.current[channel]; }
+    const ChannelTable& channelTable() const { return channels; }
+    const RxStats& rxStats() const { return rx_stats; }
+    uint32_t setCount() const { return set_count; }
+
+    void print(const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+    // Record a deferred log site, see DEBUG_LOG in controller_core.cpp
+    template <typename... Args>
+    HOT_PATH void logDeferred(const char* site, Args... args) {
+        uint32_t words[protocol::LOG_MAX_ARGS];
+        hal.logRecord(site, words, deferred_log::packArgs(words, args...));
+    }
+
+private:
+    // Poses
+    void loadPoses();
+    int findPose(const char* ref);
+    void applyPoseBlend(unsigned a, unsigned b, int t);
+    void handlePoseCommand(const char* command);
+
+    // Joint output
+    void applyPositions(const int16_t* positions, uint32_t mask);
+    void applyJointFrame(const JointFrame& frame);
+    void resetChannels();
+    void handleChannelCommand(const char* command);
+    bool decodeJointFrame(const uint8_t* data, unsigned length, JointFrame& frame);
+    void parseJointCommand(const char* command, JointFrame& frame);
+    void handleCommands(const char* command);
+    void applyJointCommand(const JointFrame& frame);
+
+    // Trajectories and delta streams
+    bool decodeKeyframes(const uint8_t* data, unsigned length);
+    void startTrajectory(bool loop);
+    void controlTrajectory(uint8_t op);
+    void updateTrajectory();
+    void handleTrajectoryCommand(const char* command);
+    void applyKeyframe(const uint8_t* data);
+    void applyDeltas(const uint8_t* data, unsigned bits);
+
+    // Sync and scheduling
+    void setSyncRole(SyncRole role);
+    void stageFrame(const JointFrame& frame);
+    void requestCommit();
+    void scheduleFrame(uint64_t time_us, const JointFrame& joints);
+    void handleSyncCommand(const char* command);
+
+    // Host link
+    void sendBinaryFrame(uint8_t type, const uint8_t* payload, uint8_t length);
+    void handleTimeRequest(const SerialFrame& frame);
+    uint64_t hostToDeviceTime(uint64_t host_us);
+    void fillTelemetry(uint8_t* payload);
+    void sendTelemetry();
+    void updateTelemetry();
+
+    // RS-485 bus
+    void handleBusFrame(const SerialFrame& frame);
+    void handleBusCommit(const SerialFrame& frame);
+    void sendBusReply(uint8_t type, const uint8_t* payload, uint8_t length, uint64_t at_us);
+    void handleBusCommand(const char* command);
+
+    // Input coalescing
+    void mergeJointFrame(const JointFrame& frame);
+    bool coalesceFrame(const SerialFrame& frame);
+    void flushMergedFrame();
+
+    // Receive path
+    void fillRxRing();
+    bool checkSequence(uint8_t seq);
+    bool acceptLine(SerialFrame& frame, unsigned length);
+    bool acceptBinaryFrame(SerialFrame& frame, uint8_t seq, bool crc_ok);
+    SerialFrame* readSerialFrame();
+    bool payloadCopied(unsigned count);
+    SerialFrame* completeBinaryFrame(uint64_t now);
+    void printStats();
+    void printMemory();
+
+    ControllerHal& hal;
+
+    // Aligned to its size so DMA reads can wrap around it
+    alignas(RX_RING_SIZE) uint8_t rx_ring[RX_RING_SIZE];
+    unsigned rx_head = 0;   // Next byte to write
+    unsigned rx_tail = 0;   // Next byte to frame
+    RxStats rx_stats = {};
+
+    // readSerialFrame() parser state
+    enum RxState { RX_LINE, RX_DISCARD_LINE, RX_TYPE, RX_LENGTH, RX_SEQ, RX_PAYLOAD, RX_COPYING, RX_CRC };
+    SerialFrame rx_frame;
+    RxState rx_state = RX_LINE;
+    unsigned rx_pos = 0;
+    unsigned rx_copying = 0;         // Bytes of the background copy (RX_COPYING)
+    uint64_t rx_copy_us = 0;         // When it was started
+    bool rx_line_corrupt = false;
+    uint64_t rx_last_byte_us = 0;
+    bool rx_checked = false;         // Binary frame carries seq and CRC
+    uint8_t rx_seq = 0;
+    uint16_t rx_crc = 0;             // Running CRC of the frame
+    uint16_t rx_crc_received = 0;
+
+    // Integrity checking (K1/K0)
+    // Frames carrying a CRC/checksum are always verified; with K1 frames without
+    // one are rejected too. Sequence numbers are shared by ASCII and binary frames.
+    bool require_integrity = false;
+    bool rx_seq_valid = false;
+    uint8_t rx_seq_expected = 0;
+
+    ChannelTable channels;
+
+    // Control tick cost (? command). Every tick maps the whole table, however
+    // many targets it takes, so the cost per channel is per table entry.
+    uint32_t tick_count = 0;
+    uint32_t tick_targets = 0;
+    uint64_t tick_cycles = 0;
+
+    // Working copy of the pose table (loaded from storage by begin())
+    PoseTable pose_table;
+
+    Keyframe keyframes[MAX_KEYFRAMES];
+    unsigned num_keyframes = 0;
+    unsigned expected_keyframes = 0;
+    TrajectoryState traj_state = TRAJ_IDLE;
+    bool traj_loop = false;
+    uint64_t traj_start_us = 0;
+    unsigned traj_segment = 0;   // Index of the keyframe at the start of the current segment
+
+    // Delta frame stream
+    // Deltas are applied against the channel targets. Every keyframe/delta frame
+    // carries a sequence number; after a gap deltas are ignored until the next
+    // keyframe, so a lost frame can't leave the hand permanently offset.
+    bool delta_synced = false;
+    uint8_t delta_seq = 0;
+
+    SyncRole sync_role = SYNC_OFF;
+    JointFrame staged_frame = {0, {0}};
+    volatile bool staged_pending = false;
+    volatile bool sync_align_pending = false;  // Restart PWM counters on the next commit
+    volatile uint64_t last_commit_us = 0;
+    volatile uint32_t sync_commits = 0;
+
+    ScheduledFrame schedule_queue[SCHEDULE_QUEUE_LEN]; // Sorted, earliest first
+    volatile unsigned schedule_count = 0;
+    volatile uint32_t schedule_late = 0;     // Frames that arrived after their time
+    volatile uint32_t schedule_rejected = 0; // Frames dropped because the queue was full
+
+    ClockEstimate host_clock = {false, 0, 0, 0};
+
+    // Host link
+    DebugOutput debug_output = DEBUG_TEXT;  // Per-channel debug output for ASCII commands
+    uint32_t telemetry_period_ms = 0;   // 0 = telemetry off
+    uint64_t next_telemetry_us = 0;
+    uint32_t set_count = 0;             // FRAME_SETs received
+    uint64_t last_set_rx_us = 0;
+
+    // RS-485 bus (N<node>)
+    // A frame addressed to this node is unwrapped into bus_frame and handled as
+    // if it had come alone. bus_reply says where its answers go meanwhile: back
+    // on the bus as this node, or nowhere for a broadcast.
+    uint8_t bus_node = 0;               // 0 = not on a bus
+    uint8_t bus_reply = 0;              // 0 = not handling a FRAME_BUS
+    SerialFrame bus_frame;
+    BusStats bus_stats = {};
+
+    // Input coalescing (C1/C0)
+    // When on, consecutive joint commands (ASCII lines and FRAME_SETs) found in one
+    // pass over the input are merged per channel and applied once, so a backlog
+    // never replays stale intermediate targets.
+    bool coalesce_input = false;
+    JointFrame merged_frame = {0, {0}};
+    unsigned merged_pending = 0;        // Frames folded into merged_frame so far
+    unsigned merged_lines = 0;          // ASCII lines among them
+    uint32_t merged_frames = 0;         // Frames that never got applied on their own
+    uint32_t dropped_targets = 0;       // Channel targets overwritten before being applied
+};
@@ -0,0 +1,67 @@
+#include "deferred_log.hpp"
+
+// Nothing here may touch the heap once the board is running
+#pragma GCC poison malloc calloc realloc free strdup
+
+using namespace protocol;
+
+HOT_PATH void LogRing::record(uint16_t site, uint32_t time_us, const uint32_t* words, unsigned count) {
+    // Records were dropped just before this one, so the marker goes first
+    unsigned marker = lost > 0 ? LOG_RECORD_ARGS + 4 : 0;
+    if (count > LOG_MAX_ARGS || LOG_RING_SIZE - (head - tail) < marker + LOG_RECORD_ARGS + 4 * count) {
+        lost++;
+        log_stats.dropped++;
+        return;
+    }
+    if (lost > 0) {
+        push(LOG_SITE_LOST, time_us, &lost, 1);
+        lost = 0;
+    }
+    push(site, time_us, words, count);
+    log_stats.records++;
+    if (head - tail > log_stats.high_water) {
+        log_stats.high_water = head - tail;
+    }
+}
+
+// Caller has checked there is room
+HOT_PATH void LogRing::push(uint16_t site, uint32_t time_us, const uint32_t* words, unsigned count) {
+    unsigned length = LOG_RECORD_ARGS + 4 * count;
+    uint8_t record[LOG_RECORD_ARGS + 4 * LOG_MAX_ARGS];
+    put_u16(record + LOG_RECORD_SITE, site);
+    put_u32(record + LOG_RECORD_TIME, time_us);
+    record[LOG_RECORD_COUNT] = (uint8_t)count;
+    for (auto i = 0u; i < count; i++) {
+        put_u32(record + LOG_RECORD_ARGS + 4 * i, words[i]);
+    }
+    for (auto i = 0u; i < length; i++) {
+        ring[(head + i) & (LOG_RING_SIZE - 1)] = record[i];
+    }
+    head += length;
+}
+
+unsigned LogRing::takeFrame(uint8_t* payload) {
+    unsigned length = 0;
+    while (head != tail) {
+        unsigned count = ring[(tail + LOG_RECORD_COUNT) & (LOG_RING_SIZE - 1)];
+        unsigned size = LOG_RECORD_ARGS + 4 * count;
+        if (length + size > MAX_FRAME_PAYLOAD) {
+            break;
+        }
+        for (auto i = 0u; i < size; i++) {
+            payload[length + i] = ring[(tail + i) & (LOG_RING_SIZE - 1)];
+        }
+        length += size;
+        tail += size;
+    }
+    // Records were dropped and none has fitted since, so they came after everything sent
+    if (head == tail && lost > 0 && length + LOG_RECORD_ARGS + 4 <= MAX_FRAME_PAYLOAD) {
+        put_u16(payload + length + LOG_RECORD_SITE, LOG_SITE_LOST);
+        put_u32(payload + length + LOG_RECORD_TIME, 0);
+        payload[length + LOG_RECORD_COUNT] = 1;
+        put_u32(payload + length + LOG_RECORD_ARGS, lost);
+        length += LOG_RECORD_ARGS + 4;
+        lost = 0;
+    }
+    return length;
+}
@@ -0,0 +1,195 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#include "hot_path.hpp"
+#include "protocol.hpp"
+
+/*
+Deferred logging
+
+printf with %f goes through the soft-float library on the M0+ and costs
+thousands of cycles. A deferred log site costs a few dozen: the board stores
+the site ID and the raw argument words in a ring, sends them to the host as
+FRAME_LOG records, and the host formats them (host/log_format.hpp).
+
+Each site's format string is placed in the servo2040_log section, and its ID
+is the string's offset in that section. The build extracts the section from
+the ELF into servo2040_controller.logstr, which is the host's string table.
+On the host the strings stay where the compiler puts them: the simulator
+formats records directly from the site pointer.
+
+Arguments are 32-bit words: integers of up to 32 bits take one, 64-bit
+integers two (low word first), and floating point values are sent as float
+bits. %s, %n and '*' widths can't be deferred; LOG_SITE_CHECK rejects them
+at compile time, along with an argument list that doesn't match the format.
+*/
+
+#ifdef __arm__
+#define LOG_SITE_SECTION __attribute__((section("servo2040_log"), used))
+#else
+#define LOG_SITE_SECTION
+#endif
+
+// Declare a log site: a static format string in the string table
+#define LOG_SITE(name, format) static const char name[] LOG_SITE_SECTION = format
+
+// Fail the build if the arguments don't match the format
+#define LOG_SITE_CHECK(format, ...)                                                                     \
+    static_assert(deferred_log::formatWords(format) >= 0, "Format can't be deferred (%s, %n or *)");    \
+    static_assert(deferred_log::formatWords(format) ==                                                  \
+                      (int)decltype(deferred_log::argWords(__VA_ARGS__))::value,                        \
+                  "Log arguments don't match the format")
+
+namespace deferred_log {
+
+// One conversion in a format string
+struct Conversion {
+    unsigned start;   // Index of the '%'
+    unsigned end;     // Index after the conversion character
+    char type;        // Conversion character, 0 if there are no more
+    int words;        // Argument words it takes, -1 if it can't be deferred
+};
+
+// Next conversion at or after index at (%% is skipped as literal text)
+constexpr Conversion nextConversion(const char* format, unsigned at) {
+    for (unsigned i = at; format[i] != '\0'; i++) {
+        if (format[i] != '%') {
+            continue;
+        }
+        if (format[i + 1] == '%') {
+            i++;
+            continue;
+        }
+        unsigned j = i + 1;
+        bool star = false;
+        while (format[j] != '\0' && (format[j] == '-' || format[j] == '+' || format[j] == ' ' ||
+                                     format[j] == '#' || format[j] == '0')) {
+            j++;
+        }
+        while ((format[j] >= '0' && format[j] <= '9') || format[j] == '.' || format[j] == '*') {
+            star = star || format[j] == '*';
+            j++;
+        }
+        int length_words = 1;
+        while (format[j] == 'h' || format[j] == 'l' || format[j] == 'j' || format[j] == 'z' ||
+               format[j] == 't' || format[j] == 'L') {
+            if (format[j] == 'j' || format[j] == 'L' || (format[j] == 'l' && format[j + 1] == 'l')) {
+                length_words = 2;
+            }
+            j += (format[j] == 'l' && format[j + 1] == 'l') || (format[j] == 'h' && format[j + 1] == 'h') ? 2 : 1;
+        }
+        char type = format[j];
+        int words = -1;
+        switch (type) {
+        case 'd': case 'i': case 'u': case 'x': case 'X': case 'o':
+            words = length_words;
+            break;
+        case 'c': case 'p':
+            words = 1;
+            break;
+        case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+            words = format[j - 1] == 'L' ? -1 : 1;
+            break;
+        default:
+            break;
+        }
+        if (star || type == '\0') {
+            words = -1;
+        }
+        return {i, type == '\0' ? j : j + 1, type == '\0' ? '?' : type, words};
+    }
+    return {0, 0, 0, 0};
+}
+
+// Argument words a format takes, -1 if it can't be deferred
+constexpr int formatWords(const char* format) {
+    int total = 0;
+    for (Conversion c = nextConversion(format, 0); c.type != 0; c = nextConversion(format, c.end)) {
+        if (c.words < 0) {
+            return -1;
+        }
+        total += c.words;
+    }
+    return total;
+}
+
+// long is 32 bits on the board, so it takes one word on the host as well
+template <typename T>
+constexpr bool isWide() {
+    return sizeof(T) > 4 && !std::is_floating_point<T>::value && !std::is_same<T, long>::value &&
+           !std::is_same<T, unsigned long>::value;
+}
+
+template <typename T>
+constexpr unsigned wordsFor() {
+    return isWide<T>() ? 2 : 1;
+}
+
+// Words an argument list packs into, as a type (only used in decltype)
+template <typename... Args>
+std::integral_constant<unsigned, (0 + ... + wordsFor<Args>())> argWords(const Args&...);
+
+template <typename T>
+HOT_PATH inline uint32_t* pack(uint32_t* words, T value) {
+    if constexpr (std::is_floating_point<T>::value) {
+        float f = (float)value;
+        std::memcpy(words, &f, 4);
+        return words + 1;
+    } else if constexpr (isWide<T>()) {
+        words[0] = (uint32_t)(uint64_t)value;
+        words[1] = (uint32_t)((uint64_t)value >> 32);
+        return words + 2;
+    } else {
+        words[0] = (uint32_t)value;
+        return words + 1;
+    }
+}
+
+// Pack arguments into words, returning the number used
+template <typename... Args>
+HOT_PATH inline unsigned packArgs(uint32_t* words, Args... args) {
+    uint32_t* end = words;
+    ((end = pack(end, args)), ...);
+    return (unsigned)(end - words);
+}
+
+} // namespace deferred_log
+
+// Records waiting to be sent, in their FRAME_LOG encoding. Filled and
+// drained from the main loop only. A record that doesn't fit is dropped and
+// counted. A LOG_SITE_LOST record saying how many goes into the ring just
+// ahead of the next record that fits, where the gap is, or is sent once the
+// ring has emptied if no record came since.
+#ifndef SERVO2040_LOG_RING_SIZE
+#define SERVO2040_LOG_RING_SIZE 2048
+#endif
+const unsigned LOG_RING_SIZE = SERVO2040_LOG_RING_SIZE;
+static_assert((LOG_RING_SIZE & (LOG_RING_SIZE - 1)) == 0, "Log ring size must be a power of two");
+
+struct LogStats {
+    uint32_t records;
+    uint32_t dropped;
+    unsigned high_water;   // Bytes
+};
+
+class LogRing {
+public:
+    void record(uint16_t site, uint32_t time_us, const uint32_t* words, unsigned count);
+
+    // Move whole records into a FRAME_LOG payload, returns its length (0 if
+    // there is nothing to send)
+    unsigned takeFrame(uint8_t* payload);
+
+    const LogStats& stats() const { return log_stats; }
+
+private:
+    void push(uint16_t site, uint32_t time_us, const uint32_t* words, unsigned count);
+
+    uint8_t ring[LOG_RING_SIZE];
+    uint32_t head = 0;      // Next byte to write
+    uint32_t tail = 0;      // Start of the oldest record
+    uint32_t lost = 0;      // Records dropped and not yet marked
+    LogStats log_stats = {};
+};
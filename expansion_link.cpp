@@ -0,0 +1,176 @@
+#include "expansion_link.hpp"
+
+#include <cstdio>
+
+#include "pico/stdlib.h"
+#include "hardware/i2c.h"
+#include "hardware/dma.h"
+#include "hardware/irq.h"
+#include "hardware/gpio.h"
+#include "hardware/sync.h"
+
+#include "hot_path.hpp"
+#include "pca9685.hpp"
+#include "protocol.hpp"
+
+// Nothing here may touch the heap once the board is running
+#pragma GCC poison malloc calloc realloc free strdup
+
+using namespace protocol;
+
+// Qw/ST connector
+#define EXPANSION_I2C i2c0
+const uint EXPANSION_SDA_PIN = 20;
+const uint EXPANSION_SCL_PIN = 21;
+
+// Bus rate, and how many outputs of each PCA9685 carry channels (the last
+// board takes what is left)
+#ifndef SERVO2040_I2C_BAUD
+#define SERVO2040_I2C_BAUD 1000000
+#endif
+#ifndef SERVO2040_PCA9685_OUTPUTS
+#define SERVO2040_PCA9685_OUTPUTS 16
+#endif
+static_assert(SERVO2040_PCA9685_OUTPUTS >= 1 && SERVO2040_PCA9685_OUTPUTS <= PCA9685_OUTPUTS,
+              "A PCA9685 has 16 outputs");
+static_assert((NUM_EXPANSION_CHANNELS + SERVO2040_PCA9685_OUTPUTS - 1) / SERVO2040_PCA9685_OUTPUTS <=
+              Pca9685Chain::MAX_BOARDS, "Too many PCA9685 boards");
+
+// The chain is shared with the I²C interrupt: the main loop only touches it
+// with interrupts off
+Pca9685Chain expansion_chain;
+uint16_t expansion_pulses[NUM_EXPANSION_CHANNELS ? NUM_EXPANSION_CHANNELS : 1];
+uint16_t expansion_commands[Pca9685Chain::MAX_BURST];  // IC_DATA_CMD words for one burst
+int expansion_dma = -1;
+volatile bool expansion_busy = false;
+uint64_t expansion_staged_us = 0;  // When the update going out was first staged
+ExpansionStats expansion_stats = {};
+
+// Send the next board's burst. The controller must be idle (TAR only changes
+// while it is disabled). False if every board is up to date.
+HOT_PATH static bool startBurst() {
+    uint8_t address;
+    const uint8_t* data;
+    unsigned length;
+    if (!expansion_chain.takeBurst(address, data, length)) {
+        return false;
+    }
+    for (auto i = 0u; i < length; i++) {
+        expansion_commands[i] = data[i];
+    }
+    expansion_commands[length - 1] |= I2C_IC_DATA_CMD_STOP_BITS;
+
+    i2c_hw_t* hw = i2c_get_hw(EXPANSION_I2C);
+    hw->enable = 0;
+    hw->tar = address;
+    hw->enable = 1;
+    dma_channel_transfer_from_buffer_now(expansion_dma, expansion_commands, length);
+    expansion_stats.bursts++;
+    expansion_stats.bytes += length + 1;
+    return true;
+}
+
+// Every board written: the update is out
+HOT_PATH static void finishUpdate() {
+    expansion_busy = false;
+    expansion_stats.sent++;
+    uint32_t latency = (uint32_t)(time_us_64() - expansion_staged_us);
+    expansion_stats.latency_last_us = latency;
+    expansion_stats.latency_total_us += latency;
+    if (latency > expansion_stats.latency_max_us) {
+        expansion_stats.latency_max_us = latency;
+    }
+}
+
+// A board that doesn't acknowledge aborts its write. The controller still
+// ends with a STOP, so the next board starts from STOP_DET either way.
+HOT_PATH static void expansionIrq() {
+    i2c_hw_t* hw = i2c_get_hw(EXPANSION_I2C);
+    uint32_t status = hw->intr_stat;
+    if (status & I2C_IC_INTR_STAT_R_TX_ABRT_BITS) {
+        dma_channel_abort(expansion_dma);
+        (void)hw->clr_tx_abrt;
+        expansion_stats.errors++;
+    }
+    if (status & I2C_IC_INTR_STAT_R_STOP_DET_BITS) {
+        (void)hw->clr_stop_det;
+        if (expansion_busy && !startBurst()) {
+            finishUpdate();
+        }
+    }
+}
+
+void expansionInit() {
+    expansion_chain.begin(NUM_EXPANSION_CHANNELS, SERVO2040_PCA9685_OUTPUTS);
+    expansion_stats.boards = expansion_chain.boards();
+    for (auto c = 0u; c < NUM_EXPANSION_CHANNELS; c++) {
+        expansion_pulses[c] = 0;
+    }
+
+    i2c_init(EXPANSION_I2C, SERVO2040_I2C_BAUD);
+    gpio_set_function(EXPANSION_SDA_PIN, GPIO_FUNC_I2C);
+    gpio_set_function(EXPANSION_SCL_PIN, GPIO_FUNC_I2C);
+    gpio_pull_up(EXPANSION_SDA_PIN);  // Weak; the boards normally carry their own pull-ups
+    gpio_pull_up(EXPANSION_SCL_PIN);
+
+    // Set up with blocking writes, before the interrupt takes over
+    Pca9685Setting settings[PCA9685_SETUP_WRITES];
+    pca9685Setup(expansion_chain.prescale(), settings);
+    for (auto b = 0u; b < expansion_chain.boards(); b++) {
+        for (const Pca9685Setting& setting : settings) {
+            uint8_t data[2] = {setting.reg, setting.value};
+            if (i2c_write_blocking(EXPANSION_I2C, expansion_chain.address(b), data, 2, false) != 2) {
+                printf("PCA9685 at 0x%02x not answering\n", expansion_chain.address(b));
+                expansion_stats.absent++;
+                break;
+            }
+        }
+    }
+    sleep_us(500);  // Oscillator start-up
+
+    expansion_dma = dma_claim_unused_channel(true);
+    dma_channel_config config = dma_channel_get_default_config(expansion_dma);
+    channel_config_set_transfer_data_size(&config, DMA_SIZE_16);
+    channel_config_set_read_increment(&config, true);
+    channel_config_set_write_increment(&config, false);
+    channel_config_set_dreq(&config, i2c_get_dreq(EXPANSION_I2C, true));
+    dma_channel_configure(expansion_dma, &config, &i2c_get_hw(EXPANSION_I2C)->data_cmd, expansion_commands, 0,
+                          false);
+
+    i2c_hw_t* hw = i2c_get_hw(EXPANSION_I2C);
+    (void)hw->clr_intr;
+    hw->intr_mask = I2C_IC_INTR_MASK_M_STOP_DET_BITS | I2C_IC_INTR_MASK_M_TX_ABRT_BITS;
+    irq_set_exclusive_handler(I2C0_IRQ, expansionIrq);
+    irq_set_enabled(I2C0_IRQ, true);
+}
+
+HOT_PATH void expansionStage(const uint16_t* pulses_q4, uint32_t mask) {
+    if (expansion_dma < 0) {
+        return;
+    }
+    for (auto c = 0u; c < NUM_EXPANSION_CHANNELS; c++) {
+        if (mask & (1u << c)) {
+            expansion_pulses[c] = pulses_q4[c];
+        }
+    }
+    uint32_t interrupts = save_and_disable_interrupts();
+    if (expansion_chain.stage(pulses_q4, mask)) {
+        expansion_stats.updates++;
+        if (expansion_busy) {
+            // Goes out with the boards still to come, or right after
+            expansion_stats.merged++;
+        } else {
+            expansion_staged_us = time_us_64();
+            expansion_busy = startBurst();
+        }
+    }
+    restore_interrupts(interrupts);
+}
+
+uint16_t expansionPulse(unsigned channel) {
+    return channel < NUM_EXPANSION_CHANNELS ? expansion_pulses[channel] : 0;
+}
+
+const ExpansionStats& expansionStats() {
+    return expansion_stats;
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include <cstdint>
+
+/*
+Expansion link
+
+PCA9685 boards (pca9685.hpp) for channels past the board's 18, on I2C0 at the
+Qw/ST connector (GP20 SDA, GP21 SCL) at up to 1 MHz (Fast-mode Plus). Built
+in when SERVO2040_EXPANSION_CHANNELS is non-zero.
+
+The control tick stages its pulses and returns. Each changed board's burst
+goes into a buffer of I²C command words, STOP on the last, which a DMA
+channel feeds to the controller; the I²C interrupt at each STOP starts the
+next board. A tick that comes while an update is still going out only adds
+to what is sent next, so the bus is never more than one update behind.
+
+The Qw/ST pins are also the UART link's (uart_link.hpp), so a build with
+expansion channels has no UART link.
+*/
+
+struct ExpansionStats {
+    unsigned boards;
+    unsigned absent;            // Boards that didn't answer at setup
+    uint32_t updates;           // Ticks that changed an expansion output
+    uint32_t bursts;            // Board writes
+    uint32_t bytes;             // Including the address bytes
+    uint32_t errors;            // Writes aborted, e.g. a board not acknowledging
+    uint32_t merged;            // Ticks staged while the last update was going out
+    uint32_t sent;              // Updates written to every board
+    uint32_t latency_last_us;   // Staged to the last board's STOP
+    uint32_t latency_max_us;
+    uint64_t latency_total_us;  // Over sent updates
+};
+
+// Claim I2C0, its pins and a DMA channel, and set the boards up for servos
+void expansionInit();
+
+// Pulse widths (1/16 µs) for the expansion channels in mask, bit 0 being
+// channel 18. Returns at once; the bus is started if it is idle.
+void expansionStage(const uint16_t* pulses_q4, uint32_t mask);
+
+// Pulse width (1/16 µs) last staged for an expansion channel, counting from 0
+uint16_t expansionPulse(unsigned channel);
+
+const ExpansionStats& expansionStats();
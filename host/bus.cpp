@@ -0,0 +1,55 @@
+#include "bus.hpp"
+
+namespace servo2040_host {
+
+using namespace protocol;
+
+BusSchedule bus_schedule(unsigned nodes, unsigned baud) {
+    BusSchedule schedule;
+    schedule.nodes = nodes;
+    schedule.baud = baud;
+    schedule.first_slot_us = BUS_TURNAROUND_US;
+    schedule.slot_us = bus_slot_us(baud);
+    schedule.cycle_us = bus_cycle_us(nodes, NUM_CHANNELS, baud);
+    return schedule;
+}
+
+void encode_bus_cycle(const BusSchedule& schedule, const int16_t (*positions)[NUM_CHANNELS],
+                      std::vector<uint8_t>& out) {
+    for (unsigned node = 1; node <= schedule.nodes; node++) {
+        uint8_t frame[3 + BUS_HEADER + 4 + 2 * NUM_CHANNELS];
+        frame[0] = FRAME_SYNC;
+        frame[1] = FRAME_BUS;
+        frame[2] = sizeof(frame) - 3;
+        frame[3] = (uint8_t)node;
+        frame[4] = FRAME_STAGE;
+        put_u32(frame + 5, ALL_CHANNELS);
+        for (unsigned s = 0; s < NUM_CHANNELS; s++) {
+            put_u16(frame + 9 + 2 * s, (uint16_t)positions[node - 1][s]);
+        }
+        out.insert(out.end(), frame, frame + sizeof(frame));
+    }
+
+    uint8_t commit[3 + BUS_COMMIT_LENGTH];
+    commit[0] = FRAME_SYNC;
+    commit[1] = FRAME_BUS_COMMIT;
+    commit[2] = BUS_COMMIT_LENGTH;
+    put_u16(commit + 3, (uint16_t)schedule.first_slot_us);
+    put_u16(commit + 5, (uint16_t)schedule.slot_us);
+    commit[7] = BUS_COMMIT_TELEMETRY;
+    out.insert(out.end(), commit, commit + sizeof(commit));
+}
+
+bool decode_bus_reply(const Frame& frame, uint8_t& node, uint8_t& type, const uint8_t*& payload,
+                      size_t& length) {
+    if (!frame.binary || frame.type != FRAME_BUS_REPLY || frame.length < BUS_HEADER) {
+        return false;
+    }
+    node = frame.data[0];
+    type = frame.data[1];
+    payload = frame.data + BUS_HEADER;
+    length = frame.length - BUS_HEADER;
+    return true;
+}
+
+} // namespace servo2040_host
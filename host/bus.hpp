@@ -0,0 +1,42 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "frame_parser.hpp"
+#include "protocol.hpp"
+
+/*
+RS-485 bus cycles
+
+Several boards in bus mode (N<node>) share one half-duplex UART link. Each
+cycle the host stages every node's targets, commits them on all nodes at once
+with a broadcast FRAME_BUS_COMMIT, and each node then answers with telemetry
+in its own slot. Slot and cycle lengths come from the bus_* timing functions
+in protocol.hpp, so a cycle takes the same time every time.
+*/
+
+namespace servo2040_host {
+
+struct BusSchedule {
+    unsigned nodes;             // Nodes 1..nodes
+    unsigned baud;
+    uint32_t first_slot_us;     // From the end of the commit to node 1's slot
+    uint32_t slot_us;
+    uint32_t cycle_us;          // Start of one cycle to the start of the next
+};
+
+// Every channel of nodes 1..nodes, every cycle
+BusSchedule bus_schedule(unsigned nodes, unsigned baud);
+
+// Append one cycle's frames: FRAME_STAGE with every channel for each node
+// (positions[node - 1]), then the commit asking for telemetry
+void encode_bus_cycle(const BusSchedule& schedule, const int16_t (*positions)[protocol::NUM_CHANNELS],
+                      std::vector<uint8_t>& out);
+
+// Split a FRAME_BUS_REPLY into the node, the type and payload it carries.
+// False if the frame is anything else.
+bool decode_bus_reply(const Frame& frame, uint8_t& node, uint8_t& type, const uint8_t*& payload,
+                      size_t& length);
+
+} // namespace servo2040_host
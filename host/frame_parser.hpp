@@ -0,0 +1,94 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+#include "protocol.hpp"
+
+namespace servo2040_host {
+
+// A console line or binary frame from the device
+struct Frame {
+    bool binary;
+    uint8_t type;       // Binary frames only, without FRAME_CHECKED
+    size_t length;      // Payload length, or line length for text
+    uint8_t data[protocol::MAX_FRAME_PAYLOAD + 1]; // Null-terminated for text
+};
+
+// Splits the device's output stream into console lines and binary frames.
+// Mirrors readSerialFrame() on the device, so the same parser also works
+// on the host → device stream, checked frames included (their sequence
+// number and CRC are skipped, not verified).
+class FrameParser {
+public:
+    template <typename Handler>
+    void feed(const uint8_t* bytes, size_t count, Handler&& on_frame) {
+        for (size_t i = 0; i < count; i++) {
+            if (push(bytes[i])) {
+                on_frame(static_cast<const Frame&>(frame_));
+            }
+        }
+    }
+
+    // Feed one byte, returns true when frame() holds a complete frame
+    bool push(uint8_t c) {
+        switch (state_) {
+        case LINE:
+            if (c == '\n' || c == '\r') {
+                if (pos_ > 0) {
+                    frame_.binary = false;
+                    frame_.length = pos_;
+                    frame_.data[pos_] = '\0';
+                    pos_ = 0;
+                    return true;
+                }
+            } else if (c == protocol::FRAME_SYNC && pos_ == 0) {
+                state_ = TYPE;
+            } else if (pos_ < protocol::MAX_FRAME_PAYLOAD) {
+                frame_.data[pos_++] = c;
+            }
+            return false;
+        case TYPE:
+            frame_.type = c & ~protocol::FRAME_CHECKED;
+            checked_ = (c & protocol::FRAME_CHECKED) != 0;
+            state_ = LENGTH;
+            return false;
+        case LENGTH:
+            frame_.length = c;
+            pos_ = 0;
+            frame_.binary = true;
+            state_ = checked_ ? SEQ : c == 0 ? LINE : PAYLOAD;
+            return state_ == LINE;
+        case SEQ:
+            state_ = frame_.length > 0 ? PAYLOAD : CRC;
+            return false;
+        case PAYLOAD:
+            frame_.data[pos_++] = c;
+            if (pos_ == frame_.length) {
+                pos_ = 0;
+                state_ = checked_ ? CRC : LINE;
+                return !checked_;
+            }
+            return false;
+        case CRC:
+            if (pos_++ == 0) {
+                return false;
+            }
+            pos_ = 0;
+            state_ = LINE;
+            return true;
+        }
+        return false;
+    }
+
+    const Frame& frame() const { return frame_; }
+
+private:
+    enum State { LINE, TYPE, LENGTH, SEQ, PAYLOAD, CRC };
+
+    Frame frame_ = {};
+    State state_ = LINE;
+    size_t pos_ = 0;
+    bool checked_ = false;
+};
+
+} // namespace servo2040_host
@@ -0,0 +1,375 @@
+#include "hand.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+namespace servo2040_host {
+
+using namespace protocol;
+
+Hand::Hand(const std::string& port, HandOptions options)
+    : options_(options), port_(open_transport(port)) {
+    if (!options_.telemetry_port.empty()) {
+        // Opened first: the device switches telemetry over once it sees DTR
+        telemetry_port_ = open_transport(options_.telemetry_port);
+    }
+    if (!options_.trace_path.empty()) {
+        trace_.reset(new TraceWriter(options_.trace_path, now_us()));
+    }
+    if (options_.checked) {
+        send_line("K1");
+    }
+    if (!options_.log_strings.empty()) {
+        log_strings_.reset(new LogStrings(options_.log_strings));
+        send_line("V2");
+    } else if (options_.quiet) {
+        send_line("V0");
+    }
+    uint8_t rate[2];
+    put_u16(rate, (uint16_t)options_.telemetry_ms);
+    send_frame(FRAME_TELEMETRY_RATE, rate, sizeof(rate));
+    thread_ = std::thread(&Hand::run, this);
+    if (telemetry_port_) {
+        telemetry_thread_ = std::thread(&Hand::run_telemetry, this);
+    }
+}
+
+Hand::~Hand() {
+    running_ = false;
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+    if (telemetry_thread_.joinable()) {
+        telemetry_thread_.join();
+    }
+}
+
+uint64_t Hand::now_us() {
+    using namespace std::chrono;
+    return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+void Hand::set_target(unsigned channel, int degrees) {
+    if (channel >= NUM_CHANNELS) {
+        return;
+    }
+    degrees = std::min(std::max(degrees, MIN_ANGLE), MAX_ANGLE);
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (pending_mask_ & (1u << channel)) {
+        link_.targets_coalesced++;
+    }
+    pending_[channel] = (int16_t)degrees;
+    pending_mask_ |= 1u << channel;
+}
+
+void Hand::set_targets(const int16_t* degrees, uint32_t mask) {
+    for (unsigned c = 0; c < NUM_CHANNELS; c++) {
+        if (mask & (1u << c)) {
+            set_target(c, degrees[c]);
+        }
+    }
+}
+
+void Hand::send_line(const std::string& line) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    append_line(outgoing_, line);
+}
+
+void Hand::send_frame(uint8_t type, const uint8_t* payload, uint8_t length) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    append_frame(outgoing_, type, payload, length);
+}
+
+// Encode a binary frame, adding seq and CRC in checked mode. Caller holds mutex_.
+void Hand::append_frame(std::vector<uint8_t>& out, uint8_t type, const uint8_t* payload, uint8_t length) {
+    if (!options_.checked) {
+        out.push_back(FRAME_SYNC);
+        out.push_back(type);
+        out.push_back(length);
+        out.insert(out.end(), payload, payload + length);
+        return;
+    }
+    size_t start = out.size();
+    out.push_back(FRAME_SYNC);
+    out.push_back(type | FRAME_CHECKED);
+    out.push_back(length);
+    out.push_back(tx_seq_++);
+    out.insert(out.end(), payload, payload + length);
+    uint16_t crc = crc16(out.data() + start + 1, (unsigned)(out.size() - start - 1));
+    out.push_back((uint8_t)crc);
+    out.push_back((uint8_t)(crc >> 8));
+}
+
+// Encode an ASCII line, adding "#seq*XX" in checked mode. Caller holds mutex_.
+void Hand::append_line(std::vector<uint8_t>& out, const std::string& line) {
+    std::string text = line;
+    if (options_.checked) {
+        char suffix[8];
+        text += "#" + std::to_string(tx_seq_++);
+        std::snprintf(suffix, sizeof(suffix), "*%02X", line_checksum(text.data(), (unsigned)text.size()));
+        text += suffix;
+    }
+    out.insert(out.end(), text.begin(), text.end());
+    out.push_back('\n');
+}
+
+bool Hand::telemetry(Telemetry& out) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    out = telemetry_;
+    return have_telemetry_;
+}
+
+LatencyStats Hand::latency() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return latency_;
+}
+
+LinkStats Hand::link_stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return link_;
+}
+
+bool Hand::device_time(uint64_t host_us, uint64_t& device_us) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!clock_.valid()) {
+        return false;
+    }
+    device_us = clock_.to_device(host_us);
+    return true;
+}
+
+void Hand::on_telemetry(std::function<void(const Telemetry&)> callback) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    telemetry_callback_ = std::move(callback);
+}
+
+void Hand::on_console(std::function<void(const std::string&)> callback) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    console_callback_ = std::move(callback);
+}
+
+void Hand::run() {
+    const uint64_t tick_us = 1000000 / std::max(options_.tick_hz, 1u);
+    const uint64_t sync_us = (uint64_t)options_.time_sync_ms * 1000;
+    uint64_t next_tick = now_us();
+    uint64_t next_sync = next_tick;
+    uint8_t buffer[512];
+
+    try {
+        while (running_) {
+            uint64_t now = now_us();
+            if (sync_us > 0 && now >= next_sync) {
+                send_time_request(now_us());
+                next_sync = now + sync_us;
+                if (trace_) {
+                    trace_->flush();
+                }
+            }
+            if (now >= next_tick) {
+                tick(now);
+                next_tick += tick_us;
+                if (next_tick < now) {
+                    next_tick = now + tick_us; // Fell behind, don't burst
+                }
+            }
+
+            int64_t wait_us = (int64_t)std::min(next_tick, sync_us > 0 ? next_sync : next_tick) - (int64_t)now_us();
+            size_t count = port_->read_some(buffer, sizeof(buffer), std::max<int64_t>(wait_us, 0));
+            if (count > 0) {
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    link_.bytes_received += count;
+                }
+                parser_.feed(buffer, count, [this](const Frame& frame) { handle_frame(frame); });
+            }
+        }
+    } catch (const std::exception& e) {
+        std::fprintf(stderr, "servo2040: %s\n", e.what());
+        running_ = false;
+    }
+    if (trace_) {
+        trace_->flush();
+    }
+}
+
+// Read the telemetry port. Nothing is sent on it.
+void Hand::run_telemetry() {
+    uint8_t buffer[512];
+    try {
+        while (running_) {
+            size_t count = telemetry_port_->read_some(buffer, sizeof(buffer), 10000);
+            if (count > 0) {
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    link_.bytes_received += count;
+                }
+                telemetry_parser_.feed(buffer, count, [this](const Frame& frame) { handle_frame(frame); });
+            }
+        }
+    } catch (const std::exception& e) {
+        std::fprintf(stderr, "servo2040: telemetry port: %s\n", e.what());
+    }
+}
+
+// Send everything queued since the last tick as one write
+void Hand::tick(uint64_t now) {
+    std::vector<uint8_t> out;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        out.swap(outgoing_);
+
+        // Hold joint targets until the first telemetry tells us the device's
+        // set_count, otherwise latency samples can't be matched to frames
+        bool can_send = options_.telemetry_ms == 0 || have_set_base_;
+        if (pending_mask_ != 0 && can_send) {
+            uint8_t payload[4 + NUM_CHANNELS * 2];
+            put_u32(payload, pending_mask_);
+            size_t length = 4;
+            for (unsigned c = 0; c < NUM_CHANNELS; c++) {
+                if (pending_mask_ & (1u << c)) {
+                    put_u16(payload + length, (uint16_t)pending_[c]);
+                    length += 2;
+                }
+            }
+            pending_mask_ = 0;
+            append_frame(out, FRAME_SET, payload, (uint8_t)length);
+            send_times_[sets_sent_ % SEND_HISTORY] = now;
+            sets_sent_++;
+            link_.frames_sent++;
+        }
+        link_.bytes_sent += out.size();
+    }
+    if (!out.empty()) {
+        write_port(out);
+    }
+}
+
+// Write to the device, recording the bytes in the trace
+void Hand::write_port(const std::vector<uint8_t>& out) {
+    if (trace_) {
+        trace_->write(now_us(), TRACE_TX, TRACE_BYTES, 0, out.data(), out.size());
+    }
+    port_->write_all(out.data(), out.size());
+}
+
+void Hand::send_time_request(uint64_t now) {
+    uint8_t payload[TIME_REQUEST_LENGTH] = {};
+    std::vector<uint8_t> frame;
+    put_u64(payload, now);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        // Anything already queued has lower sequence numbers, so it goes first
+        frame.swap(outgoing_);
+        if (clock_.valid()) {
+            put_u64(payload + 8, (uint64_t)clock_.offset_at(now));
+            put_u32(payload + 16, (uint32_t)clock_.drift_ppb());
+            payload[20] = TIME_ESTIMATE_VALID;
+        }
+        append_frame(frame, FRAME_TIME_REQUEST, payload, sizeof(payload));
+        link_.bytes_sent += frame.size();
+    }
+    write_port(frame);
+}
+
+void Hand::handle_frame(const Frame& frame) {
+    uint64_t now = now_us();
+    if (trace_) {
+        trace_->write(now, TRACE_RX, frame.binary ? TRACE_FRAME : TRACE_LINE, frame.binary ? frame.type : 0,
+                      frame.data, frame.length);
+    }
+    if (!frame.binary) {
+        std::function<void(const std::string&)> callback;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            callback = console_callback_;
+        }
+        if (callback) {
+            callback(std::string((const char*)frame.data, frame.length));
+        }
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        link_.frames_received++;
+    }
+    switch (frame.type) {
+    case FRAME_TIME_REPLY:
+        if (frame.length == TIME_REPLY_LENGTH) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            clock_.add_sample(get_u64(frame.data), get_u64(frame.data + 8), get_u64(frame.data + 16), now);
+        }
+        break;
+    case FRAME_TELEMETRY:
+        if (frame.length == TELEMETRY_LENGTH) {
+            handle_telemetry(frame);
+        }
+        break;
+    case FRAME_LOG:
+        if (log_strings_) {
+            handle_log(frame);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+// Deferred log records become console lines
+void Hand::handle_log(const Frame& frame) {
+    std::function<void(const std::string&)> callback;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        callback = console_callback_;
+    }
+    if (callback) {
+        decode_log_frame(*log_strings_, frame.data, frame.length,
+                         [&](uint32_t, const std::string& text) { callback(text); });
+    }
+}
+
+void Hand::handle_telemetry(const Frame& frame) {
+    Telemetry t;
+    t.device_time_us = get_u64(frame.data + TELEMETRY_TIME);
+    t.set_count = get_u32(frame.data + TELEMETRY_SET_COUNT);
+    t.merged_frames = get_u32(frame.data + TELEMETRY_MERGED_FRAMES);
+    t.dropped_targets = get_u32(frame.data + TELEMETRY_DROPPED_TARGETS);
+    for (unsigned c = 0; c < NUM_CHANNELS; c++) {
+        t.positions[c] = (int16_t)get_u16(frame.data + TELEMETRY_POSITIONS + c * 2);
+    }
+    uint64_t last_set_rx = get_u64(frame.data + TELEMETRY_LAST_SET_RX);
+
+    std::function<void(const Telemetry&)> callback;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        t.host_time_us = clock_.valid() ? clock_.to_host(t.device_time_us) : 0;
+
+        if (!have_set_base_) {
+            set_base_ = t.set_count - (uint32_t)sets_sent_;
+            have_set_base_ = true;
+        } else if (t.set_count != last_set_count_ && clock_.valid()) {
+            // Latency of the newest FRAME_SET the device has seen
+            uint64_t index = (uint32_t)(t.set_count - set_base_ - 1);
+            if (index < sets_sent_ && sets_sent_ - index <= SEND_HISTORY) {
+                int64_t sample = (int64_t)(clock_.to_host(last_set_rx) - send_times_[index % SEND_HISTORY]);
+                latency_.last_us = sample;
+                latency_.min_us = latency_.samples ? std::min(latency_.min_us, sample) : sample;
+                latency_.max_us = latency_.samples ? std::max(latency_.max_us, sample) : sample;
+                latency_.samples++;
+                latency_.mean_us += (sample - latency_.mean_us) / latency_.samples;
+            }
+        }
+        last_set_count_ = t.set_count;
+
+        telemetry_ = t;
+        have_telemetry_ = true;
+        callback = telemetry_callback_;
+    }
+    if (callback) {
+        callback(t);
+    }
+}
+
+} // namespace servo2040_host
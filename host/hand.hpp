@@ -0,0 +1,161 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "protocol.hpp"
+#include "frame_parser.hpp"
+#include "log_format.hpp"
+#include "transport.hpp"
+#include "time_sync.hpp"
+#include "trace.hpp"
+
+/*
+Host SDK for the Servo2040 hand controller
+
+A Hand owns the link to the board (serial port or USB command interface, see
+transport.hpp) and runs a background thread that:
+  - coalesces joint targets set since the last tick into one FRAME_SET,
+  - keeps the host/device clocks in sync (FRAME_TIME_REQUEST/REPLY),
+  - parses telemetry and console output as it arrives, formatting the
+    device's deferred log records (see log_format.hpp) into console lines,
+  - measures command latency (host send → device receive),
+  - optionally records the session to a trace file (see trace.hpp).
+
+With HandOptions::telemetry_port set, a second thread reads the board's USB
+telemetry port, and the device sends telemetry and console output there, so
+they never hold up replies on the command link.
+
+All public methods are thread safe and never wait on the device.
+*/
+
+namespace servo2040_host {
+
+using protocol::NUM_CHANNELS;
+
+struct HandOptions {
+    unsigned tick_hz = 500;          // Max FRAME_SET rate
+    unsigned telemetry_ms = 10;      // Device telemetry period (0 = off)
+    unsigned time_sync_ms = 100;     // Time sync exchange period
+    bool quiet = true;               // Turn off per-command debug output on the device (V0)
+    bool checked = false;            // Send every frame with a sequence number and CRC/checksum
+    std::string trace_path;          // Record everything sent and received here (empty = off)
+    std::string telemetry_port;      // The board's telemetry port, read on its own thread (empty = off)
+    std::string log_strings;         // Firmware log string table (servo2040_controller.logstr). When set,
+                                     // debug output is sent as deferred records (V2) and formatted here.
+};
+
+struct Telemetry {
+    uint64_t device_time_us;
+    uint64_t host_time_us;           // device_time_us on the host clock (0 before time sync)
+    uint32_t set_count;
+    uint32_t merged_frames;          // Device-side input coalescing counters
+    uint32_t dropped_targets;
+    int16_t positions[NUM_CHANNELS];
+};
+
+struct LatencyStats {
+    uint64_t samples;
+    int64_t last_us;
+    int64_t min_us;
+    int64_t max_us;
+    double mean_us;
+};
+
+struct LinkStats {
+    uint64_t frames_sent;
+    uint64_t bytes_sent;
+    uint64_t targets_coalesced;      // set_target calls merged into an already pending value
+    uint64_t frames_received;
+    uint64_t bytes_received;
+};
+
+class Hand {
+public:
+    // Opens the port (a serial device, or "usb[:serial]") and starts the
+    // background thread. Throws std::runtime_error on failure.
+    explicit Hand(const std::string& port, HandOptions options = HandOptions());
+    ~Hand();
+
+    Hand(const Hand&) = delete;
+    Hand& operator=(const Hand&) = delete;
+
+    // Queue a joint target (degrees). The newest value per channel is sent on the next tick.
+    void set_target(unsigned channel, int degrees);
+
+    // Queue targets for every channel whose bit is set in mask
+    void set_targets(const int16_t* degrees, uint32_t mask);
+
+    // Queue a raw ASCII command (e.g. "P2" or "TL"), sent in order with the frames
+    void send_line(const std::string& line);
+
+    // Queue a raw binary frame
+    void send_frame(uint8_t type, const uint8_t* payload, uint8_t length);
+
+    // Latest telemetry, false if none has arrived yet
+    bool telemetry(Telemetry& out) const;
+
+    LatencyStats latency() const;
+    LinkStats link_stats() const;
+
+    // Host ↔ device clock conversion, false before the first time sync reply
+    bool device_time(uint64_t host_us, uint64_t& device_us) const;
+
+    // Callbacks run on a background thread (either one with a telemetry port)
+    void on_telemetry(std::function<void(const Telemetry&)> callback);
+    void on_console(std::function<void(const std::string&)> callback);
+
+    // Host monotonic clock (µs) used for all host timestamps
+    static uint64_t now_us();
+
+private:
+    void run();
+    void run_telemetry();
+    void tick(uint64_t now);
+    void send_time_request(uint64_t now);
+    void handle_frame(const Frame& frame);
+    void handle_telemetry(const Frame& frame);
+    void handle_log(const Frame& frame);
+    void append_frame(std::vector<uint8_t>& out, uint8_t type, const uint8_t* payload, uint8_t length);
+    void append_line(std::vector<uint8_t>& out, const std::string& line);
+    void write_port(const std::vector<uint8_t>& out);
+
+    HandOptions options_;
+    std::unique_ptr<Transport> port_;
+    std::unique_ptr<TraceWriter> trace_;
+    std::unique_ptr<LogStrings> log_strings_;
+    FrameParser parser_;
+    std::thread thread_;
+    std::unique_ptr<Transport> telemetry_port_;
+    FrameParser telemetry_parser_;
+    std::thread telemetry_thread_;
+    std::atomic<bool> running_{true};
+
+    mutable std::mutex mutex_;
+    int16_t pending_[NUM_CHANNELS] = {};
+    uint32_t pending_mask_ = 0;
+    std::vector<uint8_t> outgoing_;         // Lines/frames queued by the caller
+    uint8_t tx_seq_ = 0;                    // Sequence number for checked frames
+    Telemetry telemetry_ = {};
+    bool have_telemetry_ = false;
+    ClockSync clock_;
+    LatencyStats latency_ = {};
+    LinkStats link_ = {};
+    std::function<void(const Telemetry&)> telemetry_callback_;
+    std::function<void(const std::string&)> console_callback_;
+
+    // Send times of recent FRAME_SETs, indexed by the device's set_count
+    static constexpr size_t SEND_HISTORY = 256;
+    uint64_t send_times_[SEND_HISTORY] = {};
+    uint64_t sets_sent_ = 0;
+    bool have_set_base_ = false;
+    uint32_t set_base_ = 0;                 // Device set_count before our first FRAME_SET
+    uint32_t last_set_count_ = 0;
+};
+
+} // namespace servo2040_host
@@ -0,0 +1,155 @@
+#include "log_format.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+#include "deferred_log.hpp"
+#include "protocol.hpp"
+
+namespace servo2040_host {
+
+using namespace protocol;
+
+namespace {
+
+// Literal text between conversions, with %% turned into %
+void append_literal(std::string& out, const char* text, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        out += text[i];
+        if (text[i] == '%' && i + 1 < length && text[i + 1] == '%') {
+            i++;
+        }
+    }
+}
+
+template <typename T>
+void append_formatted(std::string& out, const std::string& spec, T value) {
+    char text[128];
+    int length = std::snprintf(text, sizeof(text), spec.c_str(), value);
+    if (length > 0) {
+        out.append(text, std::min<size_t>(length, sizeof(text) - 1));
+    }
+}
+
+} // namespace
+
+std::string format_log(const char* format, const uint32_t* words, unsigned count) {
+    std::string out;
+    unsigned used = 0;
+    unsigned at = 0;
+    for (auto c = deferred_log::nextConversion(format, 0); c.type != 0; c = deferred_log::nextConversion(format, c.end)) {
+        append_literal(out, format + at, c.start - at);
+        at = c.end;
+        if (c.words < 0 || used + c.words > count) {
+            out += "<?>";
+            used = count;
+            continue;
+        }
+        // Flags, width and precision as given; length modifiers are replaced
+        // to suit the host's types
+        std::string spec(format + c.start, c.end - 1 - c.start);
+        bool narrow = spec.find('h') != std::string::npos;
+        spec.erase(spec.find_last_not_of("hljztL") + 1);
+        uint64_t value = words[used];
+        if (c.words == 2) {
+            value |= (uint64_t)words[used + 1] << 32;
+        }
+        used += c.words;
+        switch (c.type) {
+        case 'd':
+        case 'i': {
+            int64_t signed_value = c.words == 2 ? (int64_t)value : (int64_t)(int32_t)value;
+            if (narrow) {
+                append_formatted(out, std::string(format + c.start, c.end - c.start), (int)signed_value);
+            } else {
+                append_formatted(out, spec + "ll" + c.type, (long long)signed_value);
+            }
+            break;
+        }
+        case 'u':
+        case 'x':
+        case 'X':
+        case 'o':
+            if (narrow) {
+                append_formatted(out, std::string(format + c.start, c.end - c.start), (unsigned)value);
+            } else {
+                append_formatted(out, spec + "ll" + c.type, (unsigned long long)value);
+            }
+            break;
+        case 'c':
+            append_formatted(out, spec + 'c', (int)(uint8_t)value);
+            break;
+        case 'p':
+            append_formatted(out, std::string("0x%08x"), (unsigned)value);
+            break;
+        default: {
+            float f;
+            uint32_t bits = (uint32_t)value;
+            std::memcpy(&f, &bits, sizeof(f));
+            append_formatted(out, spec + c.type, (double)f);
+            break;
+        }
+        }
+    }
+    append_literal(out, format + at, std::strlen(format + at));
+    return out;
+}
+
+LogStrings::LogStrings(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("Can't open " + path + ": " + std::strerror(errno));
+    }
+    table_.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    table_.push_back('\0');
+}
+
+const char* LogStrings::format(uint16_t site) const {
+    if (site + 1u >= table_.size() || (site > 0 && table_[site - 1] != '\0')) {
+        return nullptr;
+    }
+    return &table_[site];
+}
+
+void decode_log_frame(const LogStrings& strings, const uint8_t* payload, size_t length,
+                      const std::function<void(uint32_t device_time_us, const std::string& text)>& on_record) {
+    size_t pos = 0;
+    while (pos + LOG_RECORD_ARGS <= length) {
+        const uint8_t* record = payload + pos;
+        uint16_t site = get_u16(record + LOG_RECORD_SITE);
+        uint32_t time_us = get_u32(record + LOG_RECORD_TIME);
+        unsigned count = record[LOG_RECORD_COUNT];
+        if (pos + LOG_RECORD_ARGS + 4 * count > length || count > LOG_MAX_ARGS) {
+            on_record(time_us, "<truncated log record>");
+            return;
+        }
+        uint32_t words[LOG_MAX_ARGS];
+        for (unsigned i = 0; i < count; i++) {
+            words[i] = get_u32(record + LOG_RECORD_ARGS + 4 * i);
+        }
+        pos += LOG_RECORD_ARGS + 4 * count;
+
+        std::string text;
+        const char* format = strings.format(site);
+        if (site == LOG_SITE_LOST && count == 1) {
+            text = "<" + std::to_string(words[0]) + " log records dropped>";
+        } else if (format == nullptr) {
+            char unknown[48];
+            std::snprintf(unknown, sizeof(unknown), "<unknown log site 0x%04x>", site);
+            text = unknown;
+        } else {
+            text = format_log(format, words, count);
+            while (!text.empty() && (text.back() == '\n' || text.back() == '\r')) {
+                text.pop_back();
+            }
+        }
+        on_record(time_us, text);
+    }
+}
+
+} // namespace servo2040_host
@@ -0,0 +1,42 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+/*
+Host-side formatting of the firmware's deferred log records
+
+The device sends FRAME_LOG records holding a log site ID and the raw
+argument words (see deferred_log.hpp). The site ID is an offset into the
+firmware's string table, servo2040_controller.logstr, which the firmware
+build extracts from the ELF. The table must come from the same build as the
+firmware on the board.
+*/
+
+namespace servo2040_host {
+
+// printf the way the device would have, from a format and its packed argument
+// words. Missing arguments are shown as "<?>".
+std::string format_log(const char* format, const uint32_t* words, unsigned count);
+
+// The firmware's log string table
+class LogStrings {
+public:
+    // Throws std::runtime_error if the file can't be read
+    explicit LogStrings(const std::string& path);
+
+    // Format string of a site, nullptr if no string starts at that offset
+    const char* format(uint16_t site) const;
+
+private:
+    std::vector<char> table_;
+};
+
+// Format every record in a FRAME_LOG payload. on_record gets the low 32 bits
+// of the device time the record was made, and the text.
+void decode_log_frame(const LogStrings& strings, const uint8_t* payload, size_t length,
+                      const std::function<void(uint32_t device_time_us, const std::string& text)>& on_record);
+
+} // namespace servo2040_host
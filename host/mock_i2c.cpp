@@ -0,0 +1,82 @@
+#include "mock_i2c.hpp"
+
+#include <cstring>
+
+#include "pca9685.hpp"
+
+namespace servo2040_host {
+
+// Power-on state: asleep, all-call on, 200 Hz, outputs off
+MockPca9685::MockPca9685() {
+    std::memset(regs_, 0, sizeof(regs_));
+    regs_[PCA9685_MODE1] = PCA9685_MODE1_SLEEP | PCA9685_MODE1_ALLCALL;
+    regs_[PCA9685_MODE2] = PCA9685_MODE2_OUTDRV;
+    regs_[PCA9685_PRE_SCALE] = 0x1E;
+    for (unsigned o = 0; o < PCA9685_OUTPUTS; o++) {
+        regs_[PCA9685_LED0_ON_L + 4 * o + 3] = 0x10;   // Full off
+    }
+}
+
+void MockPca9685::write(const uint8_t* data, size_t length) {
+    if (length == 0) {
+        return;
+    }
+    writes_++;
+    uint8_t pointer = data[0];
+    for (size_t i = 1; i < length; i++) {
+        if (pointer == PCA9685_PRE_SCALE && !asleep()) {
+            ignored_++;
+        } else {
+            regs_[pointer] = data[i];
+        }
+        if (auto_increment()) {
+            // The pointer runs through the output registers and wraps to MODE1;
+            // the ALL_LED and PRE_SCALE registers aren't reached this way
+            pointer = pointer >= PCA9685_LED0_ON_L + 4 * PCA9685_OUTPUTS - 1 ? PCA9685_MODE1 : pointer + 1;
+        }
+    }
+}
+
+bool MockPca9685::asleep() const {
+    return regs_[PCA9685_MODE1] & PCA9685_MODE1_SLEEP;
+}
+
+bool MockPca9685::auto_increment() const {
+    return regs_[PCA9685_MODE1] & PCA9685_MODE1_AI;
+}
+
+float MockPca9685::pulse_us(unsigned output) const {
+    const uint8_t* led = regs_ + PCA9685_LED0_ON_L + 4 * output;
+    if (asleep() || (led[3] & 0x10)) {
+        return 0;
+    }
+    unsigned on = (led[0] | led[1] << 8) & 0xFFF;
+    unsigned off = (led[2] | led[3] << 8) & 0xFFF;
+    if (led[1] & 0x10) {
+        return period_us();
+    }
+    unsigned high = (off + PCA9685_COUNTS - on) % PCA9685_COUNTS;
+    return pca9685PulseUs((uint16_t)high, regs_[PCA9685_PRE_SCALE]);
+}
+
+float MockPca9685::period_us() const {
+    return pca9685PulseUs(PCA9685_COUNTS, regs_[PCA9685_PRE_SCALE]);
+}
+
+bool MockI2cBus::write(uint8_t address, const uint8_t* data, size_t length) {
+    busy_us_ += transaction_us(length);
+    bytes_ += length + 1;
+    auto device = devices_.find(address);
+    if (device == devices_.end()) {
+        naks_++;
+        return false;
+    }
+    device->second->write(data, length);
+    return true;
+}
+
+double MockI2cBus::transaction_us(size_t length) const {
+    return ((length + 1) * 9 + 2) * 1e6 / baud_;
+}
+
+} // namespace servo2040_host
@@ -0,0 +1,71 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <map>
+
+/*
+Mock I²C bus and PCA9685
+
+For checking what the firmware puts on the expansion bus (pca9685.hpp)
+without the hardware. MockI2cBus takes whole write transactions, as the
+board's DMA sends them, hands them to the device at the address, and adds up
+how long they keep the bus busy. MockPca9685 keeps a real chip's register
+file, including the register pointer's auto-increment, and reports the pulse
+each output would produce.
+*/
+
+namespace servo2040_host {
+
+class MockPca9685 {
+public:
+    MockPca9685();
+
+    // One write transaction's data bytes: the register pointer, then values
+    void write(const uint8_t* data, size_t length);
+
+    uint8_t reg(uint8_t address) const { return regs_[address]; }
+    bool asleep() const;
+    bool auto_increment() const;
+
+    // High time of an output in µs (0 if it is off), from its ON/OFF counts
+    // and the prescaler, taking the oscillator as exactly 25 MHz
+    float pulse_us(unsigned output) const;
+    // PWM period in µs
+    float period_us() const;
+
+    uint64_t writes() const { return writes_; }
+    uint64_t ignored() const { return ignored_; }
+
+private:
+    uint8_t regs_[256];
+    uint64_t writes_ = 0;
+    uint64_t ignored_ = 0;      // PRE_SCALE writes while awake, which the chip ignores
+};
+
+class MockI2cBus {
+public:
+    explicit MockI2cBus(unsigned baud) : baud_(baud) {}
+
+    void attach(uint8_t address, MockPca9685& device) { devices_[address] = &device; }
+
+    // START, address, data, STOP. Returns false (the address is NAKed) if no
+    // device is attached there. Either way the bus is busy for transaction_us().
+    bool write(uint8_t address, const uint8_t* data, size_t length);
+
+    // Nine bit times per byte (8 data, ACK) for the address and data, plus
+    // START and STOP
+    double transaction_us(size_t length) const;
+
+    double busy_us() const { return busy_us_; }
+    uint64_t bytes() const { return bytes_; }
+    uint64_t naks() const { return naks_; }
+
+private:
+    unsigned baud_;
+    std::map<uint8_t, MockPca9685*> devices_;
+    double busy_us_ = 0;
+    uint64_t bytes_ = 0;
+    uint64_t naks_ = 0;
+};
+
+} // namespace servo2040_host
@@ -0,0 +1,165 @@
+"""Python bindings for the Servo2040 host SDK.
+
+Wraps libservo2040_host (built from ../) with ctypes, so no compiler is
+needed on the Python side:
+
+    from servo2040 import Hand
+    with Hand("/dev/ttyACM0") as hand:
+        hand.set_target(0, 45)
+        print(hand.latency())
+"""
+
+import ctypes
+import ctypes.util
+import os
+
+# The board's 18 channels; replaced by the library's count, which includes
+# any expansion channels, when it loads
+NUM_CHANNELS = 18
+
+
+def _telemetry_type(channels):
+    class Telemetry(ctypes.Structure):
+        _fields_ = [
+            ("device_time_us", ctypes.c_uint64),
+            ("host_time_us", ctypes.c_uint64),
+            ("set_count", ctypes.c_uint32),
+            ("merged_frames", ctypes.c_uint32),
+            ("dropped_targets", ctypes.c_uint32),
+            ("positions", ctypes.c_int16 * channels),
+        ]
+    return Telemetry
+
+
+Telemetry = _telemetry_type(NUM_CHANNELS)
+
+
+class Latency(ctypes.Structure):
+    _fields_ = [
+        ("samples", ctypes.c_uint64),
+        ("last_us", ctypes.c_int64),
+        ("min_us", ctypes.c_int64),
+        ("max_us", ctypes.c_int64),
+        ("mean_us", ctypes.c_double),
+    ]
+
+
+class LinkStats(ctypes.Structure):
+    _fields_ = [
+        ("frames_sent", ctypes.c_uint64),
+        ("bytes_sent", ctypes.c_uint64),
+        ("targets_coalesced", ctypes.c_uint64),
+        ("frames_received", ctypes.c_uint64),
+        ("bytes_received", ctypes.c_uint64),
+    ]
+
+
+def _load_library():
+    path = os.environ.get("SERVO2040_HOST_LIB")
+    if path is None:
+        here = os.path.dirname(os.path.abspath(__file__))
+        for candidate in (os.path.join(here, "libservo2040_host.so"),
+                          os.path.join(here, "..", "build", "libservo2040_host.so")):
+            if os.path.exists(candidate):
+                path = candidate
+                break
+    if path is None:
+        path = ctypes.util.find_library("servo2040_host")
+    if path is None:
+        raise OSError("libservo2040_host not found, build host/ or set SERVO2040_HOST_LIB")
+
+    global NUM_CHANNELS, Telemetry
+    lib = ctypes.CDLL(path)
+    lib.s2040_num_channels.restype = ctypes.c_uint
+    NUM_CHANNELS = lib.s2040_num_channels()
+    Telemetry = _telemetry_type(NUM_CHANNELS)
+    hand_p = ctypes.c_void_p
+    lib.s2040_open.argtypes = [ctypes.c_char_p, ctypes.c_uint, ctypes.c_uint, ctypes.c_int, ctypes.c_char_p,
+                               ctypes.c_char_p, ctypes.c_char_p]
+    lib.s2040_open.restype = hand_p
+    lib.s2040_close.argtypes = [hand_p]
+    lib.s2040_set_target.argtypes = [hand_p, ctypes.c_uint, ctypes.c_int]
+    lib.s2040_set_targets.argtypes = [hand_p, ctypes.POINTER(ctypes.c_int16), ctypes.c_uint32]
+    lib.s2040_send_line.argtypes = [hand_p, ctypes.c_char_p]
+    lib.s2040_telemetry.argtypes = [hand_p, ctypes.POINTER(Telemetry)]
+    lib.s2040_telemetry.restype = ctypes.c_int
+    lib.s2040_latency.argtypes = [hand_p, ctypes.POINTER(Latency)]
+    lib.s2040_link_stats.argtypes = [hand_p, ctypes.POINTER(LinkStats)]
+    return lib
+
+
+_lib = None
+
+
+class Hand:
+    """A Servo2040 hand. Targets are coalesced and sent from a background thread."""
+
+    def __init__(self, port, tick_hz=500, telemetry_ms=10, checked=False, trace=None,
+                 telemetry_port=None, log_strings=None):
+        """port: serial device, or "usb" / "usb:<serial>" for the USB command interface
+        trace: file to record the session to, for servo2040_replay
+        telemetry_port: the board's second USB serial port, to read telemetry there
+        log_strings: the firmware's servo2040_controller.logstr, to have its debug
+                     output sent as deferred records and formatted here"""
+        global _lib
+        if _lib is None:
+            _lib = _load_library()
+        self._handle = _lib.s2040_open(port.encode(), tick_hz, telemetry_ms, int(checked),
+                                       trace.encode() if trace else None,
+                                       telemetry_port.encode() if telemetry_port else None,
+                                       log_strings.encode() if log_strings else None)
+        if not self._handle:
+            raise OSError("Can't open " + port)
+
+    def close(self):
+        if self._handle:
+            _lib.s2040_close(self._handle)
+            self._handle = None
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc):
+        self.close()
+
+    def __del__(self):
+        self.close()
+
+    def set_target(self, channel, degrees):
+        _lib.s2040_set_target(self._handle, channel, int(degrees))
+
+    def set_targets(self, targets):
+        """targets: dict of channel → degrees, or a sequence covering channels 0..n"""
+        items = targets.items() if isinstance(targets, dict) else enumerate(targets)
+        values = (ctypes.c_int16 * NUM_CHANNELS)()
+        mask = 0
+        for channel, degrees in items:
+            values[channel] = int(degrees)
+            mask |= 1 << channel
+        _lib.s2040_set_targets(self._handle, values, mask)
+
+    def send_line(self, line):
+        _lib.s2040_send_line(self._handle, line.encode())
+
+    def telemetry(self):
+        t = Telemetry()
+        if not _lib.s2040_telemetry(self._handle, ctypes.byref(t)):
+            return None
+        return {
+            "device_time_us": t.device_time_us,
+            "host_time_us": t.host_time_us,
+            "set_count": t.set_count,
+            "merged_frames": t.merged_frames,
+            "dropped_targets": t.dropped_targets,
+            "positions": list(t.positions),
+        }
+
+    def latency(self):
+        l = Latency()
+        _lib.s2040_latency(self._handle, ctypes.byref(l))
+        return {name: getattr(l, name) for name, _ in Latency._fields_}
+
+    def link_stats(self):
+        s = LinkStats()
+        _lib.s2040_link_stats(self._handle, ctypes.byref(s))
+        return {name: getattr(s, name) for name, _ in LinkStats._fields_}
@@ -0,0 +1,125 @@
+#include "serial_port.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+namespace servo2040_host {
+
+namespace {
+
+speed_t to_speed(unsigned baud) {
+    switch (baud) {
+    case 9600: return B9600;
+    case 19200: return B19200;
+    case 38400: return B38400;
+    case 57600: return B57600;
+    case 115200: return B115200;
+    case 230400: return B230400;
+#ifdef B921600
+    case 921600: return B921600;
+#endif
+    // Direct UART links (uart_link.hpp)
+#ifdef B1000000
+    case 1000000: return B1000000;
+#endif
+#ifdef B1500000
+    case 1500000: return B1500000;
+#endif
+#ifdef B2000000
+    case 2000000: return B2000000;
+#endif
+#ifdef B3000000
+    case 3000000: return B3000000;
+#endif
+#ifdef B4000000
+    case 4000000: return B4000000;
+#endif
+    default: throw std::runtime_error("Unsupported baud rate " + std::to_string(baud));
+    }
+}
+
+std::runtime_error system_error(const std::string& what) {
+    return std::runtime_error(what + ": " + std::strerror(errno));
+}
+
+} // namespace
+
+SerialPort::SerialPort(const std::string& path, unsigned baud) {
+    fd_ = ::open(path.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (fd_ < 0) {
+        throw system_error("Can't open " + path);
+    }
+
+    termios tty;
+    if (tcgetattr(fd_, &tty) != 0) {
+        ::close(fd_);
+        throw system_error("Can't configure " + path);
+    }
+    cfmakeraw(&tty);
+    cfsetispeed(&tty, to_speed(baud));
+    cfsetospeed(&tty, to_speed(baud));
+    tty.c_cflag |= CLOCAL | CREAD;
+    tty.c_cc[VMIN] = 0;
+    tty.c_cc[VTIME] = 0;
+    if (tcsetattr(fd_, TCSANOW, &tty) != 0) {
+        ::close(fd_);
+        throw system_error("Can't configure " + path);
+    }
+    tcflush(fd_, TCIOFLUSH);
+}
+
+SerialPort::~SerialPort() {
+    if (fd_ >= 0) {
+        ::close(fd_);
+    }
+}
+
+void SerialPort::write_all(const uint8_t* data, size_t length) {
+    while (length > 0) {
+        ssize_t written = ::write(fd_, data, length);
+        if (written > 0) {
+            data += written;
+            length -= written;
+        } else if (written < 0 && errno != EAGAIN && errno != EINTR) {
+            throw system_error("Serial write failed");
+        } else {
+            pollfd pfd = {fd_, POLLOUT, 0};
+            ::poll(&pfd, 1, 10);
+        }
+    }
+}
+
+size_t SerialPort::read_some(uint8_t* data, size_t capacity, int64_t timeout_us) {
+    pollfd pfd = {fd_, POLLIN, 0};
+    int timeout_ms = timeout_us > 0 ? (int)((timeout_us + 999) / 1000) : 0;
+    int ready = ::poll(&pfd, 1, timeout_ms);
+    if (ready < 0) {
+        if (errno == EINTR) {
+            return 0;
+        }
+        throw system_error("Serial poll failed");
+    }
+    if (ready == 0) {
+        return 0;
+    }
+    if (pfd.revents & (POLLERR | POLLHUP | POLLNVAL)) {
+        throw std::runtime_error("Serial port disconnected");
+    }
+
+    ssize_t count = ::read(fd_, data, capacity);
+    if (count < 0) {
+        if (errno == EAGAIN || errno == EINTR) {
+            return 0;
+        }
+        throw system_error("Serial read failed");
+    }
+    return (size_t)count;
+}
+
+} // namespace servo2040_host
@@ -0,0 +1,28 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "transport.hpp"
+
+namespace servo2040_host {
+
+// Raw (non-canonical) POSIX serial port, as exposed by the Servo2040's USB CDC interface,
+// or a UART wired to its Qw/ST connector (the rate only matters for the latter)
+class SerialPort : public Transport {
+public:
+    // Throws std::runtime_error if the port can't be opened
+    explicit SerialPort(const std::string& path, unsigned baud = 115200);
+    ~SerialPort() override;
+
+    SerialPort(const SerialPort&) = delete;
+    SerialPort& operator=(const SerialPort&) = delete;
+
+    void write_all(const uint8_t* data, size_t length) override;
+    size_t read_some(uint8_t* data, size_t capacity, int64_t timeout_us) override;
+
+private:
+    int fd_ = -1;
+};
+
+} // namespace servo2040_host
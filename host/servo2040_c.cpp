@@ -0,0 +1,83 @@
+#include "servo2040_c.h"
+#include "hand.hpp"
+
+#include <cstdio>
+#include <cstring>
+
+using namespace servo2040_host;
+
+static_assert(S2040_NUM_CHANNELS == NUM_CHANNELS, "C API channel count must match the protocol");
+
+struct s2040_hand {
+    Hand hand;
+    s2040_hand(const char* port, HandOptions options) : hand(port, options) {}
+};
+
+s2040_hand* s2040_open(const char* port, unsigned tick_hz, unsigned telemetry_ms, int checked,
+                       const char* trace_path, const char* telemetry_port, const char* log_strings) {
+    HandOptions options;
+    options.tick_hz = tick_hz;
+    options.telemetry_ms = telemetry_ms;
+    options.checked = checked != 0;
+    options.trace_path = trace_path != nullptr ? trace_path : "";
+    options.telemetry_port = telemetry_port != nullptr ? telemetry_port : "";
+    options.log_strings = log_strings != nullptr ? log_strings : "";
+    try {
+        return new s2040_hand(port, options);
+    } catch (const std::exception& e) {
+        std::fprintf(stderr, "servo2040: %s\n", e.what());
+        return nullptr;
+    }
+}
+
+void s2040_close(s2040_hand* hand) {
+    delete hand;
+}
+
+void s2040_set_target(s2040_hand* hand, unsigned channel, int degrees) {
+    hand->hand.set_target(channel, degrees);
+}
+
+void s2040_set_targets(s2040_hand* hand, const int16_t* degrees, uint32_t mask) {
+    hand->hand.set_targets(degrees, mask);
+}
+
+void s2040_send_line(s2040_hand* hand, const char* line) {
+    hand->hand.send_line(line);
+}
+
+int s2040_telemetry(s2040_hand* hand, s2040_telemetry_t* out) {
+    Telemetry t;
+    if (!hand->hand.telemetry(t)) {
+        return 0;
+    }
+    out->device_time_us = t.device_time_us;
+    out->host_time_us = t.host_time_us;
+    out->set_count = t.set_count;
+    out->merged_frames = t.merged_frames;
+    out->dropped_targets = t.dropped_targets;
+    std::memcpy(out->positions, t.positions, sizeof(out->positions));
+    return 1;
+}
+
+void s2040_latency(s2040_hand* hand, s2040_latency_t* out) {
+    LatencyStats l = hand->hand.latency();
+    out->samples = l.samples;
+    out->last_us = l.last_us;
+    out->min_us = l.min_us;
+    out->max_us = l.max_us;
+    out->mean_us = l.mean_us;
+}
+
+void s2040_link_stats(s2040_hand* hand, s2040_link_stats_t* out) {
+    LinkStats l = hand->hand.link_stats();
+    out->frames_sent = l.frames_sent;
+    out->bytes_sent = l.bytes_sent;
+    out->targets_coalesced = l.targets_coalesced;
+    out->frames_received = l.frames_received;
+    out->bytes_received = l.bytes_received;
+}
+
+unsigned s2040_num_channels(void) {
+    return S2040_NUM_CHANNELS;
+}
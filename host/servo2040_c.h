@@ -0,0 +1,76 @@
+#ifndef SERVO2040_C_H
+#define SERVO2040_C_H
+
+/*
+C interface to the host SDK, for the Python bindings (ctypes) and other languages.
+See hand.hpp for the behaviour of each call.
+*/
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// The board's 18 channels, then any expansion channels; build with the same
+// SERVO2040_EXPANSION_CHANNELS as the firmware
+#ifndef SERVO2040_EXPANSION_CHANNELS
+#define SERVO2040_EXPANSION_CHANNELS 0
+#endif
+#define S2040_NUM_CHANNELS (18 + SERVO2040_EXPANSION_CHANNELS)
+
+typedef struct s2040_hand s2040_hand;
+
+typedef struct {
+    uint64_t device_time_us;
+    uint64_t host_time_us;
+    uint32_t set_count;
+    uint32_t merged_frames;
+    uint32_t dropped_targets;
+    int16_t positions[S2040_NUM_CHANNELS];
+} s2040_telemetry_t;
+
+typedef struct {
+    uint64_t samples;
+    int64_t last_us;
+    int64_t min_us;
+    int64_t max_us;
+    double mean_us;
+} s2040_latency_t;
+
+typedef struct {
+    uint64_t frames_sent;
+    uint64_t bytes_sent;
+    uint64_t targets_coalesced;
+    uint64_t frames_received;
+    uint64_t bytes_received;
+} s2040_link_stats_t;
+
+// port is a serial device or "usb[:serial]" (see transport.hpp).
+// Returns NULL on failure; the reason is written to stderr.
+// trace_path may be NULL; otherwise the session is recorded there (see trace.hpp).
+// telemetry_port may be NULL; otherwise telemetry is read from the board's
+// USB telemetry port there (see hand.hpp).
+// log_strings may be NULL; otherwise it is the firmware's log string table,
+// and the board's debug output is sent as deferred records (see log_format.hpp).
+s2040_hand* s2040_open(const char* port, unsigned tick_hz, unsigned telemetry_ms, int checked,
+                       const char* trace_path, const char* telemetry_port, const char* log_strings);
+void s2040_close(s2040_hand* hand);
+
+void s2040_set_target(s2040_hand* hand, unsigned channel, int degrees);
+void s2040_set_targets(s2040_hand* hand, const int16_t* degrees, uint32_t mask);
+void s2040_send_line(s2040_hand* hand, const char* line);
+
+// Returns 0 if no telemetry has arrived yet
+int s2040_telemetry(s2040_hand* hand, s2040_telemetry_t* out);
+void s2040_latency(s2040_hand* hand, s2040_latency_t* out);
+void s2040_link_stats(s2040_hand* hand, s2040_link_stats_t* out);
+
+// S2040_NUM_CHANNELS as the library was built, for bindings that don't read this header
+unsigned s2040_num_channels(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,137 @@
+#include "sim_board.hpp"
+
+#include <algorithm>
+#include <cstdio>
+
+#include "log_format.hpp"
+
+namespace servo2040_host {
+
+int SimHal::readByte() {
+    if (input.empty()) {
+        return -1;
+    }
+    uint8_t c = input.front();
+    input.pop_front();
+    return c;
+}
+
+void SimHal::write(const uint8_t* data, unsigned length) {
+    output.insert(output.end(), data, data + length);
+}
+
+void SimHal::vprint(const char* format, va_list args) {
+    char text[256];
+    int length = std::vsnprintf(text, sizeof(text), format, args);
+    if (length > 0) {
+        output.insert(output.end(), text, text + std::min<size_t>(length, sizeof(text) - 1));
+    }
+}
+
+// Formatted here, as the host would with the firmware's string table
+void SimHal::logRecord(const char* site, const uint32_t* words, unsigned count) {
+    std::string text = format_log(site, words, count);
+    output.insert(output.end(), text.begin(), text.end());
+}
+
+void SimHal::setPulse(unsigned channel, uint16_t pulse_q4) {
+    if (pulse_q4 != pulses[channel] && on_pulse) {
+        on_pulse(channel, pulse_q4 / 16.0f);
+    }
+    pulses[channel] = pulse_q4;
+}
+
+void SimHal::setPulses(const uint16_t* pulses_q4, uint32_t mask) {
+    ControllerHal::setPulses(pulses_q4, mask);
+    if (on_tick) {
+        on_tick();
+    }
+}
+
+// Inverse of the core's pulse mapping
+float SimHal::servoValue(unsigned channel) {
+    return (pulses[channel] - PULSE_CENTRE_Q4) * 140.0f / (500 << PULSE_FRAC_BITS);
+}
+
+bool SimHal::loadPoses(PoseTable& table) {
+    if (have_poses) {
+        table = poses;
+    }
+    return have_poses;
+}
+
+void SimHal::storePoses(const PoseTable& table) {
+    poses = table;
+    have_poses = true;
+}
+
+void SimHal::pulseSyncLine() {
+    if (sync_pulse) {
+        sync_pulse();
+    }
+}
+
+void SimHal::busTransmit(const uint8_t* data, unsigned length, uint64_t at_us) {
+    bus_output.push_back({std::max(at_us, time_us), std::vector<uint8_t>(data, data + length)});
+}
+
+bool SimHal::setAlarm(uint64_t time_us) {
+    if (time_us <= this->time_us) {
+        return true;
+    }
+    alarm_set = true;
+    alarm_us = time_us;
+    return false;
+}
+
+SimBoard::SimBoard(uint64_t start_us) : core_(hal_) {
+    hal_.time_us = start_us;
+    std::fill(hal_.pulses, hal_.pulses + NUM_SERVOS, (uint16_t)PULSE_CENTRE_Q4);
+    // A lone board sees its own sync pulse
+    hal_.sync_pulse = [this] { sync_edge(hal_.time_us); };
+    core_.begin();
+}
+
+void SimBoard::receive(const uint8_t* data, size_t length) {
+    hal_.input.insert(hal_.input.end(), data, data + length);
+}
+
+void SimBoard::sync_edge(uint64_t time_us) {
+    edge_set_ = true;
+    edge_us_ = std::max(time_us, hal_.time_us);
+}
+
+void SimBoard::advance_to(uint64_t time_us) {
+    while (hal_.time_us < time_us) {
+        if (hal_.alarm_set && hal_.alarm_us <= hal_.time_us) {
+            hal_.alarm_set = false;
+            core_.runScheduledFrames();
+        }
+        if (edge_set_ && edge_us_ <= hal_.time_us) {
+            edge_set_ = false;
+            core_.syncEdge();
+        }
+        if (hal_.time_us >= next_poll_us_) {
+            if (core_.poll()) {
+                continue; // Go straight round again while there is input, as the firmware does
+            }
+            next_poll_us_ = hal_.time_us + loop_us_;
+        }
+        // Input arriving while the loop sleeps waits for it to wake up
+        uint64_t next = std::min(next_poll_us_, time_us);
+        if (hal_.alarm_set && hal_.alarm_us < next) {
+            next = hal_.alarm_us;
+        }
+        if (edge_set_ && edge_us_ < next) {
+            next = edge_us_;
+        }
+        hal_.time_us = std::max(next, hal_.time_us + 1);
+    }
+}
+
+void SimBoard::take_output(std::vector<uint8_t>& out) {
+    out.insert(out.end(), hal_.output.begin(), hal_.output.end());
+    hal_.output.clear();
+}
+
+} // namespace servo2040_host
@@ -0,0 +1,101 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <vector>
+
+#include "controller_core.hpp"
+
+/*
+The firmware's controller core on a virtual clock
+
+SimBoard runs the same ControllerCore as the Servo2040, with a ControllerHal
+that keeps time, input, output, servo pulses and the pose table in memory.
+Time only moves when advance_to() is called, so a session can be replayed at
+any speed and gives the same result every time.
+*/
+
+namespace servo2040_host {
+
+class SimHal : public ControllerHal {
+public:
+    uint64_t timeUs() override { return time_us; }
+    int readByte() override;
+    void write(const uint8_t* data, unsigned length) override;
+    void vprint(const char* format, va_list args) override;
+    void logRecord(const char* site, const uint32_t* words, unsigned count) override;
+    void setPulse(unsigned channel, uint16_t pulse_q4) override;
+    void setPulses(const uint16_t* pulses_q4, uint32_t mask) override;
+    float servoValue(unsigned channel) override;
+    bool loadPoses(PoseTable& table) override;
+    void storePoses(const PoseTable& table) override;
+    void pulseSyncLine() override;
+    void busTransmit(const uint8_t* data, unsigned length, uint64_t at_us) override;
+    bool setAlarm(uint64_t time_us) override;
+    void cancelAlarm() override { alarm_set = false; }
+    uint64_t frameTimeoutUs() override { return frame_timeout_us; }
+
+    uint64_t time_us = 0;
+    std::deque<uint8_t> input;          // Bytes from the host, not yet read by the core
+    std::vector<uint8_t> output;        // Frames and console text from the core
+    uint16_t pulses[NUM_SERVOS];        // 1/16 µs, as the core computes them
+    bool have_poses = false;
+    PoseTable poses;
+    bool alarm_set = false;
+    uint64_t alarm_us = 0;
+    uint64_t frame_timeout_us = RX_FRAME_TIMEOUT_US;  // UART_IDLE_US for a UART link
+    struct BusTransmission {
+        uint64_t at_us;                 // When it goes on the line (device time)
+        std::vector<uint8_t> data;
+    };
+    std::vector<BusTransmission> bus_output;  // Frames the core sent on the RS-485 bus
+    std::function<void()> sync_pulse;   // Called when the core pulses the sync line (master), to wire it to other boards
+    std::function<void(unsigned channel, float pulse_us)> on_pulse;  // Called when a pulse width changes
+    std::function<void()> on_tick;      // Called after each control tick has set its pulses
+};
+
+class SimBoard {
+public:
+    // Main loop period when idle (the firmware sleeps 1 ms between passes, or
+    // BUS_POLL_US on a bus)
+    static const uint64_t LOOP_US = 1000;
+
+    // start_us is the device clock at power-up
+    explicit SimBoard(uint64_t start_us = 0);
+
+    SimBoard(const SimBoard&) = delete;
+    SimBoard& operator=(const SimBoard&) = delete;
+
+    uint64_t now() const { return hal_.time_us; }
+    void set_loop_us(uint64_t loop_us) { loop_us_ = loop_us; }
+
+    // Queue bytes as if the host had just sent them
+    void receive(const uint8_t* data, size_t length);
+
+    // The sync line rises at time_us (device time, or now if that has passed).
+    // The core's edge interrupt runs then, whatever the main loop is doing.
+    void sync_edge(uint64_t time_us);
+
+    // Run the main loop up to time_us, firing scheduled frames and sync edges on time
+    void advance_to(uint64_t time_us);
+
+    // Take everything the core has sent since the last call
+    void take_output(std::vector<uint8_t>& out);
+
+    int position(unsigned channel) const { return core_.position(channel); }
+    float pulse(unsigned channel) const { return hal_.pulses[channel] / 16.0f; }
+
+    SimHal& hal() { return hal_; }
+    ControllerCore& core() { return core_; }
+
+private:
+    SimHal hal_;
+    ControllerCore core_;
+    uint64_t loop_us_ = LOOP_US;
+    uint64_t next_poll_us_ = 0;  // When the main loop next wakes up
+    bool edge_set_ = false;
+    uint64_t edge_us_ = 0;       // When the sync edge interrupt runs
+};
+
+} // namespace servo2040_host
@@ -0,0 +1,171 @@
+#include "simulation.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace servo2040_host {
+
+void ServoModel::reset(double angle) {
+    angle_ = angle;
+    velocity_ = 0;
+    rate_limited_ = false;
+    current_ma_ = 0;
+}
+
+void ServoModel::step(double target, double dt_s, const ServoParams& params) {
+    // Exact first-order response over the step, then clipped to the slew limit
+    double tau_s = params.time_constant_ms / 1000.0;
+    double move = (target - angle_) * (tau_s > 0 ? 1.0 - std::exp(-dt_s / tau_s) : 1.0);
+    double max_move = params.max_rate_dps * dt_s;
+    rate_limited_ = params.max_rate_dps > 0 && std::fabs(move) > max_move;
+    // Drive effort is the unclipped move as a fraction of what the motor can do
+    double effort = params.max_rate_dps > 0 ? std::min(1.0, std::fabs(move) / max_move) : 0.0;
+    current_ma_ = params.idle_current_ma + (params.stall_current_ma - params.idle_current_ma) * effort;
+    if (rate_limited_) {
+        move = move > 0 ? max_move : -max_move;
+    }
+    angle_ += move;
+    velocity_ = move / dt_s;
+}
+
+Simulation::Simulation(const std::string& trace_path, SimOptions options)
+    : options_(options), trace_(trace_path) {
+    options_.step_us = std::max<uint64_t>(options_.step_us, 1);
+    board_.reset(new SimBoard(trace_device_start(trace_)));
+    start_us_ = model_time_ = board_->now();
+    for (unsigned c = 0; c < NUM_SERVOS; c++) {
+        servos_[c].reset(board_->hal().servoValue(c));
+    }
+    sets_applied_ = board_->core().setCount();
+    board_->hal().on_pulse = [this](unsigned channel, float pulse_us) {
+        stats_[channel].pulse_changes++;
+        changed_mask_ |= 1u << channel;
+        if (on_pulse) {
+            on_pulse(board_->now() - start_us_, channel, pulse_us);
+        }
+    };
+    board_->hal().on_tick = [this] { match_sets(); };
+}
+
+void Simulation::run() {
+    const TraceRecord* record;
+    const uint8_t* data;
+    uint64_t end_us = 0;
+    while (trace_.next(record, data)) {
+        end_us = record->time_us;
+        if (record->direction != TRACE_TX || record->kind != TRACE_BYTES) {
+            continue;
+        }
+        advance_to(start_us_ + record->time_us);
+        board_->receive(data, record->length);
+        writes_++;
+        queue_sets(data, record->length);
+    }
+    advance_to(start_us_ + end_us + options_.tail_us);
+
+    for (auto& stats : stats_) {
+        stats.mean_error_deg = steps_ ? stats.mean_error_deg / steps_ : 0;
+    }
+}
+
+// Note the SETs in a write that the board will accept (as decodeJointFrame does)
+void Simulation::queue_sets(const uint8_t* data, size_t length) {
+    using namespace protocol;
+    uint64_t now = board_->now();
+    tx_parser_.feed(data, length, [this, now](const Frame& frame) {
+        if (!frame.binary || frame.type != FRAME_SET || frame.length < 4) {
+            return;
+        }
+        uint32_t mask = get_u32(frame.data);
+        if ((mask & ~ALL_SERVOS) != 0 || frame.length != 4 + 2 * (size_t)__builtin_popcount(mask)) {
+            return;
+        }
+        for (size_t i = 4; i < frame.length; i += 2) {
+            int16_t position = (int16_t)get_u16(frame.data + i);
+            if (position < MIN_ANGLE || position > MAX_ANGLE) {
+                return;
+            }
+        }
+        sets_.push_back({mask, now});
+    });
+}
+
+// After each control tick: the SETs the board counted since the last one
+// were applied by it, and count if it moved one of their channels
+void Simulation::match_sets() {
+    uint32_t applied = board_->core().setCount();
+    while (sets_applied_ != applied && !sets_.empty()) {
+        const PendingSet& set = sets_.front();
+        if (set.mask & changed_mask_) {
+            board_stats_.latencies_us.push_back((uint32_t)(board_->now() - set.write_us));
+        }
+        sets_.pop_front();
+        sets_applied_++;
+    }
+    sets_applied_ = applied;
+    changed_mask_ = 0;
+}
+
+// Run the board and the servo models up to device_us, one model step at a time
+void Simulation::advance_to(uint64_t device_us) {
+    while (model_time_ + options_.step_us <= device_us) {
+        model_time_ += options_.step_us;
+        board_->advance_to(model_time_);
+        step_servos();
+        drain_output();
+    }
+    board_->advance_to(device_us);
+}
+
+void Simulation::step_servos() {
+    double dt_s = options_.step_us / 1e6;
+    SimHal& hal = board_->hal();
+    double total_ma = 0;
+    for (unsigned c = 0; c < NUM_SERVOS; c++) {
+        double target = hal.servoValue(c);
+        ServoModel& servo = servos_[c];
+        servo.step(target, dt_s, options_.servo);
+
+        ChannelStats& stats = stats_[c];
+        double error = std::fabs(target - servo.angle());
+        stats.max_error_deg = std::max(stats.max_error_deg, error);
+        stats.mean_error_deg += error;  // Summed here, divided at the end
+        stats.max_velocity_dps = std::max(stats.max_velocity_dps, std::fabs(servo.velocity()));
+        if (servo.rate_limited()) {
+            stats.rate_limited_s += dt_s;
+        }
+        stats.peak_current_ma = std::max(stats.peak_current_ma, servo.current_ma());
+        total_ma += servo.current_ma();
+    }
+
+    board_stats_.peak_current_ma = std::max(board_stats_.peak_current_ma, total_ma);
+    bool overcurrent = total_ma > options_.current_limit_ma;
+    if (overcurrent) {
+        board_stats_.overcurrent_s += dt_s;
+        if (!overcurrent_) {
+            board_stats_.overcurrent_events++;
+        }
+    }
+    overcurrent_ = overcurrent;
+    steps_++;
+    if (on_step) {
+        on_step(model_time_ - start_us_, servos_);
+    }
+}
+
+// Pass console lines on and discard everything else the core sent
+void Simulation::drain_output() {
+    if (!on_console) {
+        board_->hal().output.clear();
+        return;
+    }
+    board_->take_output(output_);
+    parser_.feed(output_.data(), output_.size(), [this](const Frame& frame) {
+        if (!frame.binary) {
+            on_console(std::string((const char*)frame.data, frame.length));
+        }
+    });
+    output_.clear();
+}
+
+} // namespace servo2040_host
@@ -0,0 +1,141 @@
+#pragma once
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "frame_parser.hpp"
+#include "sim_board.hpp"
+#include "trace.hpp"
+
+/*
+Offline simulation of a recorded session
+
+Simulation plays the host → device writes of a trace into a SimBoard on a
+virtual clock, as fast as the CPU allows, and drives a model of each servo
+from the pulses the firmware core produces: a first-order lag towards the
+commanded angle, limited to a maximum slew rate. The commanded pulses and
+the modelled angles can be streamed out, and tracking statistics are kept
+per channel.
+
+Current draw is modelled per servo as an idle current plus a share of the
+stall current in proportion to how hard the motor is driven. The motor is
+driven hard when it is far from its commanded angle, and at full stall
+current when it is at the slew limit. The board total is checked against a
+supply limit.
+
+Command latency is the time from the host write carrying a FRAME_SET to the
+pulse change it caused. SETs are matched to the control ticks that applied
+them by the device's set_count, as Hand matches telemetry, and a SET only
+counts if that tick changed the pulse of one of its channels. SETs that
+change nothing, and other writes, don't add to it.
+*/
+
+namespace servo2040_host {
+
+struct ServoParams {
+    double time_constant_ms = 30.0;    // First-order lag
+    double max_rate_dps = 400.0;       // Slew limit in °/s (a typical 0.15 s/60° servo)
+    double idle_current_ma = 10.0;     // Holding still
+    double stall_current_ma = 1000.0;  // Full drive
+};
+
+// A servo shaft following its commanded angle
+class ServoModel {
+public:
+    void reset(double angle);
+
+    // Advance by dt_s towards target (degrees)
+    void step(double target, double dt_s, const ServoParams& params);
+
+    double angle() const { return angle_; }
+    double velocity() const { return velocity_; }   // °/s over the last step
+    bool rate_limited() const { return rate_limited_; }
+    double current_ma() const { return current_ma_; }  // Over the last step
+
+private:
+    double angle_ = 0;
+    double velocity_ = 0;
+    bool rate_limited_ = false;
+    double current_ma_ = 0;
+};
+
+struct ChannelStats {
+    uint64_t pulse_changes;
+    double max_error_deg;        // Largest |commanded - modelled| angle
+    double mean_error_deg;
+    double max_velocity_dps;
+    double rate_limited_s;       // Time spent at the slew limit
+    double peak_current_ma;
+};
+
+// Whole-board results
+struct BoardStats {
+    std::vector<uint32_t> latencies_us;  // Command latency of each counted SET, in order
+    double peak_current_ma;              // Sum over all servos
+    double overcurrent_s;                // Time above SimOptions::current_limit_ma
+    uint64_t overcurrent_events;         // Times it went above the limit
+};
+
+struct SimOptions {
+    ServoParams servo;
+    uint64_t step_us = 1000;     // Servo model integration step
+    uint64_t tail_us = 500000;   // Keep going after the last write so the servos settle
+    double current_limit_ma = 5000;  // Servo supply budget for the whole board
+};
+
+class Simulation {
+public:
+    // Throws std::runtime_error if the trace can't be read
+    explicit Simulation(const std::string& trace_path, SimOptions options = SimOptions());
+
+    // Play the whole trace. May only be called once.
+    void run();
+
+    // Optional callbacks, times are µs since the start of the trace
+    std::function<void(uint64_t time_us, unsigned channel, float pulse_us)> on_pulse;
+    std::function<void(uint64_t time_us, const ServoModel* servos)> on_step;  // NUM_CHANNELS servos
+    std::function<void(const std::string& line)> on_console;
+
+    uint64_t duration_us() const { return model_time_ - start_us_; }
+    uint64_t writes() const { return writes_; }
+    const ChannelStats& channel(unsigned c) const { return stats_[c]; }
+    const BoardStats& board_stats() const { return board_stats_; }
+    const ServoModel& servo(unsigned c) const { return servos_[c]; }
+    SimBoard& board() { return *board_; }
+
+private:
+    void advance_to(uint64_t device_us);
+    void step_servos();
+    void drain_output();
+    void queue_sets(const uint8_t* data, size_t length);
+    void match_sets();
+
+    // A FRAME_SET written to the board, not yet applied
+    struct PendingSet {
+        uint32_t mask;
+        uint64_t write_us;              // Device time of the write
+    };
+
+    SimOptions options_;
+    TraceReader trace_;
+    std::unique_ptr<SimBoard> board_;
+    FrameParser parser_;
+    FrameParser tx_parser_;              // The trace's writes, for their SETs
+    std::vector<uint8_t> output_;
+    uint64_t start_us_;                  // Device time at the start of the trace
+    uint64_t model_time_;                // Device time the servo models have reached
+    uint64_t steps_ = 0;
+    uint64_t writes_ = 0;
+    ServoModel servos_[NUM_SERVOS];
+    ChannelStats stats_[NUM_SERVOS] = {};
+    BoardStats board_stats_ = {};
+    std::deque<PendingSet> sets_;        // In the order the board will count them
+    uint32_t sets_applied_ = 0;          // The board's set_count when sets_ was last matched
+    uint32_t changed_mask_ = 0;          // Channels whose pulse changed in the current tick
+    bool overcurrent_ = false;
+};
+
+} // namespace servo2040_host
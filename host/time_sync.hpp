@@ -0,0 +1,144 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+
+/*
+Host-side clock synchronisation with the Servo2040 device clock (time_us_64)
+
+Each exchange gives four timestamps, NTP style:
+  t0  host sends FRAME_TIME_REQUEST      (host clock)
+  t1  device receives it                 (device clock)
+  t2  device sends FRAME_TIME_REPLY      (device clock)
+  t3  host receives the reply            (host clock)
+
+offset = ((t1 - t0) + (t2 - t3)) / 2 is exact when both directions take the
+same time. USB jitter mostly adds delay in one direction, so only the samples
+with the lowest round trip in a sliding window are averaged into the offset.
+The filtered offset is recorded about once a second, and a least-squares line
+through that longer history gives the drift.
+*/
+
+namespace servo2040_host {
+
+class ClockSync {
+public:
+    static constexpr size_t WINDOW = 32;            // Raw samples kept
+    static constexpr int64_t RTT_MARGIN_US = 100;   // Accept samples within this of the best round trip
+    static constexpr size_t HISTORY = 64;           // Filtered offsets kept for the drift fit
+    static constexpr uint64_t HISTORY_INTERVAL_US = 1000000;
+
+    // Add one exchange, all times in µs
+    void add_sample(uint64_t t0, uint64_t t1, uint64_t t2, uint64_t t3) {
+        Sample& sample = samples_[next_];
+        sample.host_us = t0 + (t3 - t0) / 2;
+        sample.offset_us = ((int64_t)(t1 - t0) + (int64_t)(t2 - t3)) / 2;
+        sample.rtt_us = (int64_t)(t3 - t0) - (int64_t)(t2 - t1);
+        next_ = (next_ + 1) % WINDOW;
+        count_ = std::min(count_ + 1, WINDOW);
+        update(sample.host_us);
+    }
+
+    bool valid() const { return valid_; }
+
+    // device time - host time at host_us
+    int64_t offset_at(uint64_t host_us) const {
+        double since_ref = (double)(int64_t)(host_us - ref_host_us_);
+        return ref_offset_us_ + (int64_t)(since_ref * drift_);
+    }
+
+    uint64_t to_device(uint64_t host_us) const { return host_us + offset_at(host_us); }
+
+    // The offset changes by well under a µs per µs, so one correction step is enough
+    uint64_t to_host(uint64_t device_us) const {
+        uint64_t host_us = device_us - ref_offset_us_;
+        return device_us - offset_at(host_us);
+    }
+
+    // Drift of the device clock relative to the host, parts per billion
+    int32_t drift_ppb() const { return (int32_t)(drift_ * 1e9); }
+
+    // Estimate in the form carried by FRAME_TIME_REQUEST
+    uint64_t reference_us() const { return ref_host_us_; }
+    int64_t reference_offset_us() const { return ref_offset_us_; }
+
+    int64_t best_rtt_us() const { return best_rtt_us_; }
+
+private:
+    struct Sample {
+        uint64_t host_us;
+        int64_t offset_us;
+        int64_t rtt_us;
+    };
+
+    struct Point {
+        uint64_t host_us;
+        int64_t offset_us;
+    };
+
+    void update(uint64_t now_us) {
+        best_rtt_us_ = INT64_MAX;
+        for (size_t i = 0; i < count_; i++) {
+            best_rtt_us_ = std::min(best_rtt_us_, samples_[i].rtt_us);
+        }
+
+        // Average the good samples, moved to "now" with the current drift
+        double sum = 0;
+        size_t n = 0;
+        for (size_t i = 0; i < count_; i++) {
+            const Sample& sample = samples_[i];
+            if (sample.rtt_us > best_rtt_us_ + RTT_MARGIN_US) {
+                continue;
+            }
+            double since = (double)(int64_t)(now_us - sample.host_us);
+            sum += (double)(sample.offset_us - samples_[0].offset_us) + since * drift_;
+            n++;
+        }
+        ref_host_us_ = now_us;
+        ref_offset_us_ = samples_[0].offset_us + (int64_t)(sum / n);
+        valid_ = true;
+
+        if (history_count_ == 0 || now_us - history_[(history_next_ + HISTORY - 1) % HISTORY].host_us >= HISTORY_INTERVAL_US) {
+            history_[history_next_] = {ref_host_us_, ref_offset_us_};
+            history_next_ = (history_next_ + 1) % HISTORY;
+            history_count_ = std::min(history_count_ + 1, HISTORY);
+            fit_drift();
+        }
+    }
+
+    // Least squares slope of the filtered offset history
+    void fit_drift() {
+        if (history_count_ < 3) {
+            return;
+        }
+        const Point& base = history_[0];
+        double n = 0, sx = 0, sy = 0, sxx = 0, sxy = 0;
+        for (size_t i = 0; i < history_count_; i++) {
+            double x = (double)(int64_t)(history_[i].host_us - base.host_us);
+            double y = (double)(history_[i].offset_us - base.offset_us);
+            n += 1;
+            sx += x;
+            sy += y;
+            sxx += x * x;
+            sxy += x * y;
+        }
+        double denom = n * sxx - sx * sx;
+        if (denom > 0) {
+            drift_ = (n * sxy - sx * sy) / denom;
+        }
+    }
+
+    Sample samples_[WINDOW] = {};
+    size_t next_ = 0;
+    size_t count_ = 0;
+    Point history_[HISTORY] = {};
+    size_t history_next_ = 0;
+    size_t history_count_ = 0;
+    bool valid_ = false;
+    uint64_t ref_host_us_ = 0;
+    int64_t ref_offset_us_ = 0;
+    double drift_ = 0;
+    int64_t best_rtt_us_ = 0;
+};
+
+} // namespace servo2040_host
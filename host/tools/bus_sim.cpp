@@ -0,0 +1,197 @@
+// servo2040_bus_sim: check the RS-485 bus schedule against several simulated boards
+//
+//   servo2040_bus_sim [options]
+//
+//   --nodes N      boards on the bus (default 4, max 15)
+//   --baud N       line rate (default 3000000)
+//   --cycles N     bus cycles to run (default 1000)
+//   --jitter US    extra delay, up to US, before a board sees each cycle's frames,
+//                  on top of its main loop period (default 0)
+//   --seed N       seed for the jitter and the boards' clock offsets (default 1)
+//
+// Every board runs the firmware core on its own clock, offset at random so
+// their main loops poll out of step. The host's bytes reach each board once
+// their last bit is on the line, and the boards' replies go on the line when
+// the core asks. Checks, cycle after cycle, that:
+//   - talkers are never closer than BUS_TURNAROUND_US (no collisions)
+//   - every node answers once, inside the cycle, with the targets it just committed
+//   - every node commits within BUS_JITTER_US of the frame's last byte, as the
+//     schedule assumes, so the nodes commit no further apart than that
+// and reports the cycle rate, the closest gap between talkers and how far
+// apart the nodes committed. Exits with status 1 if a check fails.
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "bus.hpp"
+#include "sim_board.hpp"
+
+using namespace servo2040_host;
+using namespace protocol;
+
+namespace {
+
+int usage() {
+    std::fprintf(stderr, "usage: servo2040_bus_sim [--nodes N] [--baud N] [--cycles N] [--jitter US] [--seed N]\n");
+    return 2;
+}
+
+// First cycle starts once every board is up and polling
+const uint64_t START_US = 10000;
+
+// Someone driving the line: 0 is the host, otherwise a node
+struct Talk {
+    uint64_t start_ns;
+    uint64_t end_ns;
+    unsigned talker;
+};
+
+uint64_t bytes_ns(uint64_t bytes, unsigned baud) {
+    return bytes * 10 * 1000000000ull / baud;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    unsigned nodes = 4;
+    unsigned baud = UART_DEFAULT_BAUD;
+    unsigned cycles = 1000;
+    unsigned jitter_us = 0;
+    unsigned seed = 1;
+    for (int i = 1; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+        if (std::strcmp(argv[i], "--nodes") == 0 && has_value) {
+            nodes = (unsigned)std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--baud") == 0 && has_value) {
+            baud = (unsigned)std::strtoul(argv[++i], nullptr, 10);
+        } else if (std::strcmp(argv[i], "--cycles") == 0 && has_value) {
+            cycles = (unsigned)std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--jitter") == 0 && has_value) {
+            jitter_us = (unsigned)std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--seed") == 0 && has_value) {
+            seed = (unsigned)std::atoi(argv[++i]);
+        } else {
+            return usage();
+        }
+    }
+    if (nodes == 0 || nodes > BUS_MAX_NODES || baud == 0 || cycles == 0) {
+        return usage();
+    }
+
+    BusSchedule schedule = bus_schedule(nodes, baud);
+    std::mt19937 rng(seed);
+
+    std::vector<std::unique_ptr<SimBoard>> boards;
+    std::vector<uint64_t> offsets;
+    for (unsigned n = 1; n <= nodes; n++) {
+        offsets.push_back(std::uniform_int_distribution<uint64_t>(0, 9999)(rng));
+        boards.emplace_back(new SimBoard(offsets.back()));
+        SimBoard& board = *boards.back();
+        board.set_loop_us(BUS_POLL_US);
+        board.hal().frame_timeout_us = UART_IDLE_US;
+        board.core().setBusNode(n);
+    }
+
+    std::vector<Talk> talks;
+    uint64_t missing = 0;
+    uint64_t wrong = 0;
+    uint64_t max_reaction_us = 0;
+    uint64_t max_spread_us = 0;
+    std::vector<uint8_t> downlink;
+    std::vector<uint8_t> console;
+    int16_t positions[BUS_MAX_NODES][NUM_CHANNELS];
+
+    for (unsigned c = 0; c < cycles; c++) {
+        uint64_t start_us = START_US + (uint64_t)c * schedule.cycle_us;
+        for (unsigned n = 0; n < nodes; n++) {
+            for (unsigned s = 0; s < NUM_CHANNELS; s++) {
+                positions[n][s] = (int16_t)((c * 7 + n * 13 + s * 3) % 241) - 120;
+            }
+        }
+        downlink.clear();
+        encode_bus_cycle(schedule, positions, downlink);
+        uint64_t commit_ns = start_us * 1000 + bytes_ns(downlink.size(), baud);
+        talks.push_back({start_us * 1000, commit_ns, 0});
+
+        uint64_t first_commit = UINT64_MAX;
+        uint64_t last_commit = 0;
+        for (unsigned n = 0; n < nodes; n++) {
+            SimBoard& board = *boards[n];
+            uint64_t delay_us = jitter_us ? std::uniform_int_distribution<uint64_t>(0, jitter_us)(rng) : 0;
+            for (size_t j = 0; j < downlink.size(); j++) {
+                uint64_t arrival_us = (start_us * 1000 + bytes_ns(j + 1, baud) + 999) / 1000 + delay_us;
+                board.advance_to(arrival_us + offsets[n]);
+                board.receive(&downlink[j], 1);
+            }
+            board.advance_to(start_us + schedule.cycle_us + offsets[n]);
+            console.clear();
+            board.take_output(console);
+
+            unsigned answers = 0;
+            for (const SimHal::BusTransmission& sent : board.hal().bus_output) {
+                uint64_t sent_ns = (sent.at_us - offsets[n]) * 1000;
+                talks.push_back({sent_ns, sent_ns + bytes_ns(sent.data.size(), baud), n + 1});
+                FrameParser parser;
+                parser.feed(sent.data.data(), sent.data.size(), [&](const Frame& frame) {
+                    uint8_t node;
+                    uint8_t type;
+                    const uint8_t* payload;
+                    size_t length;
+                    if (!decode_bus_reply(frame, node, type, payload, length) || node != n + 1 ||
+                        type != FRAME_TELEMETRY || length != TELEMETRY_LENGTH) {
+                        wrong++;
+                        return;
+                    }
+                    answers++;
+                    for (unsigned s = 0; s < NUM_CHANNELS; s++) {
+                        if ((int16_t)get_u16(payload + TELEMETRY_POSITIONS + 2 * s) != positions[n][s]) {
+                            wrong++;
+                            break;
+                        }
+                    }
+                    uint64_t commit_us = get_u64(payload + TELEMETRY_TIME) - offsets[n];
+                    max_reaction_us = std::max(max_reaction_us, commit_us - commit_ns / 1000);
+                    first_commit = std::min(first_commit, commit_us);
+                    last_commit = std::max(last_commit, commit_us);
+                });
+            }
+            board.hal().bus_output.clear();
+            if (answers != 1) {
+                missing++;
+            }
+        }
+        if (last_commit >= first_commit) {
+            max_spread_us = std::max(max_spread_us, last_commit - first_commit);
+        }
+    }
+
+    // Everyone who talked, in order. The line is busy until the latest end so far.
+    std::sort(talks.begin(), talks.end(), [](const Talk& a, const Talk& b) { return a.start_ns < b.start_ns; });
+    int64_t closest_ns = INT64_MAX;
+    uint64_t collisions = 0;
+    uint64_t busy_until = talks[0].end_ns;
+    for (size_t i = 1; i < talks.size(); i++) {
+        int64_t gap_ns = (int64_t)talks[i].start_ns - (int64_t)busy_until;
+        closest_ns = std::min(closest_ns, gap_ns);
+        if (gap_ns < (int64_t)BUS_TURNAROUND_US * 1000) {
+            collisions++;
+        }
+        busy_until = std::max(busy_until, talks[i].end_ns);
+    }
+
+    std::printf("%u nodes at %u baud: slot %u µs, cycle %u µs (%.0f Hz), %u cycles\n", nodes, baud,
+                schedule.slot_us, schedule.cycle_us, 1e6 / schedule.cycle_us, cycles);
+    std::printf("Closest talkers: %.1f µs apart (need %u)\n", closest_ns / 1000.0, BUS_TURNAROUND_US);
+    bool timing_ok = max_reaction_us <= BUS_JITTER_US && max_spread_us <= BUS_JITTER_US;
+    std::printf("Commit: acted on within %llu µs, nodes up to %llu µs apart (budget %u)%s\n",
+                (unsigned long long)max_reaction_us, (unsigned long long)max_spread_us, BUS_JITTER_US,
+                timing_ok ? "" : ": over budget");
+    std::printf("Collisions: %llu, missing replies: %llu, wrong replies: %llu\n", (unsigned long long)collisions,
+                (unsigned long long)missing, (unsigned long long)wrong);
+    return !timing_ok || collisions > 0 || missing > 0 || wrong > 0 ? 1 : 0;
+}
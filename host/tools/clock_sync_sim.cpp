@@ -0,0 +1,248 @@
+// servo2040_clock_sync_sim: check host/device time sync converges under USB jitter
+//
+//   servo2040_clock_sync_sim [options]
+//
+//   --seconds N          session length (default 120)
+//   --interval-ms N      time between exchanges (default 20)
+//   --offset-us N        device clock minus host clock at the start (default 5000000)
+//   --drift-ppm X        device clock rate error (default 30)
+//   --delay-us N         one-way USB delay, each direction (default 150)
+//   --jitter-us N        extra one-way delay, up to N, on some messages (default 1000)
+//   --max-offset-error N allowed offset error once converged, µs (default 50)
+//   --max-drift-error X  allowed drift error once converged, ppm (default 1)
+//   --loop-us N          device main loop period (default 10)
+//   --seed N             seed for the delays (default 1)
+//
+// Runs the firmware core (SimBoard) on a clock with a known offset and drift
+// from the host's, and a ClockSync (time_sync.hpp) doing TIME_REQUEST /
+// TIME_REPLY exchanges with it, as Hand does. Each message takes the base
+// delay, plus, one time in three, a random extra delay up to the jitter, in
+// each direction independently. Once per second a SCHEDULE_HOST frame stamped
+// in host time checks the estimate the device was sent. Over the second half
+// of the session, checks that:
+//   - the host's offset estimate is within --max-offset-error of the truth
+//   - its drift estimate is within --max-drift-error
+//   - host-stamped frames are applied within --max-offset-error of their time
+// and reports when the estimate first stayed in bounds. Exits with status 1
+// if a check fails.
+//
+// A request waiting for the device's main loop to wake is one-way delay the
+// exchange can't see, and with the board's 1 ms sleep it has the same phase
+// every time, so no filtering removes it. The loop runs every 10 µs by default
+// to test the estimator itself; --loop-us 1000 shows that bias.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "frame_parser.hpp"
+#include "sim_board.hpp"
+#include "time_sync.hpp"
+
+using namespace servo2040_host;
+using namespace protocol;
+
+namespace {
+
+int usage() {
+    std::fprintf(stderr, "usage: servo2040_clock_sync_sim [--seconds N] [--interval-ms N] [--offset-us N] "
+                         "[--drift-ppm X] [--delay-us N] [--jitter-us N] [--max-offset-error N] "
+                         "[--max-drift-error X] [--loop-us N] [--seed N]\n");
+    return 2;
+}
+
+// Host time starts here, so host and device times are never near zero
+const uint64_t HOST_START_US = 1000000;
+
+// The device's clock as a function of the host's
+struct TrueClock {
+    int64_t offset_us;      // At HOST_START_US
+    double drift;           // Device µs per host µs, minus one
+
+    uint64_t device(uint64_t host_us) const {
+        double since = (double)(host_us - HOST_START_US);
+        return (uint64_t)((int64_t)host_us + offset_us + (int64_t)std::llround(since * drift));
+    }
+
+    uint64_t host(uint64_t device_us) const {
+        double since = ((double)device_us - (double)(HOST_START_US + offset_us)) / (1 + drift);
+        return HOST_START_US + (uint64_t)std::llround(since);
+    }
+
+    int64_t offset_at(uint64_t host_us) const { return (int64_t)(device(host_us) - host_us); }
+};
+
+std::vector<uint8_t> frame(uint8_t type, const uint8_t* payload, uint8_t length) {
+    std::vector<uint8_t> out = {FRAME_SYNC, type, length};
+    out.insert(out.end(), payload, payload + length);
+    return out;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    unsigned seconds = 120;
+    unsigned interval_ms = 20;
+    int64_t offset_us = 5000000;
+    double drift_ppm = 30;
+    unsigned delay_us = 150;
+    unsigned jitter_us = 1000;
+    double max_offset_error_us = 50;
+    double max_drift_error_ppm = 1;
+    unsigned loop_us = 10;
+    unsigned seed = 1;
+    for (int i = 1; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+        if (std::strcmp(argv[i], "--seconds") == 0 && has_value) {
+            seconds = (unsigned)std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--interval-ms") == 0 && has_value) {
+            interval_ms = (unsigned)std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--offset-us") == 0 && has_value) {
+            offset_us = std::atoll(argv[++i]);
+        } else if (std::strcmp(argv[i], "--drift-ppm") == 0 && has_value) {
+            drift_ppm = std::atof(argv[++i]);
+        } else if (std::strcmp(argv[i], "--delay-us") == 0 && has_value) {
+            delay_us = (unsigned)std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--jitter-us") == 0 && has_value) {
+            jitter_us = (unsigned)std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--max-offset-error") == 0 && has_value) {
+            max_offset_error_us = std::atof(argv[++i]);
+        } else if (std::strcmp(argv[i], "--max-drift-error") == 0 && has_value) {
+            max_drift_error_ppm = std::atof(argv[++i]);
+        } else if (std::strcmp(argv[i], "--loop-us") == 0 && has_value) {
+            loop_us = (unsigned)std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--seed") == 0 && has_value) {
+            seed = (unsigned)std::atoi(argv[++i]);
+        } else {
+            return usage();
+        }
+    }
+    // An exchange and a scheduled frame must both fit in one interval
+    if (seconds < 2 || loop_us == 0 || interval_ms * 1000 < 4 * (delay_us + jitter_us) + 4 * loop_us ||
+        offset_us < -(int64_t)HOST_START_US) {
+        return usage();
+    }
+
+    TrueClock truth = {offset_us, drift_ppm * 1e-6};
+    std::mt19937 rng(seed);
+    std::bernoulli_distribution delayed(1.0 / 3);
+    auto one_way_us = [&]() {
+        uint64_t extra = jitter_us && delayed(rng) ? std::uniform_int_distribution<uint64_t>(0, jitter_us)(rng) : 0;
+        return delay_us + extra;
+    };
+
+    SimBoard board(truth.device(HOST_START_US));
+    board.set_loop_us(loop_us);
+    uint64_t changed_device_us = 0;
+    board.hal().on_pulse = [&](unsigned, float) {
+        if (changed_device_us == 0) {
+            changed_device_us = board.now();
+        }
+    };
+    ClockSync clock;
+    FrameParser parser;
+    std::vector<uint8_t> output;
+
+    uint64_t end_us = HOST_START_US + (uint64_t)seconds * 1000000;
+    uint64_t check_from_us = HOST_START_US + (end_us - HOST_START_US) / 2;
+    uint64_t interval_us = (uint64_t)interval_ms * 1000;
+    uint64_t converged_us = 0;     // Host time the estimate last came into bounds
+    double worst_offset_us = 0;
+    double worst_drift_ppm = 0;
+    double worst_schedule_us = 0;
+    uint64_t exchanges = 0;
+    uint64_t lost = 0;
+    uint64_t scheduled = 0;
+    int16_t schedule_position = 10;
+
+    for (uint64_t h = HOST_START_US; h < end_us; h += interval_us) {
+        // TIME_REQUEST, carrying the current estimate as Hand sends it
+        uint8_t request[TIME_REQUEST_LENGTH] = {};
+        put_u64(request, h);
+        if (clock.valid()) {
+            put_u64(request + 8, (uint64_t)clock.offset_at(h));
+            put_u32(request + 16, (uint32_t)clock.drift_ppb());
+            request[20] = TIME_ESTIMATE_VALID;
+        }
+        std::vector<uint8_t> out = frame(FRAME_TIME_REQUEST, request, sizeof(request));
+        uint64_t arrival_us = h + one_way_us();
+        board.advance_to(truth.device(arrival_us));
+        board.receive(out.data(), out.size());
+        board.advance_to(truth.device(arrival_us) + 2 * loop_us);
+
+        // The reply leaves at the device's t2 and takes its own delay back
+        bool answered = false;
+        output.clear();
+        board.take_output(output);
+        parser.feed(output.data(), output.size(), [&](const Frame& reply) {
+            if (!reply.binary || reply.type != FRAME_TIME_REPLY || reply.length != TIME_REPLY_LENGTH) {
+                return;
+            }
+            uint64_t t2 = get_u64(reply.data + 16);
+            uint64_t t3 = truth.host(t2) + one_way_us();
+            clock.add_sample(get_u64(reply.data), get_u64(reply.data + 8), t2, t3);
+            answered = true;
+
+            double offset_error = std::fabs((double)(clock.offset_at(t3) - truth.offset_at(t3)));
+            double drift_error = std::fabs(clock.drift_ppb() / 1000.0 - drift_ppm);
+            bool in_bounds = offset_error <= max_offset_error_us && drift_error <= max_drift_error_ppm;
+            if (!in_bounds) {
+                converged_us = 0;
+            } else if (converged_us == 0) {
+                converged_us = t3;
+            }
+            if (t3 >= check_from_us) {
+                worst_offset_us = std::max(worst_offset_us, offset_error);
+                worst_drift_ppm = std::max(worst_drift_ppm, drift_error);
+            }
+        });
+        exchanges++;
+        if (!answered) {
+            lost++;
+        }
+
+        // Once a second, a frame stamped for a host time later in this interval
+        if ((h - HOST_START_US) % 1000000 < interval_us && clock.valid() && h >= check_from_us) {
+            uint8_t payload[8 + 4 + 2];
+            uint64_t due_us = h + interval_us / 2 + jitter_us + delay_us;
+            schedule_position = (int16_t)-schedule_position;
+            put_u64(payload, due_us);
+            put_u32(payload + 8, 1);
+            put_u16(payload + 12, (uint16_t)schedule_position);
+            out = frame(FRAME_SCHEDULE_HOST, payload, sizeof(payload));
+            changed_device_us = 0;
+            uint64_t sent_us = std::max(h + 2 * (delay_us + jitter_us), truth.host(board.now()));
+            board.advance_to(truth.device(sent_us + one_way_us()));
+            board.receive(out.data(), out.size());
+            board.advance_to(truth.device(h + interval_us - 1));
+            if (changed_device_us != 0) {
+                double error = std::fabs((double)truth.host(changed_device_us) - (double)due_us);
+                worst_schedule_us = std::max(worst_schedule_us, error);
+                scheduled++;
+            }
+        }
+    }
+
+    bool offset_ok = worst_offset_us <= max_offset_error_us;
+    bool drift_ok = worst_drift_ppm <= max_drift_error_ppm;
+    bool schedule_ok = scheduled > 0 && worst_schedule_us <= max_offset_error_us;
+    std::printf("%u s, exchange every %u ms, offset %lld µs, drift %.1f ppm, delay %u µs + up to %u µs\n", seconds,
+                interval_ms, (long long)offset_us, drift_ppm, delay_us, jitter_us);
+    if (converged_us) {
+        std::printf("Converged after %.1f s\n", (converged_us - HOST_START_US) / 1e6);
+    } else {
+        std::printf("Never converged\n");
+    }
+    std::printf("%s  offset error %.1f µs at most (allowed %.0f)\n", offset_ok ? "ok  " : "FAIL", worst_offset_us,
+                max_offset_error_us);
+    std::printf("%s  drift error %.3f ppm at most (allowed %.3f)\n", drift_ok ? "ok  " : "FAIL", worst_drift_ppm,
+                max_drift_error_ppm);
+    std::printf("%s  %llu host-stamped frames applied within %.1f µs of their time\n", schedule_ok ? "ok  " : "FAIL",
+                (unsigned long long)scheduled, worst_schedule_us);
+    std::printf("%llu exchanges, %llu unanswered\n", (unsigned long long)exchanges, (unsigned long long)lost);
+    return offset_ok && drift_ok && schedule_ok && lost == 0 && converged_us != 0 ? 0 : 1;
+}
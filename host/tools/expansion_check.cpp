@@ -0,0 +1,244 @@
+// servo2040_expansion_check: check PCA9685 expansion updates against mock boards
+//
+//   servo2040_expansion_check [options]
+//
+//   --channels N   expansion channels (default: this build's, or 14 if it has none)
+//   --outputs N    outputs used on each board (default 16)
+//   --i2c N        bus rate (default 1000000)
+//   --ticks N      control ticks to run (default 1000)
+//   --moving N     channels that move each tick (default all)
+//   --seed N       seed for the pulses (default 1)
+//
+// Sets up mock PCA9685s (mock_i2c.hpp) the way the firmware does, then sends
+// each tick's pulses through Pca9685Chain onto a mock I²C bus. Checks that:
+//   - every board ends up awake, at the servo prescale, with auto-increment
+//   - a tick is at most one write per board
+//   - every output's pulse is the one staged, to within half a count
+// and reports the bytes and bus time per tick: the time from the control tick
+// to the last board having its values. Each PCA9685 then starts them at its
+// next PWM period.
+//
+// In a build with SERVO2040_EXPANSION_CHANNELS it also runs the firmware core
+// (SimBoard) and checks that commands to the expansion channels come out of
+// the mocks as the pulses the core computed. Exits with status 1 if a check fails.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "mock_i2c.hpp"
+#include "pca9685.hpp"
+#include "sim_board.hpp"
+
+using namespace servo2040_host;
+using namespace protocol;
+
+namespace {
+
+int usage() {
+    std::fprintf(stderr, "usage: servo2040_expansion_check [--channels N] [--outputs N] [--i2c N] [--ticks N] "
+                         "[--moving N] [--seed N]\n");
+    return 2;
+}
+
+int failures = 0;
+
+void check(bool ok, const char* what) {
+    std::printf("%s  %s\n", ok ? "ok  " : "FAIL", what);
+    if (!ok) {
+        failures++;
+    }
+}
+
+// Mock boards on a mock bus, set up as the firmware does at boot
+struct Expansion {
+    Expansion(unsigned channels, unsigned outputs, unsigned i2c_baud) : bus(i2c_baud) {
+        chain.begin(channels, outputs);
+        boards.resize(chain.boards());
+        Pca9685Setting settings[PCA9685_SETUP_WRITES];
+        pca9685Setup(chain.prescale(), settings);
+        for (unsigned b = 0; b < chain.boards(); b++) {
+            bus.attach(chain.address(b), boards[b]);
+            for (const Pca9685Setting& setting : settings) {
+                uint8_t data[2] = {setting.reg, setting.value};
+                bus.write(chain.address(b), data, sizeof(data));
+            }
+        }
+        outputs_per_board = outputs;
+    }
+
+    // Everything the chain has staged, onto the bus. Returns the number of writes.
+    unsigned flush(std::vector<unsigned>& per_board) {
+        uint8_t address;
+        const uint8_t* data;
+        unsigned length;
+        unsigned writes = 0;
+        while (chain.takeBurst(address, data, length)) {
+            bus.write(address, data, length);
+            per_board[address - PCA9685_BASE_ADDRESS]++;
+            writes++;
+        }
+        return writes;
+    }
+
+    float pulse_us(unsigned channel) const {
+        return boards[channel / outputs_per_board].pulse_us(channel % outputs_per_board);
+    }
+
+    Pca9685Chain chain;
+    std::vector<MockPca9685> boards;
+    MockI2cBus bus;
+    unsigned outputs_per_board;
+};
+
+// Half a count, and a little for float rounding
+float tolerance_us(const Pca9685Chain& chain) {
+    return pca9685PulseUs(1, chain.prescale()) / 2 + 0.01f;
+}
+
+void check_setup(const Expansion& expansion) {
+    bool ok = true;
+    for (const MockPca9685& board : expansion.boards) {
+        ok = ok && !board.asleep() && board.auto_increment() && board.ignored() == 0 &&
+             board.reg(PCA9685_PRE_SCALE) == expansion.chain.prescale() &&
+             (board.reg(PCA9685_MODE2) & PCA9685_MODE2_OUTDRV);
+    }
+    check(ok, "boards awake at the servo prescale, auto-increment on");
+    std::printf("      %u boards, prescale %u: %.1f µs period, %.2f µs per count\n", expansion.chain.boards(),
+                expansion.chain.prescale(), expansion.boards[0].period_us(),
+                pca9685PulseUs(1, expansion.chain.prescale()));
+}
+
+// Random pulses on the chain alone
+void check_ticks(Expansion& expansion, unsigned ticks, unsigned moving, unsigned seed) {
+    Pca9685Chain& chain = expansion.chain;
+    unsigned channels = chain.channels();
+    std::mt19937 rng(seed);
+    std::uniform_int_distribution<int> pulse(1000 << PULSE_FRAC_BITS, 2000 << PULSE_FRAC_BITS);
+    std::vector<uint16_t> pulses(channels, PULSE_CENTRE_Q4);
+    std::vector<unsigned> order(channels);
+    for (unsigned c = 0; c < channels; c++) {
+        order[c] = c;
+    }
+    // Everything centred to start with, as the core does at boot
+    std::vector<unsigned> per_board(chain.boards());
+    chain.stage(pulses.data(), 0xFFFFFFFFu >> (32 - channels));
+    expansion.flush(per_board);
+
+    float tolerance = tolerance_us(chain);
+    float worst_us = 0;
+    bool one_write_each = true;
+    double total_us = 0;
+    double max_us = 0;
+    uint64_t max_bytes = 0;
+    for (unsigned t = 0; t < ticks; t++) {
+        std::shuffle(order.begin(), order.end(), rng);
+        uint32_t mask = 0;
+        for (unsigned i = 0; i < std::min(moving, channels); i++) {
+            pulses[order[i]] = (uint16_t)pulse(rng);
+            mask |= 1u << order[i];
+        }
+        double busy_before = expansion.bus.busy_us();
+        uint64_t bytes_before = expansion.bus.bytes();
+        chain.stage(pulses.data(), mask);
+        std::fill(per_board.begin(), per_board.end(), 0);
+        expansion.flush(per_board);
+        for (unsigned writes : per_board) {
+            one_write_each = one_write_each && writes <= 1;
+        }
+
+        double tick_us = expansion.bus.busy_us() - busy_before;
+        total_us += tick_us;
+        max_us = std::max(max_us, tick_us);
+        max_bytes = std::max(max_bytes, expansion.bus.bytes() - bytes_before);
+        for (unsigned c = 0; c < channels; c++) {
+            worst_us = std::max(worst_us, std::fabs(expansion.pulse_us(c) - pulses[c] / 16.0f));
+        }
+    }
+    check(one_write_each, "at most one write per board per tick");
+    check(worst_us <= tolerance, "outputs match the staged pulses");
+    std::printf("      worst error %.2f µs (allowed %.2f)\n", worst_us, tolerance);
+    std::printf("      %u ticks, %u of %u channels moving: bus time mean %.0f µs, max %.0f µs (%llu bytes)\n",
+                ticks, std::min(moving, channels), channels, total_us / ticks, max_us,
+                (unsigned long long)max_bytes);
+}
+
+// The firmware core driving the expansion channels, staged as BoardHal does
+void check_core(unsigned ticks, unsigned i2c_baud, unsigned seed) {
+    Expansion expansion(NUM_EXPANSION_CHANNELS, NUM_EXPANSION_CHANNELS < PCA9685_OUTPUTS ?
+                                                    NUM_EXPANSION_CHANNELS : PCA9685_OUTPUTS, i2c_baud);
+    SimBoard board;
+    std::mt19937 rng(seed);
+    std::uniform_int_distribution<int> angle(MIN_ANGLE, MAX_ANGLE);
+    std::vector<unsigned> per_board(expansion.chain.boards());
+    float tolerance = tolerance_us(expansion.chain);
+    float worst_us = 0;
+    uint64_t now_us = 10000;
+    for (unsigned t = 0; t < ticks; t++) {
+        std::string line;
+        for (unsigned c = NUM_BOARD_CHANNELS; c < NUM_CHANNELS; c++) {
+            line += (line.empty() ? "" : ";") + std::to_string(c) + "," + std::to_string(angle(rng));
+        }
+        line += "\n";
+        board.receive((const uint8_t*)line.data(), line.size());
+        now_us += 2000;
+        board.advance_to(now_us);
+
+        expansion.chain.stage(board.hal().pulses + NUM_BOARD_CHANNELS, ALL_CHANNELS >> NUM_BOARD_CHANNELS);
+        expansion.flush(per_board);
+        for (unsigned c = 0; c < NUM_EXPANSION_CHANNELS; c++) {
+            worst_us = std::max(worst_us, std::fabs(expansion.pulse_us(c) - board.pulse(NUM_BOARD_CHANNELS + c)));
+        }
+    }
+    std::vector<uint8_t> output;
+    board.take_output(output);
+    check(worst_us <= tolerance, "core commands to expansion channels reach the boards");
+    std::printf("      channels %u-%u, worst error %.2f µs\n", NUM_BOARD_CHANNELS, NUM_CHANNELS - 1, worst_us);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    unsigned channels = NUM_EXPANSION_CHANNELS ? NUM_EXPANSION_CHANNELS : 14;
+    unsigned outputs = PCA9685_OUTPUTS;
+    unsigned i2c_baud = 1000000;
+    unsigned ticks = 1000;
+    unsigned moving = 32;
+    unsigned seed = 1;
+    for (int i = 1; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+        if (std::strcmp(argv[i], "--channels") == 0 && has_value) {
+            channels = (unsigned)std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--outputs") == 0 && has_value) {
+            outputs = (unsigned)std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--i2c") == 0 && has_value) {
+            i2c_baud = (unsigned)std::strtoul(argv[++i], nullptr, 10);
+        } else if (std::strcmp(argv[i], "--ticks") == 0 && has_value) {
+            ticks = (unsigned)std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--moving") == 0 && has_value) {
+            moving = (unsigned)std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--seed") == 0 && has_value) {
+            seed = (unsigned)std::atoi(argv[++i]);
+        } else {
+            return usage();
+        }
+    }
+    if (channels == 0 || channels + NUM_BOARD_CHANNELS > 32 || outputs == 0 || outputs > PCA9685_OUTPUTS ||
+        (channels + outputs - 1) / outputs > Pca9685Chain::MAX_BOARDS || i2c_baud == 0 || ticks == 0) {
+        return usage();
+    }
+
+    Expansion expansion(channels, outputs, i2c_baud);
+    std::printf("%u expansion channels, %u per board, I²C at %u Hz\n", channels, outputs, i2c_baud);
+    check_setup(expansion);
+    check_ticks(expansion, ticks, moving, seed);
+    if (NUM_EXPANSION_CHANNELS > 0) {
+        check_core(ticks, i2c_baud, seed);
+    }
+    return failures > 0 ? 1 : 0;
+}
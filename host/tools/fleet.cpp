@@ -0,0 +1,241 @@
+// servo2040_fleet: run many recorded traces through the firmware core in parallel
+//
+//   servo2040_fleet [options] TRACE...
+//
+//   --threads N        worker threads (default: one per hardware thread)
+//   --repeat N         run every trace N times, e.g. to load a machine with hands
+//   --tau MS           servo time constant (default 30)
+//   --rate DPS         servo slew limit in °/s (default 400)
+//   --step US          servo model step (default 1000)
+//   --current-limit MA servo supply limit per board (default 5000)
+//   --kernel NAME      pulse kernel: scalar, sse4.1 or avx2
+//   --max-error DEG    fail a hand that lags its command by more than DEG
+//   --max-latency MS   fail a hand whose 99th percentile command latency is above MS
+//   --no-overcurrent   fail a hand that goes over the current limit
+//   --quiet            only print the fleet summary
+//
+// Every trace gets its own simulated board. Boards run on a work-stealing
+// pool, longest traces first, and the report aggregates command latency,
+// jitter and overcurrent over the whole fleet. Exits with status 1 if any
+// hand fails or a trace can't be read.
+
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <numeric>
+#include <string>
+#include <vector>
+
+#include "simulation.hpp"
+#include "work_pool.hpp"
+
+using namespace servo2040_host;
+
+namespace {
+
+struct Limits {
+    double max_error_deg = -1;
+    double max_latency_ms = -1;
+    bool no_overcurrent = false;
+};
+
+struct HandResult {
+    std::string path;
+    std::string error;                // Set if the trace couldn't be simulated
+    uint64_t duration_us = 0;
+    uint64_t writes = 0;
+    std::vector<uint32_t> latencies_us;  // Sorted
+    double max_error_deg = 0;
+    double peak_current_ma = 0;
+    double overcurrent_s = 0;
+    uint64_t overcurrent_events = 0;
+    bool ok = false;
+};
+
+int usage() {
+    std::fprintf(stderr,
+                 "usage: servo2040_fleet [--threads N] [--repeat N] [--tau MS] [--rate DPS] [--step US]\n"
+                 "                       [--current-limit MA] [--kernel scalar|sse4.1|avx2] [--max-error DEG]\n"
+                 "                       [--max-latency MS] [--no-overcurrent] [--quiet] TRACE...\n");
+    return 2;
+}
+
+// Nearest-rank percentile of sorted values, in ms
+double percentile_ms(const std::vector<uint32_t>& sorted, double p) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    size_t rank = (size_t)std::ceil(p / 100.0 * sorted.size());
+    return sorted[std::max<size_t>(rank, 1) - 1] / 1000.0;
+}
+
+double mean_ms(const std::vector<uint32_t>& values) {
+    if (values.empty()) {
+        return 0;
+    }
+    return std::accumulate(values.begin(), values.end(), 0.0) / values.size() / 1000.0;
+}
+
+// Standard deviation of the latency, which is what we call jitter
+double jitter_ms(const std::vector<uint32_t>& values) {
+    if (values.size() < 2) {
+        return 0;
+    }
+    double mean = mean_ms(values);
+    double sum = 0;
+    for (uint32_t v : values) {
+        double d = v / 1000.0 - mean;
+        sum += d * d;
+    }
+    return std::sqrt(sum / (values.size() - 1));
+}
+
+uint64_t file_size(const std::string& path) {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 ? (uint64_t)st.st_size : 0;
+}
+
+void run_hand(const SimOptions& options, const Limits& limits, HandResult& result) {
+    try {
+        Simulation sim(result.path, options);
+        sim.run();
+        const BoardStats& board = sim.board_stats();
+        result.duration_us = sim.duration_us();
+        result.writes = sim.writes();
+        result.latencies_us = board.latencies_us;
+        std::sort(result.latencies_us.begin(), result.latencies_us.end());
+        for (unsigned c = 0; c < NUM_SERVOS; c++) {
+            result.max_error_deg = std::max(result.max_error_deg, sim.channel(c).max_error_deg);
+        }
+        result.peak_current_ma = board.peak_current_ma;
+        result.overcurrent_s = board.overcurrent_s;
+        result.overcurrent_events = board.overcurrent_events;
+        result.ok = !(limits.max_error_deg >= 0 && result.max_error_deg > limits.max_error_deg) &&
+                    !(limits.max_latency_ms >= 0 && percentile_ms(result.latencies_us, 99) > limits.max_latency_ms) &&
+                    !(limits.no_overcurrent && result.overcurrent_events > 0);
+    } catch (const std::exception& e) {
+        result.error = e.what();
+    }
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    SimOptions options;
+    Limits limits;
+    std::vector<std::string> paths;
+    unsigned threads = 0;
+    unsigned repeat = 1;
+    bool quiet = false;
+    for (int i = 1; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+        if (std::strcmp(argv[i], "--threads") == 0 && has_value) {
+            threads = (unsigned)std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--repeat") == 0 && has_value) {
+            repeat = (unsigned)std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--tau") == 0 && has_value) {
+            options.servo.time_constant_ms = std::atof(argv[++i]);
+        } else if (std::strcmp(argv[i], "--rate") == 0 && has_value) {
+            options.servo.max_rate_dps = std::atof(argv[++i]);
+        } else if (std::strcmp(argv[i], "--step") == 0 && has_value) {
+            options.step_us = std::strtoull(argv[++i], nullptr, 10);
+        } else if (std::strcmp(argv[i], "--current-limit") == 0 && has_value) {
+            options.current_limit_ma = std::atof(argv[++i]);
+        } else if (std::strcmp(argv[i], "--kernel") == 0 && has_value) {
+            if (!selectPulseKernel(argv[++i])) {
+                std::fprintf(stderr, "servo2040_fleet: pulse kernel %s not available\n", argv[i]);
+                return 2;
+            }
+        } else if (std::strcmp(argv[i], "--max-error") == 0 && has_value) {
+            limits.max_error_deg = std::atof(argv[++i]);
+        } else if (std::strcmp(argv[i], "--max-latency") == 0 && has_value) {
+            limits.max_latency_ms = std::atof(argv[++i]);
+        } else if (std::strcmp(argv[i], "--no-overcurrent") == 0) {
+            limits.no_overcurrent = true;
+        } else if (std::strcmp(argv[i], "--quiet") == 0) {
+            quiet = true;
+        } else if (argv[i][0] != '-') {
+            paths.push_back(argv[i]);
+        } else {
+            return usage();
+        }
+    }
+    if (paths.empty() || repeat == 0 || options.step_us == 0) {
+        return usage();
+    }
+
+    std::vector<HandResult> results;
+    for (unsigned r = 0; r < repeat; r++) {
+        for (const auto& path : paths) {
+            results.emplace_back();
+            results.back().path = path;
+        }
+    }
+
+    // Longest first, so no core is left finishing a long trace on its own at the end
+    std::vector<size_t> order(results.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::vector<uint64_t> sizes(results.size());
+    for (size_t i = 0; i < results.size(); i++) {
+        sizes[i] = file_size(results[i].path);
+    }
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return sizes[a] > sizes[b]; });
+
+    auto wall_start = std::chrono::steady_clock::now();
+    WorkPool pool(threads);
+    for (size_t i : order) {
+        HandResult* result = &results[i];
+        pool.submit([&options, &limits, result] { run_hand(options, limits, *result); });
+    }
+    pool.wait();
+    double wall_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_start).count();
+
+    if (!quiet) {
+        std::printf("hand  sim s  writes  lat p50  lat p99  jitter  peak A  over s  max err  trace\n");
+    }
+    std::vector<uint32_t> latencies;
+    double sim_s = 0;
+    double peak_current_ma = 0;
+    double overcurrent_s = 0;
+    uint64_t overcurrent_events = 0;
+    unsigned overcurrent_hands = 0;
+    unsigned failed = 0;
+    for (size_t i = 0; i < results.size(); i++) {
+        const HandResult& r = results[i];
+        if (!r.error.empty()) {
+            std::printf("%4zu  %s: %s\n", i, r.path.c_str(), r.error.c_str());
+            failed++;
+            continue;
+        }
+        if (!quiet) {
+            std::printf("%4zu %6.1f %7llu %8.2f %8.2f %7.2f %7.2f %7.2f %8.1f  %s%s\n", i, r.duration_us / 1e6,
+                        (unsigned long long)r.writes, percentile_ms(r.latencies_us, 50),
+                        percentile_ms(r.latencies_us, 99), jitter_ms(r.latencies_us), r.peak_current_ma / 1000,
+                        r.overcurrent_s, r.max_error_deg, r.path.c_str(), r.ok ? "" : "  FAIL");
+        }
+        latencies.insert(latencies.end(), r.latencies_us.begin(), r.latencies_us.end());
+        sim_s += r.duration_us / 1e6;
+        peak_current_ma = std::max(peak_current_ma, r.peak_current_ma);
+        overcurrent_s += r.overcurrent_s;
+        overcurrent_events += r.overcurrent_events;
+        overcurrent_hands += r.overcurrent_events > 0;
+        failed += !r.ok;
+    }
+    std::sort(latencies.begin(), latencies.end());
+
+    std::printf("Fleet: %zu hands, %u failed, %.1f hand-s simulated in %.3f s on %u threads (%llu steals), %.0fx real time\n",
+                results.size(), failed, sim_s, wall_s, pool.size(), (unsigned long long)pool.steals(),
+                wall_s > 0 ? sim_s / wall_s : 0.0);
+    std::printf("Latency: %zu commands, mean %.2f ms, p50 %.2f, p99 %.2f, max %.2f, jitter %.2f ms\n",
+                latencies.size(), mean_ms(latencies), percentile_ms(latencies, 50), percentile_ms(latencies, 99),
+                percentile_ms(latencies, 100), jitter_ms(latencies));
+    std::printf("Current: peak %.2f A, over %.1f A on %u hands, %llu times, %.3f s in total\n",
+                peak_current_ma / 1000, options.current_limit_ma / 1000, overcurrent_hands,
+                (unsigned long long)overcurrent_events, overcurrent_s);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,114 @@
+// servo2040_logcat: show a board's console output with its deferred log records formatted
+//
+//   servo2040_logcat [--time] [--keep] STRINGS PORT
+//   servo2040_logcat [--time] --trace TRACE STRINGS
+//
+//   STRINGS      the firmware's log string table (servo2040_controller.logstr in
+//                the firmware build directory), from the build that is on the board
+//   PORT         the board's command or telemetry port, or "usb[:serial]"
+//   --trace      format the records in a recorded trace instead of a live board
+//   --time       prefix each record with its device time (µs, low 32 bits)
+//   --keep       don't switch the board to deferred debug output (V2) first
+//
+// Console lines are printed as they arrive. Runs until interrupted.
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <string>
+
+#include "frame_parser.hpp"
+#include "log_format.hpp"
+#include "trace.hpp"
+#include "transport.hpp"
+
+using namespace servo2040_host;
+using namespace protocol;
+
+namespace {
+
+int usage() {
+    std::fprintf(stderr,
+                 "usage: servo2040_logcat [--time] [--keep] STRINGS PORT\n"
+                 "       servo2040_logcat [--time] --trace TRACE STRINGS\n");
+    return 2;
+}
+
+void print_log(const LogStrings& strings, bool show_time, const uint8_t* payload, size_t length) {
+    decode_log_frame(strings, payload, length, [show_time](uint32_t time_us, const std::string& text) {
+        if (show_time) {
+            std::printf("[%10" PRIu32 "] %s\n", time_us, text.c_str());
+        } else {
+            std::printf("%s\n", text.c_str());
+        }
+    });
+}
+
+void print_frame(const LogStrings& strings, bool show_time, const Frame& frame) {
+    if (!frame.binary) {
+        std::printf("%s\n", (const char*)frame.data);
+    } else if (frame.type == FRAME_LOG) {
+        print_log(strings, show_time, frame.data, frame.length);
+    }
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    bool show_time = false;
+    bool keep = false;
+    std::string trace_path;
+    int arg = 1;
+    for (; arg < argc && argv[arg][0] == '-'; arg++) {
+        if (std::strcmp(argv[arg], "--time") == 0) {
+            show_time = true;
+        } else if (std::strcmp(argv[arg], "--keep") == 0) {
+            keep = true;
+        } else if (std::strcmp(argv[arg], "--trace") == 0 && arg + 1 < argc) {
+            trace_path = argv[++arg];
+        } else {
+            return usage();
+        }
+    }
+    if (argc - arg != (trace_path.empty() ? 2 : 1)) {
+        return usage();
+    }
+
+    try {
+        LogStrings strings(argv[arg]);
+        if (!trace_path.empty()) {
+            TraceReader trace(trace_path);
+            const TraceRecord* record;
+            const uint8_t* data;
+            while (trace.next(record, data)) {
+                if (record->direction != TRACE_RX) {
+                    continue;
+                }
+                if (record->kind == TRACE_LINE) {
+                    std::printf("%.*s\n", (int)record->length, (const char*)data);
+                } else if (record->kind == TRACE_FRAME && record->type == FRAME_LOG) {
+                    print_log(strings, show_time, data, record->length);
+                }
+            }
+            return 0;
+        }
+
+        std::unique_ptr<Transport> port = open_transport(argv[arg + 1]);
+        if (!keep) {
+            const char enable[] = "V2\n";
+            port->write_all((const uint8_t*)enable, std::strlen(enable));
+        }
+        FrameParser parser;
+        uint8_t buffer[512];
+        for (;;) {
+            size_t count = port->read_some(buffer, sizeof(buffer), 100000);
+            parser.feed(buffer, count, [&](const Frame& frame) { print_frame(strings, show_time, frame); });
+            std::fflush(stdout);
+        }
+    } catch (const std::exception& e) {
+        std::fprintf(stderr, "servo2040_logcat: %s\n", e.what());
+        return 1;
+    }
+}
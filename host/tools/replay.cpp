@@ -0,0 +1,237 @@
+// servo2040_replay: play a recorded trace into a board or the simulated core
+//
+//   servo2040_replay [--port DEV] [--speed N] [--quiet] TRACE
+//
+//   --port DEV   drive a real board on DEV, or "usb[:serial]" for its USB command
+//                interface (default: the simulated firmware core)
+//   --speed N    play N times faster than recorded (default 1). With the
+//                simulated core, 0 runs as fast as possible.
+//   --quiet      don't print the device's console output
+//
+// Host → device bytes are sent exactly as they were recorded, at their
+// recorded times. The device's telemetry is compared with the recorded
+// telemetry at the end.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "frame_parser.hpp"
+#include "hand.hpp"
+#include "transport.hpp"
+#include "sim_board.hpp"
+#include "trace.hpp"
+
+using namespace servo2040_host;
+using namespace protocol;
+
+namespace {
+
+struct ReplayResult {
+    uint64_t tx_records = 0;
+    uint64_t tx_bytes = 0;
+    uint64_t telemetry = 0;             // Telemetry frames received during the replay
+    bool have_positions = false;
+    int16_t positions[NUM_CHANNELS] = {};
+};
+
+// Replay output from the device: console lines to stdout, telemetry into result
+class OutputSink {
+public:
+    OutputSink(ReplayResult& result, bool quiet) : result_(result), quiet_(quiet) {}
+
+    void feed(const uint8_t* data, size_t length) {
+        parser_.feed(data, length, [this](const Frame& frame) {
+            if (!frame.binary) {
+                if (!quiet_) {
+                    std::printf("%s\n", (const char*)frame.data);
+                }
+            } else if (frame.type == FRAME_TELEMETRY && frame.length == TELEMETRY_LENGTH) {
+                result_.telemetry++;
+                result_.have_positions = true;
+                for (unsigned c = 0; c < NUM_CHANNELS; c++) {
+                    result_.positions[c] = (int16_t)get_u16(frame.data + TELEMETRY_POSITIONS + c * 2);
+                }
+            }
+        });
+    }
+
+private:
+    FrameParser parser_;
+    ReplayResult& result_;
+    bool quiet_;
+};
+
+// Wall clock pacing: wait until trace time t_us has come round at the given speed
+class Pacer {
+public:
+    explicit Pacer(double speed) : speed_(speed), start_(Hand::now_us()) {}
+
+    // Microseconds until trace time t_us is due (0 if it already is, or speed is 0)
+    int64_t wait_us(uint64_t t_us) const {
+        if (speed_ <= 0) {
+            return 0;
+        }
+        int64_t due = (int64_t)start_ + (int64_t)(t_us / speed_);
+        return std::max<int64_t>(due - (int64_t)Hand::now_us(), 0);
+    }
+
+private:
+    double speed_;
+    uint64_t start_;
+};
+
+void replay_sim(TraceReader& trace, double speed, OutputSink& sink, ReplayResult& result) {
+    // Run the simulated clock in step with the recorded device clock, so
+    // device timestamps in the trace (scheduled frames) still line up
+    SimBoard board(trace_device_start(trace));
+    uint64_t base = board.now();
+    Pacer pacer(speed);
+    std::vector<uint8_t> output;
+
+    const TraceRecord* record;
+    const uint8_t* data;
+    uint64_t end_us = 0;
+    while (trace.next(record, data)) {
+        end_us = record->time_us;
+        if (record->direction != TRACE_TX || record->kind != TRACE_BYTES) {
+            continue;
+        }
+        board.advance_to(base + record->time_us);
+        std::this_thread::sleep_for(std::chrono::microseconds(pacer.wait_us(record->time_us)));
+        board.receive(data, record->length);
+        result.tx_records++;
+        result.tx_bytes += record->length;
+
+        board.take_output(output);
+        sink.feed(output.data(), output.size());
+        output.clear();
+    }
+    board.advance_to(base + end_us + 100000);
+    board.take_output(output);
+    sink.feed(output.data(), output.size());
+}
+
+void replay_port(TraceReader& trace, const std::string& path, double speed, OutputSink& sink,
+                 ReplayResult& result) {
+    std::unique_ptr<Transport> port = open_transport(path);
+    Pacer pacer(speed);
+    uint8_t buffer[512];
+
+    auto read_for = [&](int64_t timeout_us) {
+        uint64_t until = Hand::now_us() + timeout_us;
+        do {
+            int64_t left = (int64_t)(until - Hand::now_us());
+            size_t count = port->read_some(buffer, sizeof(buffer), std::max<int64_t>(left, 0));
+            sink.feed(buffer, count);
+        } while (Hand::now_us() < until);
+    };
+
+    const TraceRecord* record;
+    const uint8_t* data;
+    while (trace.next(record, data)) {
+        if (record->direction != TRACE_TX || record->kind != TRACE_BYTES) {
+            continue;
+        }
+        int64_t wait = pacer.wait_us(record->time_us);
+        if (wait > 0) {
+            read_for(wait);
+        }
+        port->write_all(data, record->length);
+        result.tx_records++;
+        result.tx_bytes += record->length;
+    }
+    read_for(100000); // Collect the last telemetry
+}
+
+// Final telemetry positions in the trace
+bool recorded_positions(TraceReader& trace, int16_t* positions) {
+    const TraceRecord* record;
+    const uint8_t* data;
+    bool found = false;
+    while (trace.next(record, data)) {
+        if (record->direction == TRACE_RX && record->kind == TRACE_FRAME &&
+            record->type == FRAME_TELEMETRY && record->length == TELEMETRY_LENGTH) {
+            for (unsigned c = 0; c < NUM_CHANNELS; c++) {
+                positions[c] = (int16_t)get_u16(data + TELEMETRY_POSITIONS + c * 2);
+            }
+            found = true;
+        }
+    }
+    trace.rewind();
+    return found;
+}
+
+void print_positions(const char* label, const int16_t* positions) {
+    std::printf("%-9s", label);
+    for (unsigned c = 0; c < NUM_CHANNELS; c++) {
+        std::printf(" %4d", positions[c]);
+    }
+    std::printf("\n");
+}
+
+int usage() {
+    std::fprintf(stderr, "usage: servo2040_replay [--port DEV] [--speed N] [--quiet] TRACE\n");
+    return 2;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    std::string port;
+    std::string path;
+    double speed = 1.0;
+    bool quiet = false;
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--port") == 0 && i + 1 < argc) {
+            port = argv[++i];
+        } else if (std::strcmp(argv[i], "--speed") == 0 && i + 1 < argc) {
+            speed = std::atof(argv[++i]);
+        } else if (std::strcmp(argv[i], "--quiet") == 0) {
+            quiet = true;
+        } else if (argv[i][0] != '-' && path.empty()) {
+            path = argv[i];
+        } else {
+            return usage();
+        }
+    }
+    if (path.empty() || speed < 0 || (speed == 0 && !port.empty())) {
+        return usage();
+    }
+
+    try {
+        TraceReader trace(path);
+        ReplayResult result;
+        OutputSink sink(result, quiet);
+        int16_t recorded[NUM_CHANNELS];
+        bool have_recorded = recorded_positions(trace, recorded);
+
+        if (port.empty()) {
+            replay_sim(trace, speed, sink, result);
+        } else {
+            replay_port(trace, port, speed, sink, result);
+        }
+
+        std::printf("Replayed %llu writes (%llu bytes) to %s, %llu telemetry frames back\n",
+                    (unsigned long long)result.tx_records, (unsigned long long)result.tx_bytes,
+                    port.empty() ? "simulated core" : port.c_str(), (unsigned long long)result.telemetry);
+        if (have_recorded && result.have_positions) {
+            print_positions("Recorded", recorded);
+            print_positions("Replayed", result.positions);
+            if (std::memcmp(recorded, result.positions, sizeof(recorded)) != 0) {
+                std::printf("Final positions differ\n");
+                return 1;
+            }
+        }
+    } catch (const std::exception& e) {
+        std::fprintf(stderr, "servo2040_replay: %s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
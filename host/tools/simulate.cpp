@@ -0,0 +1,282 @@
+// servo2040_sim: run a recorded trace through the firmware core offline
+//
+//   servo2040_sim [options] TRACE
+//
+//   --tau MS           servo time constant (default 30)
+//   --rate DPS         servo slew limit in °/s (default 400)
+//   --step US          servo model step (default 1000)
+//   --current-limit MA servo supply limit for the board (default 5000)
+//   --pulses FILE      write every pulse width change as CSV: time_us,channel,pulse_us
+//   --positions FILE   write the modelled angles as CSV: time_us,ch0..ch17
+//   --sample MS        --positions sample period (default 10)
+//   --max-error DEG    exit with status 1 if any channel lags its command by more than DEG
+//   --console          print the device's console output
+//   --kernel NAME      pulse kernel: scalar, sse4.1 or avx2 (default: best the CPU has).
+//                      All give identical pulses, so their --pulses files can be diffed.
+//
+//   servo2040_sim --kernel-check
+//
+// Checks that claim instead of running a trace: every kernel this build and
+// CPU have is run against the scalar one for every int16 position, over a
+// spread of calibrations and interpolation fractions, and the tool exits
+// with status 1 if any result differs.
+//
+// The virtual clock runs as fast as the CPU allows, so hours of teleop take
+// seconds. Times in the CSV files are µs since the start of the trace.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "pulse_kernel.hpp"
+#include "simulation.hpp"
+
+using namespace servo2040_host;
+
+namespace {
+
+int usage() {
+    std::fprintf(stderr,
+                 "usage: servo2040_sim [--tau MS] [--rate DPS] [--step US] [--current-limit MA] [--pulses FILE]\n"
+                 "                     [--positions FILE] [--sample MS] [--max-error DEG] [--console]\n"
+                 "                     [--kernel scalar|sse4.1|avx2] TRACE\n"
+                 "       servo2040_sim --kernel-check\n");
+    return 2;
+}
+
+std::FILE* open_csv(const std::string& path) {
+    std::FILE* file = std::fopen(path.c_str(), "w");
+    if (file == nullptr) {
+        throw std::runtime_error("Can't create " + path);
+    }
+    return file;
+}
+
+// Not a multiple of any vector width, so every batch ends in the scalar tail
+const unsigned KERNEL_BATCH = 1021;
+
+// Position sweep for one kernel against the scalar one. Calibrations vary from
+// lane to lane, so a kernel that mixes lanes up shows too. Returns mismatches.
+uint64_t check_pulses(const char* name, uint64_t& compared) {
+    const int32_t scales[] = {0, 1, -1, pulseScaleForRange(100), pulseScaleForRange(500), PULSE_PER_DEGREE_Q16,
+                              -PULSE_PER_DEGREE_Q16, pulseScaleForRange(2000), 0x7FFFFFFF, INT32_MIN};
+    const uint16_t centres[] = {0, 1, 500 << PULSE_FRAC_BITS, PULSE_CENTRE_Q4, 2500 << PULSE_FRAC_BITS, 0xFFFF};
+    const unsigned num_scales = sizeof(scales) / sizeof(scales[0]);
+    const unsigned num_centres = sizeof(centres) / sizeof(centres[0]);
+    std::vector<int16_t> positions(KERNEL_BATCH);
+    std::vector<int32_t> scale(KERNEL_BATCH);
+    std::vector<uint16_t> centre(KERNEL_BATCH);
+    std::vector<uint16_t> expected(KERNEL_BATCH);
+    std::vector<uint16_t> pulses(KERNEL_BATCH);
+    uint64_t mismatches = 0;
+    for (unsigned k = 0; k < num_scales * num_centres; k++) {
+        for (int32_t first = INT16_MIN; first <= INT16_MAX; first += KERNEL_BATCH) {
+            unsigned count = (unsigned)std::min<int32_t>(KERNEL_BATCH, INT16_MAX - first + 1);
+            for (unsigned i = 0; i < count; i++) {
+                positions[i] = (int16_t)(first + (int32_t)i);
+                scale[i] = scales[(k + i) % num_scales];
+                centre[i] = centres[(k / num_scales + i) % num_centres];
+            }
+            selectPulseKernel("scalar");
+            computePulses(positions.data(), scale.data(), centre.data(), expected.data(), count);
+            selectPulseKernel(name);
+            computePulses(positions.data(), scale.data(), centre.data(), pulses.data(), count);
+            for (unsigned i = 0; i < count; i++) {
+                if (pulses[i] != expected[i] && mismatches++ == 0) {
+                    std::printf("      %s: position %d, scale %d, centre %u gave %u, scalar %u\n", name,
+                                positions[i], scale[i], centre[i], pulses[i], expected[i]);
+                }
+            }
+            compared += count;
+        }
+    }
+    return mismatches;
+}
+
+// Every start position against a spread of end positions and fractions
+uint64_t check_interpolation(const char* name, uint64_t& compared) {
+    const int16_t ends[] = {INT16_MIN, -4000, -90, -1, 0, 1, 90, 4000, INT16_MAX};
+    const int32_t fracs[] = {0, 1, 0x4000, 0x7FFF, 0x8000, 0x8001, 0xC000, 0xFFFF, 0x10000};
+    std::vector<int16_t> a(KERNEL_BATCH);
+    std::vector<int16_t> b(KERNEL_BATCH);
+    std::vector<int16_t> expected(KERNEL_BATCH);
+    std::vector<int16_t> out(KERNEL_BATCH);
+    uint64_t mismatches = 0;
+    for (int32_t frac : fracs) {
+        for (unsigned e = 0; e < sizeof(ends) / sizeof(ends[0]); e++) {
+            for (int32_t first = INT16_MIN; first <= INT16_MAX; first += KERNEL_BATCH) {
+                unsigned count = (unsigned)std::min<int32_t>(KERNEL_BATCH, INT16_MAX - first + 1);
+                for (unsigned i = 0; i < count; i++) {
+                    a[i] = (int16_t)(first + (int32_t)i);
+                    b[i] = ends[(e + i) % (sizeof(ends) / sizeof(ends[0]))];
+                }
+                selectPulseKernel("scalar");
+                interpolatePositions(a.data(), b.data(), frac, expected.data(), count);
+                selectPulseKernel(name);
+                interpolatePositions(a.data(), b.data(), frac, out.data(), count);
+                for (unsigned i = 0; i < count; i++) {
+                    if (out[i] != expected[i] && mismatches++ == 0) {
+                        std::printf("      %s: %d to %d at %d/65536 gave %d, scalar %d\n", name, a[i], b[i], frac,
+                                    out[i], expected[i]);
+                    }
+                }
+                compared += count;
+            }
+        }
+    }
+    return mismatches;
+}
+
+int kernel_check() {
+    std::string best = pulseKernelName();
+    bool ok = true;
+    unsigned checked = 0;
+    for (const char* name : {"sse4.1", "avx2"}) {
+        if (!selectPulseKernel(name)) {
+            std::printf("      %s: not available, skipped\n", name);
+            continue;
+        }
+        uint64_t pulses = 0;
+        uint64_t interpolations = 0;
+        uint64_t mismatches = check_pulses(name, pulses) + check_interpolation(name, interpolations);
+        std::printf("%s  %s matches scalar: %llu pulses, %llu interpolations, %llu mismatches\n",
+                    mismatches == 0 ? "ok  " : "FAIL", name, (unsigned long long)pulses,
+                    (unsigned long long)interpolations, (unsigned long long)mismatches);
+        ok = ok && mismatches == 0;
+        checked++;
+    }
+    selectPulseKernel(best.c_str());
+    if (checked == 0) {
+        std::printf("Only the scalar kernel is available, nothing to compare\n");
+    }
+    return ok ? 0 : 1;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    SimOptions options;
+    std::string path;
+    std::string pulses_path;
+    std::string positions_path;
+    uint64_t sample_us = 10000;
+    double max_error = -1;
+    bool console = false;
+    if (argc == 2 && std::strcmp(argv[1], "--kernel-check") == 0) {
+        return kernel_check();
+    }
+    for (int i = 1; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+        if (std::strcmp(argv[i], "--tau") == 0 && has_value) {
+            options.servo.time_constant_ms = std::atof(argv[++i]);
+        } else if (std::strcmp(argv[i], "--rate") == 0 && has_value) {
+            options.servo.max_rate_dps = std::atof(argv[++i]);
+        } else if (std::strcmp(argv[i], "--step") == 0 && has_value) {
+            options.step_us = std::strtoull(argv[++i], nullptr, 10);
+        } else if (std::strcmp(argv[i], "--current-limit") == 0 && has_value) {
+            options.current_limit_ma = std::atof(argv[++i]);
+        } else if (std::strcmp(argv[i], "--pulses") == 0 && has_value) {
+            pulses_path = argv[++i];
+        } else if (std::strcmp(argv[i], "--positions") == 0 && has_value) {
+            positions_path = argv[++i];
+        } else if (std::strcmp(argv[i], "--sample") == 0 && has_value) {
+            sample_us = (uint64_t)(std::atof(argv[++i]) * 1000);
+        } else if (std::strcmp(argv[i], "--max-error") == 0 && has_value) {
+            max_error = std::atof(argv[++i]);
+        } else if (std::strcmp(argv[i], "--console") == 0) {
+            console = true;
+        } else if (std::strcmp(argv[i], "--kernel") == 0 && has_value) {
+            if (!selectPulseKernel(argv[++i])) {
+                std::fprintf(stderr, "servo2040_sim: pulse kernel %s not available\n", argv[i]);
+                return 2;
+            }
+        } else if (argv[i][0] != '-' && path.empty()) {
+            path = argv[i];
+        } else {
+            return usage();
+        }
+    }
+    if (path.empty() || options.step_us == 0 || sample_us == 0) {
+        return usage();
+    }
+
+    std::FILE* pulses = nullptr;
+    std::FILE* positions = nullptr;
+    bool ok = true;
+    try {
+        Simulation sim(path, options);
+
+        if (!pulses_path.empty()) {
+            pulses = open_csv(pulses_path);
+            std::fprintf(pulses, "time_us,channel,pulse_us\n");
+            sim.on_pulse = [pulses](uint64_t time_us, unsigned channel, float pulse_us) {
+                std::fprintf(pulses, "%llu,%u,%.4f\n", (unsigned long long)time_us, channel, pulse_us);
+            };
+        }
+        if (!positions_path.empty()) {
+            positions = open_csv(positions_path);
+            std::fprintf(positions, "time_us");
+            for (unsigned c = 0; c < NUM_SERVOS; c++) {
+                std::fprintf(positions, ",ch%u", c);
+            }
+            std::fprintf(positions, "\n");
+            uint64_t next_sample = 0;
+            sim.on_step = [positions, sample_us, next_sample](uint64_t time_us, const ServoModel* servos) mutable {
+                if (time_us < next_sample) {
+                    return;
+                }
+                next_sample = time_us + sample_us;
+                std::fprintf(positions, "%llu", (unsigned long long)time_us);
+                for (unsigned c = 0; c < NUM_SERVOS; c++) {
+                    std::fprintf(positions, ",%.2f", servos[c].angle());
+                }
+                std::fprintf(positions, "\n");
+            };
+        }
+        if (console) {
+            sim.on_console = [](const std::string& line) { std::printf("%s\n", line.c_str()); };
+        }
+
+        auto wall_start = std::chrono::steady_clock::now();
+        sim.run();
+        double wall_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_start).count();
+        double sim_s = sim.duration_us() / 1e6;
+
+        std::printf("Simulated %.1f s (%llu writes) in %.3f s, %.0fx real time\n", sim_s,
+                    (unsigned long long)sim.writes(), wall_s, wall_s > 0 ? sim_s / wall_s : 0.0);
+        std::printf("Servo: tau %.1f ms, slew %.0f °/s, pulse kernel %s\n", options.servo.time_constant_ms,
+                    options.servo.max_rate_dps, pulseKernelName());
+        std::printf("ch  pulses  max err  mean err  max °/s  slew-limited s\n");
+        for (unsigned c = 0; c < NUM_SERVOS; c++) {
+            const ChannelStats& stats = sim.channel(c);
+            std::printf("%2u %7llu %8.1f %9.2f %8.0f %15.3f\n", c, (unsigned long long)stats.pulse_changes,
+                        stats.max_error_deg, stats.mean_error_deg, stats.max_velocity_dps, stats.rate_limited_s);
+            if (max_error >= 0 && stats.max_error_deg > max_error) {
+                ok = false;
+            }
+        }
+        const BoardStats& board = sim.board_stats();
+        std::printf("Board: peak %.2f A, over %.1f A %llu times for %.3f s, %zu command latencies\n",
+                    board.peak_current_ma / 1000, options.current_limit_ma / 1000,
+                    (unsigned long long)board.overcurrent_events, board.overcurrent_s, board.latencies_us.size());
+        if (!ok) {
+            std::printf("Tracking error above %.1f°\n", max_error);
+        }
+    } catch (const std::exception& e) {
+        std::fprintf(stderr, "servo2040_sim: %s\n", e.what());
+        ok = false;
+    }
+    if (pulses != nullptr) {
+        std::fclose(pulses);
+    }
+    if (positions != nullptr) {
+        std::fclose(positions);
+    }
+    return ok ? 0 : 1;
+}
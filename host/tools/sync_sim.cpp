@@ -0,0 +1,197 @@
+// servo2040_sync_sim: check two boards on a shared sync line commit together
+//
+//   servo2040_sync_sim [options]
+//
+//   --cycles N       frames to stage and commit (default 1000)
+//   --usb-jitter US  random delay, up to US, on every frame from the host (default 2000)
+//   --edge-jitter US random delay, up to US, before each board's edge interrupt
+//                    runs, for wiring and interrupt latency (default 5)
+//   --max-skew US    allowed skew between the boards' outputs (default 50)
+//   --seed N         seed for the delays and the boards' clock offsets (default 1)
+//
+// Runs the firmware core twice (SimBoard), each on its own clock, as sync
+// master (YM) and slave (YS). Every cycle the host sends the same STAGE frame
+// to both, each arriving with its own USB delay, then a COMMIT to the master.
+// The master's pulse raises the sync line on both boards, and each commits
+// from its own core's edge handler, whatever its main loop is doing. Checks,
+// cycle after cycle, that:
+//   - staged targets never reach the outputs before the edge
+//   - both boards apply the frame they were sent
+//   - the boards' outputs change no further apart than --max-skew
+// and reports the worst skew and edge-to-output latency. Exits with status 1
+// if a check fails.
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "sim_board.hpp"
+
+using namespace servo2040_host;
+using namespace protocol;
+
+namespace {
+
+int usage() {
+    std::fprintf(stderr, "usage: servo2040_sync_sim [--cycles N] [--usb-jitter US] [--edge-jitter US] [--max-skew US] "
+                         "[--seed N]\n");
+    return 2;
+}
+
+// A board and when (on the common clock) its outputs last changed
+struct Node {
+    explicit Node(uint64_t offset_us) : board(offset_us), offset_us(offset_us) {
+        board.hal().on_pulse = [this](unsigned, float) {
+            changed_us = board.now() - this->offset_us;
+            changes++;
+        };
+    }
+
+    // Run to a time on the common clock
+    void advance_to(uint64_t common_us) { board.advance_to(common_us + offset_us); }
+
+    void send(const std::vector<uint8_t>& bytes) { board.receive(bytes.data(), bytes.size()); }
+
+    // The sync line rises on this board's pin at a time on the common clock
+    void sync_edge(uint64_t common_us) { board.sync_edge(common_us + offset_us); }
+
+    SimBoard board;
+    uint64_t offset_us;
+    uint64_t changed_us = 0;
+    uint64_t changes = 0;
+};
+
+std::vector<uint8_t> stage_frame(const int16_t* positions) {
+    std::vector<uint8_t> frame(3 + 4 + 2 * NUM_CHANNELS);
+    frame[0] = FRAME_SYNC;
+    frame[1] = FRAME_STAGE;
+    frame[2] = (uint8_t)(frame.size() - 3);
+    put_u32(&frame[3], ALL_CHANNELS);
+    for (unsigned s = 0; s < NUM_CHANNELS; s++) {
+        put_u16(&frame[7 + 2 * s], (uint16_t)positions[s]);
+    }
+    return frame;
+}
+
+std::vector<uint8_t> line(const char* text) {
+    return std::vector<uint8_t>(text, text + std::strlen(text));
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    unsigned cycles = 1000;
+    unsigned usb_jitter_us = 2000;
+    unsigned edge_jitter_us = 5;
+    unsigned max_skew_us = 50;
+    unsigned seed = 1;
+    for (int i = 1; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+        if (std::strcmp(argv[i], "--cycles") == 0 && has_value) {
+            cycles = (unsigned)std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--usb-jitter") == 0 && has_value) {
+            usb_jitter_us = (unsigned)std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--edge-jitter") == 0 && has_value) {
+            edge_jitter_us = (unsigned)std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--max-skew") == 0 && has_value) {
+            max_skew_us = (unsigned)std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--seed") == 0 && has_value) {
+            seed = (unsigned)std::atoi(argv[++i]);
+        } else {
+            return usage();
+        }
+    }
+    if (cycles == 0) {
+        return usage();
+    }
+
+    std::mt19937 rng(seed);
+    auto delay = [&](unsigned max_us) {
+        return max_us ? std::uniform_int_distribution<uint64_t>(0, max_us)(rng) : 0;
+    };
+    Node master(delay(9999));
+    Node slave(delay(9999));
+
+    // The master's pulse reaches both boards' pins; each edge interrupt runs a
+    // little later
+    uint64_t edge_us = 0;
+    uint64_t edges = 0;
+    master.board.hal().sync_pulse = [&] {
+        edge_us = master.board.now() - master.offset_us;
+        edges++;
+        master.sync_edge(edge_us + delay(edge_jitter_us));
+        slave.sync_edge(edge_us + delay(edge_jitter_us));
+    };
+
+    uint64_t now_us = 10000;
+    master.send(line("YM\n"));
+    slave.send(line("YS\n"));
+    master.advance_to(now_us);
+    slave.advance_to(now_us);
+
+    // A cycle is long enough for the last frame to arrive and be read, and the
+    // edge to reach both boards
+    const uint64_t cycle_us = 2 * usb_jitter_us + 4 * SimBoard::LOOP_US + edge_jitter_us;
+    uint64_t early = 0;
+    uint64_t wrong = 0;
+    uint64_t missed = 0;
+    uint64_t worst_skew_us = 0;
+    uint64_t worst_latency_us = 0;
+    int16_t positions[NUM_CHANNELS];
+    std::vector<uint8_t> output;
+    for (unsigned c = 0; c < cycles; c++) {
+        for (unsigned s = 0; s < NUM_CHANNELS; s++) {
+            positions[s] = (int16_t)((c * 7 + s * 11) % 241) - 120;
+        }
+        std::vector<uint8_t> stage = stage_frame(positions);
+        uint64_t master_changes = master.changes;
+        uint64_t slave_changes = slave.changes;
+
+        // STAGE to both, each with its own delay, then COMMIT to the master after both
+        for (Node* node : {&master, &slave}) {
+            node->advance_to(now_us + delay(usb_jitter_us));
+            node->send(stage);
+        }
+        uint64_t commit_us = now_us + usb_jitter_us + 2 * SimBoard::LOOP_US + delay(usb_jitter_us);
+        slave.advance_to(commit_us);
+        master.advance_to(commit_us);
+        if (master.changes != master_changes || slave.changes != slave_changes) {
+            early++;
+        }
+        uint64_t edges_before = edges;
+        master.send({FRAME_SYNC, FRAME_COMMIT, 0});
+        now_us += cycle_us;
+        master.advance_to(now_us);
+        slave.advance_to(now_us);
+
+        if (edges != edges_before + 1 || master.changes == master_changes || slave.changes == slave_changes) {
+            missed++;
+            continue;
+        }
+        for (unsigned s = 0; s < NUM_CHANNELS; s++) {
+            if (master.board.position(s) != positions[s] || slave.board.position(s) != positions[s]) {
+                wrong++;
+                break;
+            }
+        }
+        uint64_t skew_us = master.changed_us > slave.changed_us ? master.changed_us - slave.changed_us
+                                                                : slave.changed_us - master.changed_us;
+        worst_skew_us = std::max(worst_skew_us, skew_us);
+        worst_latency_us = std::max({worst_latency_us, master.changed_us - edge_us, slave.changed_us - edge_us});
+        master.board.take_output(output);
+        slave.board.take_output(output);
+        output.clear();
+    }
+
+    bool skew_ok = worst_skew_us <= max_skew_us;
+    std::printf("%u cycles, USB jitter up to %u µs, edge jitter up to %u µs\n", cycles, usb_jitter_us,
+                edge_jitter_us);
+    std::printf("Commit skew: %llu µs at most (allowed %u)\n", (unsigned long long)worst_skew_us, max_skew_us);
+    std::printf("Edge to outputs: %llu µs at most\n", (unsigned long long)worst_latency_us);
+    std::printf("Applied early: %llu, missed commits: %llu, wrong targets: %llu\n", (unsigned long long)early,
+                (unsigned long long)missed, (unsigned long long)wrong);
+    return !skew_ok || early > 0 || missed > 0 || wrong > 0 ? 1 : 0;
+}
@@ -0,0 +1,210 @@
+// servo2040_uart_loopback: check the host side of a UART link against the firmware core
+//
+//   servo2040_uart_loopback [--baud N]
+//
+//   --baud N     rate the host end is opened at (default 3000000)
+//
+// Runs the firmware's controller core (SimBoard) in real time on the master end
+// of a pseudo-terminal, with the UART link's framing (a binary frame that stalls
+// for UART_IDLE_US is dropped), and opens the other end as "<pty>@<baud>".
+// Checks that:
+//   - a binary frame cut off by an idle line is dropped, and the next one applied
+//   - targets set through a Hand reach the board and come back in telemetry
+//   - the clocks sync and command latency is measured
+//
+// A pty doesn't pace bytes at the baud rate, so this checks the framing and the
+// host code path rather than line timing. Exits with status 1 if a check fails.
+
+#include <pty.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "hand.hpp"
+#include "sim_board.hpp"
+#include "transport.hpp"
+
+using namespace servo2040_host;
+using namespace protocol;
+
+namespace {
+
+int usage() {
+    std::fprintf(stderr, "usage: servo2040_uart_loopback [--baud N]\n");
+    return 2;
+}
+
+// A simulated board on the master end of a pty, its clock following the host's
+class LoopbackBoard {
+public:
+    LoopbackBoard() {
+        int slave;
+        char name[256];
+        if (openpty(&master_, &slave, name, nullptr, nullptr) != 0) {
+            throw std::runtime_error(std::string("openpty failed: ") + std::strerror(errno));
+        }
+        ::close(slave);  // Reopened by the host side, by name
+        path_ = name;
+        board_.hal().frame_timeout_us = UART_IDLE_US;
+        start_us_ = Hand::now_us();
+        thread_ = std::thread([this] { run(); });
+    }
+
+    ~LoopbackBoard() {
+        stop_ = true;
+        thread_.join();
+        ::close(master_);
+    }
+
+    const std::string& path() const { return path_; }
+
+    // Run f on the board while its thread is held off
+    template <typename F>
+    void inspect(F&& f) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        f(board_);
+    }
+
+private:
+    void run() {
+        std::vector<uint8_t> output;
+        uint8_t buffer[512];
+        while (!stop_) {
+            pollfd pfd = {master_, POLLIN, 0};
+            ssize_t count = 0;
+            if (::poll(&pfd, 1, 1) > 0 && (pfd.revents & POLLIN)) {
+                count = ::read(master_, buffer, sizeof(buffer));
+            }
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (count > 0) {
+                    board_.receive(buffer, (size_t)count);
+                }
+                board_.advance_to(Hand::now_us() - start_us_);
+                board_.take_output(output);
+            }
+            // Nobody may be reading yet, so output the host end can't take is lost, as on a real line
+            if (!output.empty() && ::write(master_, output.data(), output.size()) < 0) {
+                // Ignored
+            }
+            output.clear();
+        }
+    }
+
+    int master_ = -1;
+    std::string path_;
+    SimBoard board_;
+    std::mutex mutex_;
+    uint64_t start_us_ = 0;
+    std::atomic<bool> stop_{false};
+    std::thread thread_;
+};
+
+int failures = 0;
+
+void check(bool ok, const char* what) {
+    std::printf("%s  %s\n", ok ? "ok  " : "FAIL", what);
+    if (!ok) {
+        failures++;
+    }
+}
+
+void sleep_us(uint64_t us) {
+    std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
+
+// FRAME_SET for channel 0 only
+std::vector<uint8_t> set_frame(int16_t position) {
+    std::vector<uint8_t> frame = {FRAME_SYNC, FRAME_SET, 6, 0, 0, 0, 0, 0, 0};
+    put_u32(&frame[3], 1);
+    put_u16(&frame[7], (uint16_t)position);
+    return frame;
+}
+
+void check_idle_framing(LoopbackBoard& board, const std::string& port) {
+    std::unique_ptr<Transport> link = open_transport(port);
+    std::vector<uint8_t> first = set_frame(20);
+    std::vector<uint8_t> second = set_frame(30);
+
+    // Half a frame, then the line goes idle
+    link->write_all(first.data(), 5);
+    sleep_us(10 * UART_IDLE_US);
+    link->write_all(second.data(), second.size());
+    sleep_us(10 * UART_IDLE_US);
+
+    uint32_t timeouts = 0;
+    int position = 0;
+    board.inspect([&](SimBoard& b) {
+        timeouts = b.core().rxStats().timeouts;
+        position = b.position(0);
+    });
+    check(timeouts == 1, "stalled frame dropped at the idle line");
+    check(position == 30, "next frame applied");
+}
+
+void check_hand(const std::string& port) {
+    HandOptions options;
+    options.telemetry_ms = 10;
+    options.time_sync_ms = 20;
+    Hand hand(port, options);
+
+    int16_t targets[NUM_CHANNELS];
+    for (unsigned i = 0; i < NUM_CHANNELS; i++) {
+        targets[i] = (int16_t)(2 * i - 10);
+    }
+    hand.set_targets(targets, ALL_CHANNELS);
+
+    bool matched = false;
+    uint64_t device_us = 0;
+    for (int i = 0; i < 200 && !(matched && hand.device_time(Hand::now_us(), device_us)); i++) {
+        sleep_us(10000);
+        Telemetry telemetry;
+        matched = hand.telemetry(telemetry) &&
+                  std::memcmp(telemetry.positions, targets, sizeof(targets)) == 0;
+    }
+    check(matched, "targets returned in telemetry");
+    check(hand.device_time(Hand::now_us(), device_us), "clocks synced");
+
+    LatencyStats latency = hand.latency();
+    check(latency.samples > 0, "command latency measured");
+    if (latency.samples > 0) {
+        std::printf("      latency: %llu samples, mean %.0f µs, max %lld µs\n",
+                    (unsigned long long)latency.samples, latency.mean_us, (long long)latency.max_us);
+    }
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    unsigned baud = UART_DEFAULT_BAUD;
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--baud") == 0 && i + 1 < argc) {
+            baud = (unsigned)std::strtoul(argv[++i], nullptr, 10);
+        } else {
+            return usage();
+        }
+    }
+
+    try {
+        LoopbackBoard board;
+        std::string port = board.path() + "@" + std::to_string(baud);
+        std::printf("%s\n", port.c_str());
+        check_idle_framing(board, port);
+        check_hand(port);
+    } catch (const std::exception& e) {
+        std::fprintf(stderr, "servo2040_uart_loopback: %s\n", e.what());
+        return 1;
+    }
+    return failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,135 @@
+#include "trace.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "protocol.hpp"
+
+namespace servo2040_host {
+
+static const size_t TRACE_ALIGN = 8;
+static const size_t TRACE_MAX_DATA = 0xFFFF;
+
+TraceWriter::TraceWriter(const std::string& path, uint64_t host_start_us) : start_us_(host_start_us) {
+    file_ = std::fopen(path.c_str(), "wb");
+    if (file_ == nullptr) {
+        throw std::runtime_error("Can't create " + path + ": " + std::strerror(errno));
+    }
+    std::setvbuf(file_, nullptr, _IOFBF, 64 * 1024);
+
+    using namespace std::chrono;
+    TraceHeader header = {};
+    std::memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    header.version = TRACE_VERSION;
+    header.header_size = sizeof(TraceHeader);
+    header.wall_clock_us = duration_cast<microseconds>(system_clock::now().time_since_epoch()).count();
+    header.host_start_us = host_start_us;
+    std::fwrite(&header, sizeof(header), 1, file_);
+}
+
+TraceWriter::~TraceWriter() {
+    std::fclose(file_);
+}
+
+void TraceWriter::write(uint64_t host_us, TraceDirection direction, TraceKind kind, uint8_t type,
+                        const uint8_t* data, size_t length) {
+    static const uint8_t padding[TRACE_ALIGN] = {};
+    std::lock_guard<std::mutex> lock(mutex_);
+    do {
+        size_t chunk = std::min(length, TRACE_MAX_DATA);
+        TraceRecord record = {};
+        record.time_us = host_us - start_us_;
+        record.length = (uint16_t)chunk;
+        record.direction = direction;
+        record.kind = kind;
+        record.type = type;
+        std::fwrite(&record, sizeof(record), 1, file_);
+        std::fwrite(data, 1, chunk, file_);
+        std::fwrite(padding, 1, (TRACE_ALIGN - chunk % TRACE_ALIGN) % TRACE_ALIGN, file_);
+        data += chunk;
+        length -= chunk;
+    } while (length > 0);
+}
+
+void TraceWriter::flush() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::fflush(file_);
+}
+
+TraceReader::TraceReader(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Can't open " + path + ": " + std::strerror(errno));
+    }
+    struct stat st;
+    if (::fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(TraceHeader)) {
+        ::close(fd);
+        throw std::runtime_error(path + " is not a trace file");
+    }
+    size_ = (size_t)st.st_size;
+    void* map = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        throw std::runtime_error("Can't map " + path + ": " + std::strerror(errno));
+    }
+    base_ = (const uint8_t*)map;
+    header_ = (const TraceHeader*)base_;
+    if (std::memcmp(header_->magic, TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0 || header_->version != TRACE_VERSION ||
+        header_->header_size < sizeof(TraceHeader) || header_->header_size > size_) {
+        ::munmap(map, size_);
+        throw std::runtime_error(path + " is not a version " + std::to_string(TRACE_VERSION) + " trace file");
+    }
+    offset_ = header_->header_size;
+}
+
+TraceReader::~TraceReader() {
+    ::munmap((void*)base_, size_);
+}
+
+bool TraceReader::next(const TraceRecord*& record, const uint8_t*& data) {
+    if (size_ - offset_ < sizeof(TraceRecord)) {
+        return false;
+    }
+    record = (const TraceRecord*)(base_ + offset_);
+    size_t padded = (record->length + TRACE_ALIGN - 1) / TRACE_ALIGN * TRACE_ALIGN;
+    if (size_ - offset_ - sizeof(TraceRecord) < record->length) {
+        return false;
+    }
+    data = base_ + offset_ + sizeof(TraceRecord);
+    offset_ = std::min(size_, offset_ + sizeof(TraceRecord) + padded);
+    return true;
+}
+
+uint64_t trace_device_start(TraceReader& trace) {
+    using namespace protocol;
+    const TraceRecord* record;
+    const uint8_t* data;
+    uint64_t start = 0;
+    while (trace.next(record, data)) {
+        if (record->direction != TRACE_RX || record->kind != TRACE_FRAME) {
+            continue;
+        }
+        uint64_t device_us = 0;
+        if (record->type == FRAME_TELEMETRY && record->length == TELEMETRY_LENGTH) {
+            device_us = get_u64(data + TELEMETRY_TIME);
+        } else if (record->type == FRAME_TIME_REPLY && record->length == TIME_REPLY_LENGTH) {
+            device_us = get_u64(data + 16);
+        } else {
+            continue;
+        }
+        start = device_us > record->time_us ? device_us - record->time_us : 0;
+        break;
+    }
+    trace.rewind();
+    return start;
+}
+
+} // namespace servo2040_host
@@ -0,0 +1,113 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+
+/*
+Command trace files
+
+A trace records what a Hand sent to the device and what came back, so a
+session can be replayed against a board or the simulated firmware core.
+
+The file is append-only: a fixed header, then records that are only ever
+added at the end, so a trace cut short by a crash is still readable up to
+its last complete record. Every record starts on an 8-byte boundary and all
+fields are little endian, so a reader can mmap the file and walk it in place.
+
+    TraceHeader   32 bytes
+    TraceRecord   16 bytes, then length data bytes, zero padded to 8 bytes
+    ...
+*/
+
+namespace servo2040_host {
+
+const char TRACE_MAGIC[8] = {'S', '2', '0', '4', '0', 'T', 'R', 'C'};
+const uint32_t TRACE_VERSION = 1;
+
+struct TraceHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;       // sizeof(TraceHeader), records start here
+    uint64_t wall_clock_us;     // Unix time when the trace was started
+    uint64_t host_start_us;     // Hand::now_us() at the start, record times are relative to it
+};
+
+enum TraceDirection : uint8_t {
+    TRACE_TX = 0,   // Host → device
+    TRACE_RX = 1,   // Device → host
+};
+
+enum TraceKind : uint8_t {
+    TRACE_BYTES = 0,    // Raw bytes exactly as written to the port (TX)
+    TRACE_FRAME = 1,    // A binary frame, type in TraceRecord::type, payload as data (RX)
+    TRACE_LINE = 2,     // A console line without its line ending (RX)
+};
+
+struct TraceRecord {
+    uint64_t time_us;           // Host time since TraceHeader::host_start_us
+    uint16_t length;            // Data bytes following the record
+    uint8_t direction;          // TraceDirection
+    uint8_t kind;               // TraceKind
+    uint8_t type;               // Frame type for TRACE_FRAME
+    uint8_t reserved[3];
+};
+
+static_assert(sizeof(TraceHeader) == 32, "Trace header layout");
+static_assert(sizeof(TraceRecord) == 16, "Trace record layout");
+
+// Appends records to a new trace file. Thread safe.
+class TraceWriter {
+public:
+    // Creates (or truncates) path. Throws std::runtime_error on failure.
+    TraceWriter(const std::string& path, uint64_t host_start_us);
+    ~TraceWriter();
+
+    TraceWriter(const TraceWriter&) = delete;
+    TraceWriter& operator=(const TraceWriter&) = delete;
+
+    // Record data, split into several records if it is longer than a record can hold
+    void write(uint64_t host_us, TraceDirection direction, TraceKind kind, uint8_t type,
+               const uint8_t* data, size_t length);
+
+    // Push buffered records to the file
+    void flush();
+
+private:
+    std::mutex mutex_;
+    std::FILE* file_ = nullptr;
+    uint64_t start_us_;
+};
+
+// Reads a trace file through a read-only memory mapping
+class TraceReader {
+public:
+    // Throws std::runtime_error if path isn't a trace file
+    explicit TraceReader(const std::string& path);
+    ~TraceReader();
+
+    TraceReader(const TraceReader&) = delete;
+    TraceReader& operator=(const TraceReader&) = delete;
+
+    const TraceHeader& header() const { return *header_; }
+
+    // Next complete record, false at the end (or at a truncated last record).
+    // data points into the mapping and stays valid as long as the reader.
+    bool next(const TraceRecord*& record, const uint8_t*& data);
+
+    // Start again from the first record
+    void rewind() { offset_ = header_->header_size; }
+
+private:
+    const uint8_t* base_ = nullptr;
+    size_t size_ = 0;
+    const TraceHeader* header_ = nullptr;
+    size_t offset_ = 0;
+};
+
+// Device clock when the trace started, worked out from the first recorded
+// telemetry or time reply (0 if there is none). Rewinds the reader.
+uint64_t trace_device_start(TraceReader& trace);
+
+} // namespace servo2040_host
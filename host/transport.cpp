@@ -0,0 +1,32 @@
+#include "transport.hpp"
+
+#include <cstdlib>
+#include <stdexcept>
+
+#include "serial_port.hpp"
+#ifdef SERVO2040_HAVE_LIBUSB
+#include "usb_port.hpp"
+#endif
+
+namespace servo2040_host {
+
+std::unique_ptr<Transport> open_transport(const std::string& port) {
+    if (port == "usb" || port.compare(0, 4, "usb:") == 0) {
+#ifdef SERVO2040_HAVE_LIBUSB
+        return std::unique_ptr<Transport>(new UsbPort(port.size() > 4 ? port.substr(4) : ""));
+#else
+        throw std::runtime_error("Can't open " + port + ": built without libusb");
+#endif
+    }
+    size_t at = port.rfind('@');
+    if (at != std::string::npos) {
+        unsigned long baud = std::strtoul(port.c_str() + at + 1, nullptr, 10);
+        if (baud == 0) {
+            throw std::runtime_error("Bad baud rate in " + port);
+        }
+        return std::unique_ptr<Transport>(new SerialPort(port.substr(0, at), (unsigned)baud));
+    }
+    return std::unique_ptr<Transport>(new SerialPort(port));
+}
+
+} // namespace servo2040_host
@@ -0,0 +1,28 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace servo2040_host {
+
+// Byte stream to and from a board
+class Transport {
+public:
+    virtual ~Transport() = default;
+
+    // Write everything, waiting for the device if it is busy. Throws on error.
+    virtual void write_all(const uint8_t* data, size_t length) = 0;
+
+    // Read whatever is available, waiting up to timeout_us for the first byte.
+    // Returns the number of bytes read (0 on timeout). Throws on error.
+    virtual size_t read_some(uint8_t* data, size_t capacity, int64_t timeout_us) = 0;
+};
+
+// "usb" or "usb:<serial number>" opens the board's vendor-class bulk interface
+// (UsbPort), anything else is a serial device path (SerialPort), optionally
+// followed by "@<baud>" for a UART link (e.g. "/dev/ttyAMA0@3000000").
+// Throws std::runtime_error if it can't be opened.
+std::unique_ptr<Transport> open_transport(const std::string& port);
+
+} // namespace servo2040_host
@@ -0,0 +1,173 @@
+#include "usb_port.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include <libusb.h>
+
+namespace servo2040_host {
+
+namespace {
+
+const unsigned WRITE_TIMEOUT_MS = 1000;
+
+std::runtime_error usb_error(const std::string& what, int code) {
+    return std::runtime_error(what + ": " + libusb_error_name(code));
+}
+
+// A vendor-class interface with a bulk IN and a bulk OUT endpoint
+struct CommandInterface {
+    int number = -1;
+    uint8_t in_endpoint = 0;
+    uint8_t out_endpoint = 0;
+    uint16_t packet_size = 0;
+};
+
+bool find_command_interface(libusb_device* device, CommandInterface& found) {
+    libusb_config_descriptor* config;
+    if (libusb_get_active_config_descriptor(device, &config) != 0) {
+        return false;
+    }
+    for (int i = 0; i < config->bNumInterfaces && found.number < 0; i++) {
+        if (config->interface[i].num_altsetting < 1) {
+            continue;
+        }
+        const libusb_interface_descriptor& itf = config->interface[i].altsetting[0];
+        if (itf.bInterfaceClass != LIBUSB_CLASS_VENDOR_SPEC) {
+            continue;
+        }
+        CommandInterface candidate;
+        for (int e = 0; e < itf.bNumEndpoints; e++) {
+            const libusb_endpoint_descriptor& ep = itf.endpoint[e];
+            if ((ep.bmAttributes & 0x03) != LIBUSB_TRANSFER_TYPE_BULK) {
+                continue;
+            }
+            if (ep.bEndpointAddress & LIBUSB_ENDPOINT_IN) {
+                candidate.in_endpoint = ep.bEndpointAddress;
+                candidate.packet_size = ep.wMaxPacketSize;
+            } else {
+                candidate.out_endpoint = ep.bEndpointAddress;
+            }
+        }
+        // The SDK's reset interface is vendor class too, but has no endpoints
+        if (candidate.in_endpoint != 0 && candidate.out_endpoint != 0) {
+            candidate.number = itf.bInterfaceNumber;
+            found = candidate;
+        }
+    }
+    libusb_free_config_descriptor(config);
+    return found.number >= 0;
+}
+
+std::string serial_number(libusb_device_handle* handle, uint8_t index) {
+    unsigned char text[64];
+    int length = index ? libusb_get_string_descriptor_ascii(handle, index, text, sizeof(text)) : 0;
+    return length > 0 ? std::string((const char*)text, length) : std::string();
+}
+
+} // namespace
+
+UsbPort::UsbPort(const std::string& serial) {
+    int result = libusb_init(&context_);
+    if (result != 0) {
+        throw usb_error("Can't initialise libusb", result);
+    }
+    try {
+        open(serial);
+    } catch (...) {
+        close();
+        throw;
+    }
+}
+
+UsbPort::~UsbPort() {
+    close();
+}
+
+void UsbPort::open(const std::string& serial) {
+    libusb_device** devices;
+    ssize_t count = libusb_get_device_list(context_, &devices);
+    if (count < 0) {
+        throw usb_error("Can't list USB devices", (int)count);
+    }
+
+    std::string error = "no board with a command interface";
+    for (ssize_t i = 0; i < count && handle_ == nullptr; i++) {
+        libusb_device_descriptor descriptor;
+        CommandInterface itf;
+        if (libusb_get_device_descriptor(devices[i], &descriptor) != 0 || descriptor.idVendor != VENDOR_ID ||
+            descriptor.idProduct != PRODUCT_ID || !find_command_interface(devices[i], itf)) {
+            continue;
+        }
+        libusb_device_handle* handle;
+        int result = libusb_open(devices[i], &handle);
+        if (result != 0) {
+            error = std::string("can't open board: ") + libusb_error_name(result);
+            continue;
+        }
+        if (!serial.empty() && serial_number(handle, descriptor.iSerialNumber) != serial) {
+            libusb_close(handle);
+            continue;
+        }
+        result = libusb_claim_interface(handle, itf.number);
+        if (result != 0) {
+            error = std::string("can't claim the command interface: ") + libusb_error_name(result);
+            libusb_close(handle);
+            continue;
+        }
+        handle_ = handle;
+        interface_ = itf.number;
+        in_endpoint_ = itf.in_endpoint;
+        out_endpoint_ = itf.out_endpoint;
+        packet_size_ = itf.packet_size;
+    }
+    libusb_free_device_list(devices, 1);
+
+    if (handle_ == nullptr) {
+        throw std::runtime_error("Can't open USB " + (serial.empty() ? std::string("board") : serial) + ": " + error);
+    }
+}
+
+void UsbPort::close() {
+    if (handle_ != nullptr) {
+        libusb_release_interface(handle_, interface_);
+        libusb_close(handle_);
+        handle_ = nullptr;
+    }
+    if (context_ != nullptr) {
+        libusb_exit(context_);
+        context_ = nullptr;
+    }
+}
+
+void UsbPort::write_all(const uint8_t* data, size_t length) {
+    while (length > 0) {
+        int transferred = 0;
+        int chunk = (int)std::min<size_t>(length, 1 << 16);
+        int result = libusb_bulk_transfer(handle_, out_endpoint_, const_cast<uint8_t*>(data), chunk,
+                                          &transferred, WRITE_TIMEOUT_MS);
+        if (result != 0 && result != LIBUSB_ERROR_TIMEOUT) {
+            throw usb_error("USB write failed", result);
+        }
+        data += transferred;
+        length -= transferred;
+    }
+}
+
+size_t UsbPort::read_some(uint8_t* data, size_t capacity, int64_t timeout_us) {
+    // Whole packets only, so the board can't overrun the buffer
+    int length = (int)(std::min<size_t>(capacity, 1 << 16) / packet_size_ * packet_size_);
+    if (length == 0) {
+        throw std::runtime_error("USB read buffer is smaller than a packet");
+    }
+    // libusb treats 0 as no timeout at all
+    unsigned timeout_ms = timeout_us > 0 ? (unsigned)((timeout_us + 999) / 1000) : 1;
+    int transferred = 0;
+    int result = libusb_bulk_transfer(handle_, in_endpoint_, data, length, &transferred, timeout_ms);
+    if (result != 0 && result != LIBUSB_ERROR_TIMEOUT && result != LIBUSB_ERROR_INTERRUPTED) {
+        throw usb_error("USB read failed", result);
+    }
+    return (size_t)transferred;
+}
+
+} // namespace servo2040_host
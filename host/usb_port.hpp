@@ -0,0 +1,46 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "transport.hpp"
+
+struct libusb_context;
+struct libusb_device_handle;
+
+namespace servo2040_host {
+
+// The vendor-class bulk interface of the Servo2040's composite USB device,
+// through libusb. Frames on it go straight to the board's command input and
+// never queue behind console text, which stays on the CDC port.
+class UsbPort : public Transport {
+public:
+    static constexpr uint16_t VENDOR_ID = 0x2E8A;
+    static constexpr uint16_t PRODUCT_ID = 0x000A;
+
+    // Opens the first board with a command interface, or the one with this
+    // USB serial number. Throws std::runtime_error if none can be opened.
+    explicit UsbPort(const std::string& serial = "");
+    ~UsbPort() override;
+
+    UsbPort(const UsbPort&) = delete;
+    UsbPort& operator=(const UsbPort&) = delete;
+
+    void write_all(const uint8_t* data, size_t length) override;
+
+    // capacity must hold at least one packet (64 bytes)
+    size_t read_some(uint8_t* data, size_t capacity, int64_t timeout_us) override;
+
+private:
+    void open(const std::string& serial);
+    void close();
+
+    libusb_context* context_ = nullptr;
+    libusb_device_handle* handle_ = nullptr;
+    int interface_ = -1;
+    uint8_t in_endpoint_ = 0;
+    uint8_t out_endpoint_ = 0;
+    uint16_t packet_size_ = 64;
+};
+
+} // namespace servo2040_host
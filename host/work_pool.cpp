@@ -0,0 +1,107 @@
+#include "work_pool.hpp"
+
+#include <algorithm>
+
+namespace servo2040_host {
+
+namespace {
+
+// Which pool and worker the current thread belongs to, if any
+thread_local const WorkPool* current_pool = nullptr;
+thread_local unsigned current_worker = 0;
+
+} // namespace
+
+WorkPool::WorkPool(unsigned threads) {
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (unsigned i = 0; i < threads; i++) {
+        queues_.emplace_back(new Queue);
+    }
+    for (unsigned i = 0; i < threads; i++) {
+        threads_.emplace_back(&WorkPool::worker, this, i);
+    }
+}
+
+WorkPool::~WorkPool() {
+    wait();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    work_ready_.notify_all();
+    for (auto& thread : threads_) {
+        thread.join();
+    }
+}
+
+void WorkPool::submit(std::function<void()> task) {
+    // Spread tasks from outside the pool round-robin, keep tasks from a worker local
+    unsigned index = current_pool == this ? current_worker : next_queue_++ % queues_.size();
+    unfinished_++;
+    {
+        std::lock_guard<std::mutex> lock(queues_[index]->mutex);
+        queues_[index]->tasks.push_back(std::move(task));
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        queued_++;
+    }
+    work_ready_.notify_one();
+}
+
+void WorkPool::wait() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    all_done_.wait(lock, [this] { return unfinished_ == 0; });
+}
+
+// Newest task from our own deque, else the oldest from someone else's
+bool WorkPool::take(unsigned index, std::function<void()>& task) {
+    {
+        Queue& own = *queues_[index];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty()) {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            queued_--;
+            return true;
+        }
+    }
+    for (size_t i = 1; i < queues_.size(); i++) {
+        Queue& other = *queues_[(index + i) % queues_.size()];
+        std::lock_guard<std::mutex> lock(other.mutex);
+        if (!other.tasks.empty()) {
+            task = std::move(other.tasks.front());
+            other.tasks.pop_front();
+            queued_--;
+            steals_++;
+            return true;
+        }
+    }
+    return false;
+}
+
+void WorkPool::worker(unsigned index) {
+    current_pool = this;
+    current_worker = index;
+    std::function<void()> task;
+    for (;;) {
+        if (take(index, task)) {
+            task();
+            task = nullptr;
+            if (--unfinished_ == 0) {
+                std::lock_guard<std::mutex> lock(mutex_);
+                all_done_.notify_all();
+            }
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(mutex_);
+        work_ready_.wait(lock, [this] { return queued_ > 0 || stopping_; });
+        if (stopping_ && queued_ == 0) {
+            return;
+        }
+    }
+}
+
+} // namespace servo2040_host
@@ -0,0 +1,63 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+Work-stealing thread pool
+
+Each worker has its own deque. A worker takes its newest task first and, when
+its deque is empty, steals the oldest task from another worker, so long and
+short jobs even out across cores without a shared queue everybody contends
+on. Tasks submitted from inside a task go to the submitting worker's deque.
+*/
+
+namespace servo2040_host {
+
+class WorkPool {
+public:
+    // threads = 0 uses one worker per hardware thread
+    explicit WorkPool(unsigned threads = 0);
+    ~WorkPool();
+
+    WorkPool(const WorkPool&) = delete;
+    WorkPool& operator=(const WorkPool&) = delete;
+
+    // Queue a task. Tasks must not throw.
+    void submit(std::function<void()> task);
+
+    // Block until every submitted task has finished (not from inside a task)
+    void wait();
+
+    unsigned size() const { return (unsigned)threads_.size(); }
+    uint64_t steals() const { return steals_; }
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    void worker(unsigned index);
+    bool take(unsigned index, std::function<void()>& task);
+
+    std::vector<std::unique_ptr<Queue>> queues_;
+    std::vector<std::thread> threads_;
+    std::mutex mutex_;                    // Guards sleeping and waking
+    std::condition_variable work_ready_;
+    std::condition_variable all_done_;
+    std::atomic<size_t> queued_{0};       // Tasks sitting in a deque
+    std::atomic<size_t> unfinished_{0};   // Tasks submitted and not yet finished
+    std::atomic<unsigned> next_queue_{0};
+    std::atomic<uint64_t> steals_{0};
+    bool stopping_ = false;
+};
+
+} // namespace servo2040_host
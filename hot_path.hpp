@@ -0,0 +1,37 @@
+#pragma once
+
+/*
+Placement of the real-time path
+
+On the board, code normally runs straight from QSPI flash through the XIP
+cache, and a cache miss stalls the CPU for several microseconds while the
+line is fetched. SERVO2040_RAM_HOT_PATH (set from CMake) moves the path a
+command takes from the USB ring to the PWM outputs into SRAM:
+
+  0  everything runs from flash
+  1  functions marked HOT_PATH, and tables marked HOT_DATA, are copied to
+     SRAM at boot (the SDK linker script's .time_critical sections)
+  2  the whole image is copied to SRAM at boot (copy_to_ram binary)
+
+The markers are empty on the host and in modes 0 and 2. Every marked
+function gets its own section, so inline and out-of-line functions never
+share one. An inline variable in a header takes HOT_SHARED_DATA(name)
+instead: every file that includes it must name the same section, so the
+linker keeps a single copy.
+*/
+
+#ifndef SERVO2040_RAM_HOT_PATH
+#define SERVO2040_RAM_HOT_PATH 0
+#endif
+
+#if SERVO2040_RAM_HOT_PATH == 1
+#define HOT_SECTION_NAMED(n) __attribute__((section(".time_critical.servo2040_" #n)))
+#define HOT_SECTION(n) HOT_SECTION_NAMED(n)
+#define HOT_PATH HOT_SECTION(__COUNTER__)
+#define HOT_DATA HOT_SECTION(__COUNTER__)
+#define HOT_SHARED_DATA(name) HOT_SECTION_NAMED(name)
+#else
+#define HOT_PATH
+#define HOT_DATA
+#define HOT_SHARED_DATA(name)
+#endif
@@ -0,0 +1,75 @@
+#include "pca9685.hpp"
+
+#include "hot_path.hpp"
+
+void pca9685Setup(uint8_t prescale, Pca9685Setting* settings) {
+    settings[0] = {PCA9685_MODE1, (uint8_t)(PCA9685_MODE1_SLEEP | PCA9685_MODE1_AI | PCA9685_MODE1_ALLCALL)};
+    settings[1] = {PCA9685_PRE_SCALE, prescale};
+    settings[2] = {PCA9685_MODE2, PCA9685_MODE2_OUTDRV};
+    settings[3] = {PCA9685_MODE1, (uint8_t)(PCA9685_MODE1_AI | PCA9685_MODE1_ALLCALL)};
+}
+
+void Pca9685Chain::begin(unsigned channels, unsigned outputs_per_board, unsigned hz) {
+    outputs = outputs_per_board ? outputs_per_board : 1;
+    if (outputs > PCA9685_OUTPUTS) {
+        outputs = PCA9685_OUTPUTS;
+    }
+    num_boards = (channels + outputs - 1) / outputs;
+    if (num_boards > MAX_BOARDS) {
+        num_boards = MAX_BOARDS;
+    }
+    num_channels = channels < num_boards * outputs ? channels : num_boards * outputs;
+    pre_scale = pca9685Prescale(hz);
+    for (auto c = 0u; c < num_channels; c++) {
+        off_counts[c] = 0;
+    }
+    // Outputs with a channel on each board
+    for (auto b = 0u; b < num_boards; b++) {
+        unsigned used = num_channels - b * outputs < outputs ? num_channels - b * outputs : outputs;
+        dirty[b] = (uint16_t)((1u << used) - 1);
+    }
+}
+
+HOT_PATH bool Pca9685Chain::stage(const uint16_t* pulses_q4, uint32_t mask) {
+    bool changed = false;
+    for (auto c = 0u; c < num_channels; c++) {
+        if (!(mask & (1u << c))) {
+            continue;
+        }
+        uint16_t value = pca9685Counts(pulses_q4[c], pre_scale);
+        if (value != off_counts[c]) {
+            off_counts[c] = value;
+            dirty[c / outputs] |= (uint16_t)(1u << (c % outputs));
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+HOT_PATH bool Pca9685Chain::takeBurst(uint8_t& board_address, const uint8_t*& data, unsigned& length) {
+    for (auto b = 0u; b < num_boards; b++) {
+        if (!dirty[b]) {
+            continue;
+        }
+        unsigned first = (unsigned)__builtin_ctz(dirty[b]);
+        unsigned last = 31 - (unsigned)__builtin_clz(dirty[b]);
+        dirty[b] = 0;
+
+        // Outputs in between that didn't change are rewritten with the values they have
+        burst[0] = (uint8_t)(PCA9685_LED0_ON_L + 4 * first);
+        uint8_t* out = burst + 1;
+        for (auto o = first; o <= last; o++) {
+            uint16_t value = off_counts[b * outputs + o];
+            out[0] = 0;
+            out[1] = 0;
+            out[2] = (uint8_t)value;
+            out[3] = (uint8_t)(value >> 8);
+            out += 4;
+        }
+        board_address = address(b);
+        data = burst;
+        length = (unsigned)(out - burst);
+        return true;
+    }
+    return false;
+}
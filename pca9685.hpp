@@ -0,0 +1,108 @@
+#pragma once
+#include <cstdint>
+
+/*
+PCA9685 expansion boards
+
+Channels after the board's own 18 (protocol::NUM_EXPANSION_CHANNELS) are
+outputs of PCA9685 PWM boards on the Qw/ST I²C bus, a fixed number of outputs
+per board, the boards at consecutive addresses from PCA9685_BASE_ADDRESS.
+
+Pca9685Chain keeps each board's output registers as last written, and turns
+the pulses of a control tick into at most one write per board: the register
+pointer, then LEDn_ON/LEDn_OFF of every output from the first changed one to
+the last, which the chip takes as one auto-increment burst. Outputs that
+didn't change cost nothing, so a tick that moves a few joints is a few bytes.
+A PCA9685 takes new values at the end of its current PWM period, so an output
+never glitches mid-pulse.
+
+Shared by the firmware (expansion_link.hpp sends the bursts by DMA) and the
+host tools (host/mock_i2c.hpp receives them).
+*/
+
+// Registers
+const uint8_t PCA9685_MODE1 = 0x00;
+const uint8_t PCA9685_MODE2 = 0x01;
+const uint8_t PCA9685_LED0_ON_L = 0x06;     // ON_L, ON_H, OFF_L, OFF_H per output
+const uint8_t PCA9685_PRE_SCALE = 0xFE;
+
+const uint8_t PCA9685_MODE1_RESTART = 0x80;
+const uint8_t PCA9685_MODE1_AI = 0x20;      // Register pointer auto-increment
+const uint8_t PCA9685_MODE1_SLEEP = 0x10;
+const uint8_t PCA9685_MODE1_ALLCALL = 0x01;
+const uint8_t PCA9685_MODE2_OUTDRV = 0x04;  // Totem-pole outputs
+
+const uint8_t PCA9685_BASE_ADDRESS = 0x40;
+const unsigned PCA9685_OUTPUTS = 16;
+const unsigned PCA9685_COUNTS = 4096;       // Per PWM period
+// Internal oscillator. It is only good to a few percent; J<channel> calibration
+// takes up the difference if a joint needs it.
+const uint32_t PCA9685_OSC_HZ = 25000000;
+const unsigned PCA9685_SERVO_HZ = 50;
+
+// PRE_SCALE for a PWM frequency
+inline uint8_t pca9685Prescale(unsigned hz) {
+    return (uint8_t)((PCA9685_OSC_HZ + PCA9685_COUNTS / 2 * hz) / (PCA9685_COUNTS * hz) - 1);
+}
+
+// OFF count (ON at 0) for a pulse width in 1/16 µs, rounded to the nearest
+// count: one count is (prescale + 1) / 25 µs, 4.9 µs at 50 Hz
+inline uint16_t pca9685Counts(uint16_t pulse_q4, uint8_t prescale) {
+    uint32_t per_count = 16u * (prescale + 1);
+    uint32_t counts = ((uint32_t)pulse_q4 * (PCA9685_OSC_HZ / 1000000) + per_count / 2) / per_count;
+    return (uint16_t)(counts < PCA9685_COUNTS ? counts : PCA9685_COUNTS - 1);
+}
+
+// Pulse width in µs an OFF count gives, for reports
+inline float pca9685PulseUs(uint16_t counts, uint8_t prescale) {
+    return counts * (prescale + 1) / (float)(PCA9685_OSC_HZ / 1000000);
+}
+
+// One register write at setup
+struct Pca9685Setting {
+    uint8_t reg;
+    uint8_t value;
+};
+
+// Writes that set a board up for servos, in order: sleep (the prescaler only
+// takes a new value while asleep), prescale, totem-pole outputs, then wake
+// with auto-increment. The oscillator needs 500 µs after waking.
+const unsigned PCA9685_SETUP_WRITES = 4;
+void pca9685Setup(uint8_t prescale, Pca9685Setting* settings);
+
+class Pca9685Chain {
+public:
+    static const unsigned MAX_BOARDS = 4;
+    // Register pointer, then four registers per output
+    static const unsigned MAX_BURST = 1 + 4 * PCA9685_OUTPUTS;
+
+    // channels outputs, outputs_per_board to a board, servos at hz.
+    // Everything is written on the first update.
+    void begin(unsigned channels, unsigned outputs_per_board, unsigned hz = PCA9685_SERVO_HZ);
+
+    unsigned boards() const { return num_boards; }
+    unsigned channels() const { return num_channels; }
+    uint8_t prescale() const { return pre_scale; }
+    uint8_t address(unsigned board) const { return (uint8_t)(PCA9685_BASE_ADDRESS + board); }
+
+    // Take pulse widths (1/16 µs) for the channels in mask, bit 0 being the
+    // first expansion channel. Returns true if any output changed.
+    bool stage(const uint16_t* pulses_q4, uint32_t mask);
+
+    // The next board with changes, lowest address first: its address and the
+    // bytes of its write, starting with the register pointer. The bytes stay
+    // valid until the next call. False once every board is up to date.
+    bool takeBurst(uint8_t& address, const uint8_t*& data, unsigned& length);
+
+    // OFF count last staged for a channel
+    uint16_t counts(unsigned channel) const { return off_counts[channel]; }
+
+private:
+    unsigned num_channels = 0;
+    unsigned outputs = PCA9685_OUTPUTS;
+    unsigned num_boards = 0;
+    uint8_t pre_scale = 0;
+    uint16_t off_counts[MAX_BOARDS * PCA9685_OUTPUTS] = {};
+    uint16_t dirty[MAX_BOARDS] = {};   // Changed outputs per board, one bit each
+    uint8_t burst[MAX_BURST] = {};
+};
@@ -0,0 +1,215 @@
+#pragma once
+#include <cstdint>
+
+#include "hot_path.hpp"
+
+/*
+Servo2040 wire protocol
+Shared by the firmware and the host tools, so both sides agree on framing.
+
+Binary frames: FRAME_SYNC, type, payload length, payload
+FRAME_SYNC is not printable, so it can never start an ASCII command line.
+All multi-byte values are little endian.
+*/
+
+namespace protocol {
+
+// Channels 0-17 are the board's own outputs. Expansion channels (PCA9685
+// boards, see pca9685.hpp) follow them when the firmware is built with
+// SERVO2040_EXPANSION_CHANNELS, and the host must be built to match.
+// Channel masks are u32, so there are at most 32 channels in all.
+#ifndef SERVO2040_EXPANSION_CHANNELS
+#define SERVO2040_EXPANSION_CHANNELS 0
+#endif
+constexpr unsigned NUM_BOARD_CHANNELS = 18;
+constexpr unsigned NUM_EXPANSION_CHANNELS = SERVO2040_EXPANSION_CHANNELS;
+constexpr unsigned NUM_CHANNELS = NUM_BOARD_CHANNELS + NUM_EXPANSION_CHANNELS;
+static_assert(NUM_CHANNELS <= 32, "Channel masks are 32 bits");
+constexpr uint32_t ALL_CHANNELS = 0xFFFFFFFFu >> (32 - NUM_CHANNELS);
+constexpr int MIN_ANGLE = -140;
+constexpr int MAX_ANGLE = 140;
+
+constexpr uint8_t FRAME_SYNC = 0xA5;
+constexpr unsigned MAX_FRAME_PAYLOAD = 255;
+
+// UART link (uart_link.hpp), 8N1. The board polls its input at least once
+// a millisecond, so a gap of UART_IDLE_US without bytes reliably shows the
+// line is idle: it ends a binary frame that was cut short.
+constexpr unsigned UART_DEFAULT_BAUD = 3000000;
+constexpr uint64_t UART_IDLE_US = 2000;
+
+// Integrity checked frames set the top bit of the type:
+//   FRAME_SYNC, type | FRAME_CHECKED, payload length, u8 seq, payload, u16 CRC
+// The CRC-16/CCITT (poly 0x1021, init 0xFFFF) covers everything after FRAME_SYNC.
+// ASCII lines take an optional "#<seq>" and "*<XX>" suffix, where XX is the hex
+// XOR of every character before the '*', e.g. "0,10;1,20#7*2D".
+constexpr uint8_t FRAME_CHECKED = 0x80;
+constexpr unsigned CHECKED_OVERHEAD = 3;      // seq + CRC
+
+// Host → device
+constexpr uint8_t FRAME_TRAJ_BEGIN = 0x10;    // u16 keyframe count, clears the trajectory buffer
+constexpr uint8_t FRAME_TRAJ_DATA = 0x11;     // One or more encoded keyframes
+constexpr uint8_t FRAME_TRAJ_CONTROL = 0x12;  // u8 TrajectoryOp
+constexpr uint8_t FRAME_KEYFRAME = 0x20;      // u8 seq, int16 position per channel
+constexpr uint8_t FRAME_DELTA8 = 0x21;        // u8 seq, int8 delta per channel
+constexpr uint8_t FRAME_DELTA4 = 0x22;        // u8 seq, 4-bit signed delta per channel (two per byte, low nibble first)
+constexpr uint8_t FRAME_SET = 0x23;           // u32 mask, int16 position per set bit, applied immediately
+constexpr uint8_t FRAME_STAGE = 0x30;         // As FRAME_SET, applied on the next sync commit
+constexpr uint8_t FRAME_COMMIT = 0x31;        // No payload, commit the staged frame
+constexpr uint8_t FRAME_SCHEDULE = 0x32;      // u64 device time (µs), then as FRAME_SET
+constexpr uint8_t FRAME_SCHEDULE_HOST = 0x33; // As FRAME_SCHEDULE, but in host time (needs time sync)
+constexpr uint8_t FRAME_TIME_REQUEST = 0x40;  // u64 host time, i64 offset µs, i32 drift ppb, u8 flags
+constexpr uint8_t FRAME_TELEMETRY_RATE = 0x51; // u16 telemetry period in ms (0 = off)
+constexpr uint8_t FRAME_BUS = 0x60;           // u8 node, u8 type, payload: a frame for one node (or BUS_BROADCAST)
+constexpr uint8_t FRAME_BUS_COMMIT = 0x61;    // u16 first slot µs, u16 slot µs, u8 BusCommitFlags: commit on every node
+
+// Device → host
+constexpr uint8_t FRAME_TIME_REPLY = 0x41;    // u64 host time, u64 device rx time, u64 device tx time
+constexpr uint8_t FRAME_TELEMETRY = 0x50;     // See TELEMETRY_* offsets below
+constexpr uint8_t FRAME_LOG = 0x52;           // Deferred log records, see LOG_RECORD_* below
+constexpr uint8_t FRAME_BUS_REPLY = 0x62;     // u8 node, u8 type, payload: a bus node's answer
+
+// Trajectory keyframe delta escape: an absolute int16 position follows
+constexpr int8_t TRAJ_ABSOLUTE = -128;
+
+enum TrajectoryOp : uint8_t {
+    TRAJ_STOP = 0,
+    TRAJ_PLAY = 1,
+    TRAJ_LOOP = 2,
+    TRAJ_ARM = 3,      // Play once when the trigger command arrives
+    TRAJ_TRIGGER = 4,
+};
+
+// FRAME_TIME_REQUEST
+constexpr unsigned TIME_REQUEST_LENGTH = 21;
+constexpr uint8_t TIME_ESTIMATE_VALID = 0x01;
+constexpr unsigned TIME_REPLY_LENGTH = 24;
+
+// FRAME_TELEMETRY payload layout
+constexpr unsigned TELEMETRY_TIME = 0;          // u64 device time
+constexpr unsigned TELEMETRY_LAST_SET_RX = 8;   // u64 device time the last FRAME_SET arrived
+constexpr unsigned TELEMETRY_SET_COUNT = 16;    // u32 FRAME_SETs received
+constexpr unsigned TELEMETRY_MERGED_FRAMES = 20;   // u32 joint frames merged into a later one (C1)
+constexpr unsigned TELEMETRY_DROPPED_TARGETS = 24; // u32 channel targets overwritten before being applied
+constexpr unsigned TELEMETRY_POSITIONS = 28;    // int16 position per channel
+constexpr unsigned TELEMETRY_LENGTH = TELEMETRY_POSITIONS + NUM_CHANNELS * 2;
+
+// FRAME_LOG payload: one or more records, each
+constexpr unsigned LOG_RECORD_SITE = 0;     // u16 offset of the format string in the string table
+constexpr unsigned LOG_RECORD_TIME = 2;     // u32 low 32 bits of device time
+constexpr unsigned LOG_RECORD_COUNT = 6;    // u8 argument words
+constexpr unsigned LOG_RECORD_ARGS = 7;     // u32 per argument word
+constexpr unsigned LOG_MAX_ARGS = 16;
+constexpr uint16_t LOG_SITE_LOST = 0xFFFF;  // One word: records dropped on the device just before this point
+
+// RS-485 bus: nodes 1-BUS_MAX_NODES share one half-duplex UART link. The
+// host wraps each frame in FRAME_BUS, and a node only talks to answer a frame
+// addressed to it alone, or in its slot after FRAME_BUS_COMMIT: node n starts
+// first slot µs + (n - 1) * slot µs after the commit arrives.
+constexpr uint8_t BUS_BROADCAST = 0xFF;
+constexpr unsigned BUS_MAX_NODES = 15;
+constexpr unsigned BUS_COMMIT_LENGTH = 5;
+constexpr unsigned BUS_HEADER = 2;            // node, type
+
+enum BusCommitFlags : uint8_t {
+    BUS_COMMIT_TELEMETRY = 0x01,  // Each node sends FRAME_TELEMETRY in its slot
+};
+
+// Bus timing (µs). A byte is 10 bits on the line. A node polls its input every
+// BUS_POLL_US while idle, and acts on a commit at most BUS_JITTER_US after its
+// last byte. Talkers leave BUS_TURNAROUND_US between them for the transceivers
+// to switch direction.
+constexpr uint32_t BUS_POLL_US = 20;
+constexpr uint32_t BUS_JITTER_US = 50;
+constexpr uint32_t BUS_TURNAROUND_US = 10;
+constexpr unsigned BUS_TELEMETRY_BYTES = 3 + BUS_HEADER + TELEMETRY_LENGTH;  // FRAME_BUS_REPLY carrying telemetry
+
+constexpr uint32_t bus_bytes_us(unsigned bytes, unsigned baud) {
+    return (uint32_t)(((uint64_t)bytes * 10 * 1000000 + baud - 1) / baud);
+}
+
+// Long enough for a node's telemetry even if it starts BUS_JITTER_US late and
+// the next node starts on time
+constexpr uint32_t bus_slot_us(unsigned baud) {
+    return bus_bytes_us(BUS_TELEMETRY_BYTES, baud) + BUS_JITTER_US + BUS_TURNAROUND_US;
+}
+
+// One cycle from the host: FRAME_STAGE with `channels` positions for each node, then the commit
+constexpr unsigned bus_downlink_bytes(unsigned nodes, unsigned channels) {
+    return nodes * (3 + BUS_HEADER + 4 + 2 * channels) + 3 + BUS_COMMIT_LENGTH;
+}
+
+// A whole cycle: the host's frames, a turnaround, then a slot per node. The
+// last slot ends a turnaround after the latest possible reply, so the next
+// cycle can start straight away.
+constexpr uint32_t bus_cycle_us(unsigned nodes, unsigned channels, unsigned baud) {
+    return bus_bytes_us(bus_downlink_bytes(nodes, channels), baud) + BUS_TURNAROUND_US + nodes * bus_slot_us(baud);
+}
+
+// CRC-16/CCITT lookup table, generated at compile time
+struct Crc16Table {
+    uint16_t entries[256];
+    constexpr Crc16Table() : entries() {
+        for (unsigned i = 0; i < 256; i++) {
+            uint16_t crc = (uint16_t)(i << 8);
+            for (int bit = 0; bit < 8; bit++) {
+                crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+            }
+            entries[i] = crc;
+        }
+    }
+};
+
+// Read for every byte of a checked frame, so it goes to SRAM with the hot path.
+// Inline, so every file shares one copy.
+inline constexpr Crc16Table HOT_SHARED_DATA(crc16_table) CRC16_TABLE;
+constexpr uint16_t CRC16_INIT = 0xFFFF;
+
+inline uint16_t crc16_update(uint16_t crc, uint8_t byte) {
+    return (uint16_t)((crc << 8) ^ CRC16_TABLE.entries[((crc >> 8) ^ byte) & 0xFF]);
+}
+
+inline uint16_t crc16(const uint8_t* data, unsigned length, uint16_t crc = CRC16_INIT) {
+    for (unsigned i = 0; i < length; i++) {
+        crc = crc16_update(crc, data[i]);
+    }
+    return crc;
+}
+
+// XOR checksum for ASCII lines
+inline uint8_t line_checksum(const char* text, unsigned length) {
+    uint8_t sum = 0;
+    for (unsigned i = 0; i < length; i++) {
+        sum ^= (uint8_t)text[i];
+    }
+    return sum;
+}
+
+inline uint16_t get_u16(const uint8_t* data) {
+    return data[0] | (data[1] << 8);
+}
+
+inline uint32_t get_u32(const uint8_t* data) {
+    return data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+inline uint64_t get_u64(const uint8_t* data) {
+    return get_u32(data) | ((uint64_t)get_u32(data + 4) << 32);
+}
+
+inline void put_u16(uint8_t* data, uint16_t value) {
+    data[0] = (uint8_t)value;
+    data[1] = (uint8_t)(value >> 8);
+}
+
+inline void put_u32(uint8_t* data, uint32_t value) {
+    put_u16(data, (uint16_t)value);
+    put_u16(data + 2, (uint16_t)(value >> 16));
+}
+
+inline void put_u64(uint8_t* data, uint64_t value) {
+    put_u32(data, (uint32_t)value);
+    put_u32(data + 4, (uint32_t)(value >> 32));
+}
+
+} // namespace protocol
@@ -0,0 +1,190 @@
+#include "pulse_kernel.hpp"
+
+#include <cstring>
+
+#include "hot_path.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PULSE_KERNEL_X86 1
+#endif
+
+HOT_PATH static void computePulsesScalar(const int16_t* positions, const int32_t* scale_q16,
+                                         const uint16_t* centre_q4, uint16_t* pulses, unsigned count) {
+    for (auto i = 0u; i < count; i++) {
+        pulses[i] = pulseFromPosition(positions[i], scale_q16[i], centre_q4[i]);
+    }
+}
+
+HOT_PATH static void interpolatePositionsScalar(const int16_t* a, const int16_t* b, int32_t frac_q16,
+                                                int16_t* out, unsigned count) {
+    for (auto i = 0u; i < count; i++) {
+        out[i] = interpolatePosition(a[i], b[i], frac_q16);
+    }
+}
+
+#ifdef PULSE_KERNEL_X86
+// 32-bit lanes throughout, wrapping like the scalar code's unsigned arithmetic.
+// Results are packed back to 16 bits without saturating, as the scalar casts do.
+
+__attribute__((target("sse4.1")))
+static __m128i pack32to16Sse41(__m128i lo, __m128i hi) {
+    const __m128i low_halves = _mm_set_epi8(-1, -1, -1, -1, -1, -1, -1, -1, 13, 12, 9, 8, 5, 4, 1, 0);
+    lo = _mm_shuffle_epi8(lo, low_halves);
+    hi = _mm_shuffle_epi8(hi, low_halves);
+    return _mm_unpacklo_epi64(lo, hi);
+}
+
+__attribute__((target("sse4.1")))
+static void computePulsesSse41(const int16_t* positions, const int32_t* scale_q16, const uint16_t* centre_q4,
+                               uint16_t* pulses, unsigned count) {
+    const __m128i half = _mm_set1_epi32(0x8000);
+    unsigned i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i p = _mm_loadu_si128((const __m128i*)(positions + i));
+        __m128i c = _mm_loadu_si128((const __m128i*)(centre_q4 + i));
+        __m128i lo = _mm_mullo_epi32(_mm_cvtepi16_epi32(p), _mm_loadu_si128((const __m128i*)(scale_q16 + i)));
+        __m128i hi = _mm_mullo_epi32(_mm_cvtepi16_epi32(_mm_srli_si128(p, 8)),
+                                     _mm_loadu_si128((const __m128i*)(scale_q16 + i + 4)));
+        lo = _mm_add_epi32(_mm_srai_epi32(_mm_add_epi32(lo, half), 16), _mm_cvtepu16_epi32(c));
+        hi = _mm_add_epi32(_mm_srai_epi32(_mm_add_epi32(hi, half), 16), _mm_cvtepu16_epi32(_mm_srli_si128(c, 8)));
+        _mm_storeu_si128((__m128i*)(pulses + i), pack32to16Sse41(lo, hi));
+    }
+    computePulsesScalar(positions + i, scale_q16 + i, centre_q4 + i, pulses + i, count - i);
+}
+
+__attribute__((target("sse4.1")))
+static void interpolatePositionsSse41(const int16_t* a, const int16_t* b, int32_t frac_q16, int16_t* out,
+                                      unsigned count) {
+    const __m128i frac = _mm_set1_epi32(frac_q16);
+    const __m128i half = _mm_set1_epi32(0x8000);
+    unsigned i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i va = _mm_loadu_si128((const __m128i*)(a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i*)(b + i));
+        __m128i a_lo = _mm_cvtepi16_epi32(va);
+        __m128i a_hi = _mm_cvtepi16_epi32(_mm_srli_si128(va, 8));
+        __m128i d_lo = _mm_sub_epi32(_mm_cvtepi16_epi32(vb), a_lo);
+        __m128i d_hi = _mm_sub_epi32(_mm_cvtepi16_epi32(_mm_srli_si128(vb, 8)), a_hi);
+        __m128i lo = _mm_add_epi32(a_lo, _mm_srai_epi32(_mm_add_epi32(_mm_mullo_epi32(d_lo, frac), half), 16));
+        __m128i hi = _mm_add_epi32(a_hi, _mm_srai_epi32(_mm_add_epi32(_mm_mullo_epi32(d_hi, frac), half), 16));
+        _mm_storeu_si128((__m128i*)(out + i), pack32to16Sse41(lo, hi));
+    }
+    interpolatePositionsScalar(a + i, b + i, frac_q16, out + i, count - i);
+}
+
+__attribute__((target("avx2")))
+static __m128i pack32to16Avx2(__m256i v) {
+    const __m256i low_halves = _mm256_set_epi8(
+        -1, -1, -1, -1, -1, -1, -1, -1, 13, 12, 9, 8, 5, 4, 1, 0,
+        -1, -1, -1, -1, -1, -1, -1, -1, 13, 12, 9, 8, 5, 4, 1, 0);
+    v = _mm256_permute4x64_epi64(_mm256_shuffle_epi8(v, low_halves), 0x08);
+    return _mm256_castsi256_si128(v);
+}
+
+__attribute__((target("avx2")))
+static void computePulsesAvx2(const int16_t* positions, const int32_t* scale_q16, const uint16_t* centre_q4,
+                              uint16_t* pulses, unsigned count) {
+    const __m256i half = _mm256_set1_epi32(0x8000);
+    unsigned i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i p = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(positions + i)));
+        __m256i multiplier = _mm256_loadu_si256((const __m256i*)(scale_q16 + i));
+        __m256i centre = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(centre_q4 + i)));
+        p = _mm256_add_epi32(_mm256_srai_epi32(_mm256_add_epi32(_mm256_mullo_epi32(p, multiplier), half), 16), centre);
+        _mm_storeu_si128((__m128i*)(pulses + i), pack32to16Avx2(p));
+    }
+    computePulsesScalar(positions + i, scale_q16 + i, centre_q4 + i, pulses + i, count - i);
+}
+
+__attribute__((target("avx2")))
+static void interpolatePositionsAvx2(const int16_t* a, const int16_t* b, int32_t frac_q16, int16_t* out,
+                                     unsigned count) {
+    const __m256i frac = _mm256_set1_epi32(frac_q16);
+    const __m256i half = _mm256_set1_epi32(0x8000);
+    unsigned i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i va = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(a + i)));
+        __m256i vb = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(b + i)));
+        __m256i delta = _mm256_sub_epi32(vb, va);
+        __m256i v = _mm256_add_epi32(va, _mm256_srai_epi32(_mm256_add_epi32(_mm256_mullo_epi32(delta, frac), half), 16));
+        _mm_storeu_si128((__m128i*)(out + i), pack32to16Avx2(v));
+    }
+    interpolatePositionsScalar(a + i, b + i, frac_q16, out + i, count - i);
+}
+#endif
+
+struct PulseKernel {
+    const char* name;
+    void (*compute)(const int16_t*, const int32_t*, const uint16_t*, uint16_t*, unsigned);
+    void (*interpolate)(const int16_t*, const int16_t*, int32_t, int16_t*, unsigned);
+    bool (*supported)();
+};
+
+static bool alwaysSupported() {
+    return true;
+}
+
+#ifdef PULSE_KERNEL_X86
+static bool sse41Supported() {
+    return __builtin_cpu_supports("sse4.1");
+}
+
+static bool avx2Supported() {
+    return __builtin_cpu_supports("avx2");
+}
+#endif
+
+// Best first
+static const PulseKernel pulse_kernels[] = {
+#ifdef PULSE_KERNEL_X86
+    {"avx2", computePulsesAvx2, interpolatePositionsAvx2, avx2Supported},
+    {"sse4.1", computePulsesSse41, interpolatePositionsSse41, sse41Supported},
+#endif
+    {"scalar", computePulsesScalar, interpolatePositionsScalar, alwaysSupported},
+};
+
+static const PulseKernel* bestPulseKernel() {
+    for (const PulseKernel& kernel : pulse_kernels) {
+        if (kernel.supported()) {
+            return &kernel;
+        }
+    }
+    return &pulse_kernels[0];
+}
+
+static const PulseKernel* pulse_kernel = bestPulseKernel();
+
+// Without a choice of kernels the board calls the scalar code directly,
+// rather than through the table (which stays in flash)
+HOT_PATH void computePulses(const int16_t* positions, const int32_t* scale_q16, const uint16_t* centre_q4,
+                            uint16_t* pulses, unsigned count) {
+#ifdef PULSE_KERNEL_X86
+    pulse_kernel->compute(positions, scale_q16, centre_q4, pulses, count);
+#else
+    computePulsesScalar(positions, scale_q16, centre_q4, pulses, count);
+#endif
+}
+
+HOT_PATH void interpolatePositions(const int16_t* a, const int16_t* b, int32_t frac_q16, int16_t* out,
+                                   unsigned count) {
+#ifdef PULSE_KERNEL_X86
+    pulse_kernel->interpolate(a, b, frac_q16, out, count);
+#else
+    interpolatePositionsScalar(a, b, frac_q16, out, count);
+#endif
+}
+
+const char* pulseKernelName() {
+    return pulse_kernel->name;
+}
+
+bool selectPulseKernel(const char* name) {
+    for (const PulseKernel& kernel : pulse_kernels) {
+        if (strcmp(kernel.name, name) == 0 && kernel.supported()) {
+            pulse_kernel = &kernel;
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include <cstdint>
+
+/*
+Control tick kernel
+
+Maps joint positions to servo pulse widths, and interpolates positions
+between keyframes, for a batch of channels using integer arithmetic only.
+Arrays are structure-of-arrays (one value per channel, channels contiguous),
+so a caller can pass one hand or many hands back to back.
+
+The board runs the scalar code. On x86 hosts the batch functions pick an
+SSE4.1 or AVX2 version at run time; these give bit-identical results, so a
+simulation produces exactly the pulses the board would.
+*/
+
+// Pulse widths are fixed point, 1/16 µs
+const int PULSE_FRAC_BITS = 4;
+const int32_t PULSE_CENTRE_Q4 = 1500 << PULSE_FRAC_BITS;    // 0°
+// 500 µs per 140°, in Q4 µs per degree as a 16.16 multiplier
+const int32_t PULSE_PER_DEGREE_Q16 = 3744914;                // round(500 * 16 / 140 * 65536)
+
+// Pulse width for a position in degrees, given a channel's calibration (the
+// pulse at 0° and the Q16 pulse per degree). Wraps (never traps) outside ±4000°.
+inline uint16_t pulseFromPosition(int32_t position, int32_t scale_q16 = PULSE_PER_DEGREE_Q16,
+                                  int32_t centre_q4 = PULSE_CENTRE_Q4) {
+    uint32_t scaled = (uint32_t)position * (uint32_t)scale_q16 + 0x8000;
+    return (uint16_t)(centre_q4 + ((int32_t)scaled >> 16));
+}
+
+// Q16 multiplier for a servo that moves range_us per 140°
+inline int32_t pulseScaleForRange(int32_t range_us) {
+    return (int32_t)(((int64_t)range_us * (16 << 16) + 70) / 140);
+}
+
+// a + (b - a) * frac_q16 / 65536, rounded to the nearest degree (halves up)
+inline int16_t interpolatePosition(int32_t a, int32_t b, int32_t frac_q16) {
+    uint32_t scaled = (uint32_t)(b - a) * (uint32_t)frac_q16 + 0x8000;
+    return (int16_t)(a + ((int32_t)scaled >> 16));
+}
+
+// Fraction of span_us elapsed after into_us, for interpolatePositions (0 ≤ into_us < span_us)
+inline int32_t interpolationFraction(uint32_t into_us, uint32_t span_us) {
+    return (int32_t)(((uint64_t)into_us << 16) / span_us);
+}
+
+// pulses[i] = pulseFromPosition(positions[i], scale_q16[i], centre_q4[i])
+void computePulses(const int16_t* positions, const int32_t* scale_q16, const uint16_t* centre_q4,
+                   uint16_t* pulses, unsigned count);
+
+// out[i] = interpolatePosition(a[i], b[i], frac_q16)
+void interpolatePositions(const int16_t* a, const int16_t* b, int32_t frac_q16, int16_t* out, unsigned count);
+
+// Implementation the batch functions use: "scalar", "sse4.1" or "avx2"
+const char* pulseKernelName();
+
+// Use a particular implementation, e.g. to compare them. Returns false if
+// this build or CPU doesn't have it.
+bool selectPulseKernel(const char* name);
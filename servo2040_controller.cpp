@@ -2,25 +2,59 @@
 #include <stdio.h>
 #include <cstring>
 #include <cstdlib>
+#include <new>
+#include <malloc.h>
 #include "pico/stdlib.h"
+#include "hardware/flash.h"
+#include "hardware/sync.h"
+#include "hardware/gpio.h"
+#include "hardware/pwm.h"
+#include "hardware/timer.h"
+#include "hardware/dma.h"
+#include "hardware/structs/systick.h"
+#include "hardware/structs/xip_ctrl.h"
 
 #include "servo2040.hpp"
 #include "button/button.hpp"
+#include "protocol.hpp"
+#include "controller_core.hpp"
+#include "deferred_log.hpp"
+#include "expansion_link.hpp"
+#include "hot_path.hpp"
+#include "uart_link.hpp"
+#include "usb_link.hpp"
 
 /*
 Servo2040 Multi-Servo Controller
 Converted from ESP32/PCA9685 to RP2040/Servo2040
 With simple LED indication
+
+Command handling lives in controller_core.cpp, the USB device in
+usb_link.cpp, the UART link in uart_link.cpp and PCA9685 expansion boards in
+expansion_link.cpp; this file provides the board side of the core (servos,
+flash, sync line, alarm, DMA) and the LEDs.
+
+Nothing is allocated on the heap: every object and buffer is static and sized
+at build time (M prints the breakdown).
 */
 
+// Keep it that way
+#pragma GCC poison malloc calloc realloc free strdup
+
 using namespace servo;
 using namespace plasma;
 using namespace pimoroni;
+using namespace protocol;
 
 // Constants
-const uint NUM_SERVOS = 18; // Servo2040 supports up to 18 servos
-const int MIN_ANGLE = -140; // Minimum servo angle in degrees
-const int MAX_ANGLE = 140;  // Maximum servo angle in degrees
+// NUM_BOARD_SERVOS (18) comes from controller_core.hpp; channels after them
+// are on expansion boards
+static_assert(NUM_BOARD_SERVOS == servo2040::NUM_SERVOS, "Protocol channel count must match the board");
+// The expansion bus and the UART link share the Qw/ST pins
+#if SERVO2040_UART_BAUD && SERVO2040_EXPANSION_CHANNELS
+#error "SERVO2040_UART_BAUD and SERVO2040_EXPANSION_CHANNELS both need the Qw/ST connector"
+#endif
+// MIN_ANGLE/MAX_ANGLE (-140° to 140°) come from protocol.hpp
 
 // LED constants
 const uint UPDATES = 50;    // How many times the LEDs will be updated per second
@@ -31,20 +65,24 @@ const uint READY_LED = 0;    // First LED (green when ready)
 const uint COMMAND_LED = 1;  // Second LED (flashes when commands received)
 const uint NUM_LEDS = servo2040::NUM_LEDS; // Total number of LEDs (6)
 
-// Track current positions in degrees
-int currentPositions[NUM_SERVOS];
+// Servo objects, constructed in setup() into static storage. They sit back
+// to back, so servoAt(s) is an index rather than a pointer to chase.
+alignas(Servo) uint8_t servo_storage[NUM_BOARD_SERVOS][sizeof(Servo)];
 
-// Servo objects array
-Servo *servos[NUM_SERVOS];
+inline Servo& servoAt(unsigned s) {
+    return *std::launder(reinterpret_cast<Servo*>(servo_storage[s]));
+}
 
-// Create the LED bar, using PIO 1 and State Machine 0
-WS2812 led_bar(NUM_LEDS, pio1, 0, servo2040::LED_DATA);
+// Create the LED bar, using PIO 1 and State Machine 0, with a static buffer
+WS2812::RGB led_buffer[NUM_LEDS];
+WS2812 led_bar(NUM_LEDS, pio1, 0, servo2040::LED_DATA, WS2812::DEFAULT_SERIAL_FREQ, false,
+               WS2812::COLOR_ORDER::GRB, led_buffer);
 
 // Create the user button
 Button user_sw(servo2040::USER_SW);
 
 // Available servo pins on Servo2040
-const uint servo_pins[NUM_SERVOS] = {
+const uint servo_pins[NUM_BOARD_SERVOS] = {
     servo2040::SERVO_1,  servo2040::SERVO_2,  servo2040::SERVO_3,  servo2040::SERVO_4,
     servo2040::SERVO_5,  servo2040::SERVO_6,  servo2040::SERVO_7,  servo2040::SERVO_8,
     servo2040::SERVO_9,  servo2040::SERVO_10, servo2040::SERVO_11, servo2040::SERVO_12,
@@ -52,17 +90,191 @@ const uint servo_pins[NUM_SERVOS] = {
     servo2040::SERVO_17, servo2040::SERVO_18
 };
 
+// Pose library storage
+// Poses live in the last sector of flash so they survive a power cycle.
+const uint32_t POSE_FLASH_OFFSET = PICO_FLASH_SIZE_BYTES - FLASH_SECTOR_SIZE;
+
+// Flash programming works in whole pages
+const uint POSE_TABLE_FLASH_SIZE = (sizeof(PoseTable) + FLASH_PAGE_SIZE - 1) / FLASH_PAGE_SIZE * FLASH_PAGE_SIZE;
+static_assert(POSE_TABLE_FLASH_SIZE <= FLASH_SECTOR_SIZE, "Pose table must fit in one flash sector");
+
+// Frame copy path
+// Binary payloads are copied out of the RX ring either by the CPU (with the
+// table-driven CRC) or by DMA, with the DMA sniffer computing the CRC-16 as the
+// bytes go past. A DMA copy runs in the background: the core's parser waits
+// for it on its next pass (ringCopyDone) while the main loop carries on with
+// the trajectory. DMA only pays for its setup on longer runs. D1/D0 switch it
+// at run time and B benchmarks both paths.
+const uint DMA_COPY_MIN = 16;        // Shorter copies always use the CPU
+const uint BENCHMARK_ROUNDS = 64;
+
+enum CopyPath { COPY_CPU, COPY_DMA, NUM_COPY_PATHS };
+
+struct CopyStats {
+    uint32_t copies;
+    uint32_t bytes;
+    uint32_t cycles;                 // CPU cycles spent, starting and finishing DMA copies
+    uint32_t busy;                   // Parser passes that found the DMA copy still running
+};
+
+bool use_dma_copy = true;
+int copy_dma_channel = -1;           // -1 if DMA failed its self test
+dma_channel_config copy_ring_config; // Reads wrap around the RX ring
+dma_channel_config copy_linear_config;
+CopyStats copy_stats[NUM_COPY_PATHS] = {};
+
+// Multi-board synchronisation
+// Boards share a sync line on the A0 header (plus ground). The master pulses
+// it and every board commits its staged frame from the rising-edge interrupt,
+// within a few µs of each other.
+const uint SYNC_PIN = servo2040::ADC0;
+const uint SYNC_PULSE_US = 10;
+
+// Hardware alarm for scheduled frames
+int schedule_alarm = -1;
+
+// Hot path placement (see hot_path.hpp)
+// The XIP cache counters are 32 bits, so every pass of the main loop reads
+// and clears them into these totals. The control loop's share is sampled
+// around core.poll(), interrupts taken meanwhile included; with the hot path
+// in SRAM it should show no misses.
+const char* const HOT_PATH_PLACEMENTS[] = {"flash", "SRAM (hot path)", "SRAM (whole image)"};
+
+struct XipStats {
+    uint64_t accesses;
+    uint64_t hits;
+    uint64_t loop_accesses;
+    uint64_t loop_hits;
+    uint32_t loop_passes;
+    uint32_t loop_passes_missed;  // Passes that waited on flash at least once
+};
+
+XipStats xip_stats = {};
+
+// Host link
+// Input is read from USB and the UART (if it is on), staying with one while
+// it has bytes. Replies, telemetry and console output go back on the link
+// the host last sent on. SERVO2040_UART_BAUD starts the UART at boot.
+//
+// On an RS-485 bus (N<node>) the UART is never the host link: the core
+// answers on the bus itself (busTransmit), and the console stays on USB.
+// SERVO2040_BUS_NODE joins a bus at boot. The transceiver's DE pin is A1.
+#ifndef SERVO2040_UART_BAUD
+#define SERVO2040_UART_BAUD 0
+#endif
+#ifndef SERVO2040_BUS_NODE
+#define SERVO2040_BUS_NODE 0
+#endif
+
+const uint BUS_DE_PIN = servo2040::ADC1;
+
+enum HostLink { LINK_USB, LINK_UART };
+
+HostLink host_link = LINK_USB;
+HostLink input_link = LINK_USB;     // Where readByte() is reading from
+bool bus_mode = false;
+
+void setHostLink(HostLink link) {
+    host_link = link;
+    uartConsole(link == LINK_UART);
+}
+
+// Deferred log records (V2), sent as FRAME_LOG on the console stream once per
+// main-loop pass. A site's ID is its format string's offset in the
+// servo2040_log section, which the build extracts to servo2040_controller.logstr.
+extern "C" const char __start_servo2040_log[];
+LogRing log_ring;
+
+void flushDeferredLog() {
+    uint8_t frame[3 + MAX_FRAME_PAYLOAD];
+    while (unsigned length = log_ring.takeFrame(frame + 3)) {
+        frame[0] = FRAME_SYNC;
+        frame[1] = FRAME_LOG;
+        frame[2] = (uint8_t)length;
+        if (host_link == LINK_UART) {
+            uartWrite(frame, 3 + length);
+        } else {
+            usbWrite(USB_LOG, frame, 3 + length);
+        }
+    }
+}
+
+#if SERVO2040_RAM_HOT_PATH == 1
+// Servo outputs written straight to the PWM compare registers, as
+// Servo::pulse() does but without its float maths (which runs from flash).
+// The scale comes from each slice's wrap and the servo frequency, and gives
+// the same level as the driver to within one count.
+struct PwmOutput {
+    uint slice;
+    uint channel;
+    uint32_t level_scale_q16;  // PWM counts per 1/16 µs
+    uint16_t pulse_q4;         // Last pulse written, for servoValue()
+};
+
+PwmOutput pwm_outputs[NUM_BOARD_SERVOS];
+#endif
+
+// Heap guard
+// The SDK may use the heap while setup() runs; after that the heap is sealed.
+// newlib calls __malloc_lock() on every malloc, free and realloc, so any heap
+// use after init is counted and reported from the main loop. Set from CMake:
+// 0 = off, 1 = count and report, 2 = panic on the spot.
+#ifndef SERVO2040_HEAP_GUARD
+#define SERVO2040_HEAP_GUARD 1
+#endif
+
+volatile bool heap_sealed = false;
+volatile uint32_t heap_calls_after_init = 0;
+uint32_t heap_calls_reported = 0;
+
+#if SERVO2040_HEAP_GUARD
+extern "C" void __malloc_lock(struct _reent* reent) {
+    (void)reent;
+    if (heap_sealed) {
+#if SERVO2040_HEAP_GUARD >= 2
+        panic("Heap used after init");
+#endif
+        heap_calls_after_init++;
+    }
+}
+
+extern "C" void __malloc_unlock(struct _reent* reent) {
+    (void)reent;
+}
+#endif
+
+// mallinfo() takes the malloc lock too, so don't count it
+struct mallinfo heapInfo() {
+    bool sealed = heap_sealed;
+    heap_sealed = false;
+    struct mallinfo info = mallinfo();
+    heap_sealed = sealed;
+    return info;
+}
+
+void reportHeapUse() {
+    uint32_t calls = heap_calls_after_init;
+    if (calls != heap_calls_reported) {
+        printf("Heap used after init: %lu malloc/free calls so far\n", (unsigned long)calls);
+        heap_calls_reported = calls;
+    }
+}
+
+// RAM layout from the linker script
+extern "C" char __data_start__[], __data_end__[], __bss_start__[], __bss_end__[];
+extern "C" char end[], __StackLimit[], __StackTop[], __StackBottom[];
+
 // Set LED indicators to their default state
 void setDefaultLEDs() {
     // Clear all LEDs
     led_bar.clear();
-    
+
     // Set first LED to green to indicate ready status
     led_bar.set_rgb(READY_LED, 0, 64, 0);
-    
+
     // Turn off command LED
     led_bar.set_rgb(COMMAND_LED, 0, 0, 0);
-    
+
     // Remaining LEDs can be turned off
     for (auto i = 2u; i < NUM_LEDS; i++) {
         led_bar.set_rgb(i, 0, 0, 0);
@@ -73,91 +285,593 @@ void setDefaultLEDs() {
 void flashCommandLED() {
     // Flash the command LED blue
     led_bar.set_rgb(COMMAND_LED, 0, 0, 128);
-    
+
     // Schedule it to turn off after a short time (will be handled in main loop)
 }
 
+// Restart all servo PWM counters together so every board's periods line up
+void alignPwmPhase() {
+    uint32_t slice_mask = 0;
+    for (auto s = 0u; s < NUM_BOARD_SERVOS; s++) {
+        slice_mask |= 1u << pwm_gpio_to_slice_num(servo_pins[s]);
+    }
+    pwm_set_mask_enabled(0);
+    for (auto slice = 0u; slice < NUM_PWM_SLICES; slice++) {
+        if (slice_mask & (1u << slice)) {
+            pwm_set_counter(slice, 0);
+        }
+    }
+    pwm_set_mask_enabled(slice_mask);
+}
+
+// SysTick as a free-running 24-bit down-counter of CPU cycles
+void initCycleCounter() {
+    systick_hw->rvr = 0x00FFFFFF;
+    systick_hw->cvr = 0;
+    systick_hw->csr = 0x5;  // Enable, processor clock
+}
+
+HOT_PATH uint32_t cycleCount() {
+    return systick_hw->cvr;
+}
+
+HOT_PATH uint32_t cyclesSince(uint32_t start) {
+    return (start - cycleCount()) & 0x00FFFFFF;
+}
+
+// time_us_64() lives in flash; this is the same read of the raw timer
+HOT_PATH uint64_t timerUs() {
+    uint32_t high = timer_hw->timerawh;
+    for (;;) {
+        uint32_t low = timer_hw->timerawl;
+        uint32_t next_high = timer_hw->timerawh;
+        if (next_high == high) {
+            return (uint64_t)high << 32 | low;
+        }
+        high = next_high;
+    }
+}
+
+// Read and clear the XIP cache counters
+HOT_PATH void collectXipCounters(bool control_loop) {
+    // Hits first, so a flash access in between can't make hits exceed accesses
+    uint32_t hits = xip_ctrl_hw->ctr_hit;
+    uint32_t accesses = xip_ctrl_hw->ctr_acc;
+    xip_ctrl_hw->ctr_hit = 0;
+    xip_ctrl_hw->ctr_acc = 0;
+    xip_stats.accesses += accesses;
+    xip_stats.hits += hits;
+    if (control_loop) {
+        xip_stats.loop_accesses += accesses;
+        xip_stats.loop_hits += hits;
+        xip_stats.loop_passes++;
+        if (accesses != hits) {
+            xip_stats.loop_passes_missed++;
+        }
+    }
+}
+
+#if SERVO2040_RAM_HOT_PATH == 1
+void initPwmOutputs() {
+    for (auto s = 0u; s < NUM_BOARD_SERVOS; s++) {
+        PwmOutput& out = pwm_outputs[s];
+        out.slice = pwm_gpio_to_slice_num(servo_pins[s]);
+        out.channel = pwm_gpio_to_channel(servo_pins[s]);
+        float counts_per_us = (pwm_hw->slice[out.slice].top + 1) * servoAt(s).frequency() / 1000000.0f;
+        out.level_scale_q16 = (uint32_t)(counts_per_us / 16 * 65536 + 0.5f);
+        out.pulse_q4 = PULSE_CENTRE_Q4;
+    }
+}
+
+HOT_PATH void writePwmOutput(unsigned s, uint16_t pulse_q4) {
+    PwmOutput& out = pwm_outputs[s];
+    out.pulse_q4 = pulse_q4;
+    pwm_set_chan_level(out.slice, out.channel, (uint16_t)((pulse_q4 * out.level_scale_q16) >> 16));
+}
+
+HOT_PATH void setBoardPulse(unsigned s, uint16_t pulse_q4) {
+    writePwmOutput(s, pulse_q4);
+}
+
+// The Servo objects don't see direct writes, so map the pulse back through their calibration
+float boardServoValue(unsigned s) {
+    Calibration& cal = servoAt(s).calibration();
+    float pulse = pwm_outputs[s].pulse_q4 / 16.0f;
+    return cal.first_value() + (pulse - cal.first_pulse()) * (cal.last_value() - cal.first_value()) /
+                                   (cal.last_pulse() - cal.first_pulse());
+}
+#else
+void setBoardPulse(unsigned s, uint16_t pulse_q4) {
+    servoAt(s).pulse(pulse_q4 / 16.0f);
+}
+
+float boardServoValue(unsigned s) {
+    return servoAt(s).value();
+}
+#endif
+
+// Start a DMA copy, the sniffer carrying on the CRC from crc. The result is
+// in the sniffer's accumulator once the channel is no longer busy.
+HOT_PATH void startDmaCopy(const uint8_t* src, uint8_t* dst, uint count, uint16_t crc, bool ring) {
+    dma_channel_set_config(copy_dma_channel, ring ? &copy_ring_config : &copy_linear_config, false);
+    dma_sniffer_set_data_accumulator(crc);
+    dma_channel_set_read_addr(copy_dma_channel, src, false);
+    dma_channel_set_write_addr(copy_dma_channel, dst, false);
+    dma_channel_set_trans_count(copy_dma_channel, count, true);
+}
+
+// Copy with DMA and wait for it, for the self test and the benchmark
+HOT_PATH uint16_t dmaCopy(const uint8_t* src, uint8_t* dst, uint count, uint16_t crc, bool ring) {
+    startDmaCopy(src, dst, count, crc, ring);
+    dma_channel_wait_for_finish_blocking(copy_dma_channel);
+    return (uint16_t)dma_sniffer_get_data_accumulator();
+}
+
+// Claim a DMA channel for frame copies and check the sniffer's CRC against
+// the software one before trusting it
+void initFrameCopy() {
+    initCycleCounter();
+
+    copy_dma_channel = dma_claim_unused_channel(false);
+    if (copy_dma_channel < 0) {
+        return;
+    }
+    uint ring_bits = 0;
+    while ((1u << ring_bits) < RX_RING_SIZE) {
+        ring_bits++;
+    }
+    copy_linear_config = dma_channel_get_default_config(copy_dma_channel);
+    channel_config_set_transfer_data_size(&copy_linear_config, DMA_SIZE_8);
+    channel_config_set_read_increment(&copy_linear_config, true);
+    channel_config_set_write_increment(&copy_linear_config, true);
+    channel_config_set_sniff_enable(&copy_linear_config, true);
+    copy_ring_config = copy_linear_config;
+    channel_config_set_ring(&copy_ring_config, false, ring_bits);
+    dma_sniffer_enable(copy_dma_channel, DMA_SNIFF_CTRL_CALC_VALUE_CRC16, true);  // CRC-16-CCITT
+
+    static const uint8_t test[] = "123456789";
+    uint8_t scratch[sizeof(test)];
+    if (dmaCopy(test, scratch, 9, CRC16_INIT, false) != crc16(test, 9)) {
+        printf("DMA CRC self test failed, using CPU copies\n");
+        copy_dma_channel = -1;
+    }
+}
+
+// Time copy + CRC of a full-size payload on both paths
+void benchmarkFrameCopy() {
+    static uint8_t src[MAX_FRAME_PAYLOAD];
+    static uint8_t dst[MAX_FRAME_PAYLOAD];
+    for (auto i = 0u; i < MAX_FRAME_PAYLOAD; i++) {
+        src[i] = (uint8_t)(i * 7 + 3);
+    }
+
+    uint32_t start = cycleCount();
+    uint16_t cpu_crc = 0;
+    for (auto r = 0u; r < BENCHMARK_ROUNDS; r++) {
+        cpu_crc = cpuCopy(src, 0, 0xFFFFFFFF, dst, MAX_FRAME_PAYLOAD, CRC16_INIT, true);
+    }
+    uint32_t cpu_cycles = cyclesSince(start) / BENCHMARK_ROUNDS;
+    printf("Copy+CRC of %d bytes: CPU %lu cycles", MAX_FRAME_PAYLOAD, (unsigned long)cpu_cycles);
+
+    if (copy_dma_channel < 0) {
+        printf(", DMA unavailable\n");
+        return;
+    }
+    start = cycleCount();
+    uint16_t dma_crc = 0;
+    for (auto r = 0u; r < BENCHMARK_ROUNDS; r++) {
+        dma_crc = dmaCopy(src, dst, MAX_FRAME_PAYLOAD, CRC16_INIT, false);
+    }
+    uint32_t dma_cycles = cyclesSince(start) / BENCHMARK_ROUNDS;
+    printf(", DMA %lu cycles, CRCs %s\n", (unsigned long)dma_cycles,
+           cpu_crc == dma_crc ? "match" : "DIFFER");
+}
+
+void syncEdgeCallback(uint gpio, uint32_t events);
+void scheduleAlarmCallback(uint alarm_num);
+
+// The Servo2040 side of the controller core
+class BoardHal : public ControllerHal {
+public:
+    HOT_PATH uint64_t timeUs() override {
+        return timerUs();
+    }
+
+    // Whichever link, and USB interface, has input (see usb_link.hpp)
+    HOT_PATH int readByte() override {
+        int c = input_link == LINK_UART ? uartReadByte() : usbReadByte();
+        if (c < 0) {
+            HostLink other = input_link == LINK_UART ? LINK_USB : LINK_UART;
+            c = other == LINK_UART ? uartReadByte() : usbReadByte();
+            if (c >= 0) {
+                input_link = other;
+                if (!bus_mode) {
+                    setHostLink(other);
+                }
+            }
+        }
+        return c;
+    }
+
+    // An idle UART line ends a frame (see uart_link.hpp)
+    HOT_PATH uint64_t frameTimeoutUs() override {
+        return input_link == LINK_UART ? UART_IDLE_US : RX_FRAME_TIMEOUT_US;
+    }
+
+    // Raw, without CR/LF translation, on the link and interface the host sends on
+    void write(const uint8_t* data, unsigned length) override {
+        if (host_link == LINK_UART) {
+            uartWrite(data, length);
+        } else {
+            usbWrite(USB_REPLY, data, length);
+        }
+    }
+
+    // The UART link has no reply reserve; its output ring drops what doesn't fit
+    HOT_PATH bool replyRoom() override {
+        return host_link == LINK_UART || usbReplyRoom();
+    }
+
+    // On the telemetry port once a host has it open
+    void writeTelemetry(const uint8_t* data, unsigned length) override {
+        if (host_link == LINK_UART) {
+            uartWrite(data, length);
+        } else {
+            usbWrite(USB_TELEMETRY, data, length);
+        }
+    }
+
+    void vprint(const char* format, va_list args) override {
+        vprintf(format, args);
+    }
+
+    HOT_PATH void logRecord(const char* site, const uint32_t* words, unsigned count) override {
+        log_ring.record((uint16_t)(site - __start_servo2040_log), (uint32_t)timerUs(), words, count);
+    }
+
+    // Channels past the board's own are staged for the expansion boards,
+    // which are written after the board's outputs
+    HOT_PATH void setPulse(unsigned channel, uint16_t pulse_q4) override {
+        if (channel >= NUM_BOARD_SERVOS) {
+            uint16_t pulses_q4[NUM_SERVOS];
+            pulses_q4[channel] = pulse_q4;
+            expansionStage(pulses_q4 + NUM_BOARD_SERVOS, 1u << (channel - NUM_BOARD_SERVOS));
+            return;
+        }
+        setBoardPulse(channel, pulse_q4);
+    }
+
+    HOT_PATH void setPulses(const uint16_t* pulses_q4, uint32_t mask) override {
+        for (auto s = 0u; s < NUM_BOARD_SERVOS; s++) {
+            if (mask & (1u << s)) {
+                setBoardPulse(s, pulses_q4[s]);
+            }
+        }
+        if (NUM_EXPANSION_CHANNELS > 0 && (mask >> NUM_BOARD_SERVOS) != 0) {
+            expansionStage(pulses_q4 + NUM_BOARD_SERVOS, mask >> NUM_BOARD_SERVOS);
+        }
+    }
+
+    // Expansion outputs have no calibration of their own, so their pulse maps
+    // back through the default one
+    float servoValue(unsigned channel) override {
+        if (channel >= NUM_BOARD_SERVOS) {
+            return ((int)expansionPulse(channel - NUM_BOARD_SERVOS) - PULSE_CENTRE_Q4) * (float)MAX_ANGLE /
+                   (500 << PULSE_FRAC_BITS);
+        }
+        return boardServoValue(channel);
+    }
+
+    HOT_PATH uint32_t cycleCount() override {
+        return ::cycleCount();
+    }
+
+    HOT_PATH uint32_t cyclesSince(uint32_t start) override {
+        return ::cyclesSince(start);
+    }
+
+    bool loadPoses(PoseTable& table) override {
+        memcpy(&table, (const void*)(XIP_BASE + POSE_FLASH_OFFSET), sizeof(PoseTable));
+        return true;
+    }
+
+    void storePoses(const PoseTable& table) override {
+        static uint8_t page_buffer[POSE_TABLE_FLASH_SIZE];
+        memset(page_buffer, 0xFF, sizeof(page_buffer));
+        memcpy(page_buffer, &table, sizeof(PoseTable));
+
+        // Nothing may run from flash while it is being erased/programmed
+        uint32_t ints = save_and_disable_interrupts();
+        flash_range_erase(POSE_FLASH_OFFSET, FLASH_SECTOR_SIZE);
+        flash_range_program(POSE_FLASH_OFFSET, page_buffer, sizeof(page_buffer));
+        restore_interrupts(ints);
+    }
+
+    HOT_PATH uint32_t disableInterrupts() override {
+        return save_and_disable_interrupts();
+    }
+
+    HOT_PATH void restoreInterrupts(uint32_t state) override {
+        restore_interrupts(state);
+    }
+
+    void setBusMode(bool on) override {
+        bus_mode = on;
+        uartBusMode(on ? (int)BUS_DE_PIN : -1);
+        if (on && host_link == LINK_UART) {
+            setHostLink(LINK_USB);
+        }
+        if (on && uartStats().baud == 0) {
+            printf("UART link is off, start it with U<baud>\n");
+        }
+    }
+
+    HOT_PATH void busTransmit(const uint8_t* data, unsigned length, uint64_t at_us) override {
+        uartBusSend(data, length, at_us);
+    }
+
+    void setSyncRole(SyncRole role) override {
+        gpio_set_irq_enabled(SYNC_PIN, GPIO_IRQ_EDGE_RISE, false);
+        gpio_init(SYNC_PIN);
+        if (role == SYNC_MASTER) {
+            gpio_set_dir(SYNC_PIN, GPIO_OUT);
+            gpio_put(SYNC_PIN, false);
+        } else {
+            gpio_set_dir(SYNC_PIN, GPIO_IN);
+            gpio_pull_down(SYNC_PIN);
+        }
+        // The master commits from its own edge too, so both boards see the same latency
+        if (role != SYNC_OFF) {
+            gpio_set_irq_enabled_with_callback(SYNC_PIN, GPIO_IRQ_EDGE_RISE, true, &syncEdgeCallback);
+        }
+    }
+
+    void pulseSyncLine() override {
+        gpio_put(SYNC_PIN, true);
+        busy_wait_us_32(SYNC_PULSE_US);
+        gpio_put(SYNC_PIN, false);
+    }
+
+    void alignPwmPhase() override {
+        ::alignPwmPhase();
+    }
+
+    // hardware_alarm_set_target returns true if the time has already passed
+    bool setAlarm(uint64_t time_us) override {
+        return hardware_alarm_set_target(schedule_alarm, from_us_since_boot(time_us));
+    }
+
+    void cancelAlarm() override {
+        hardware_alarm_cancel(schedule_alarm);
+    }
+
+    HOT_PATH uint16_t copyFromRing(const uint8_t* ring, unsigned index, unsigned mask, uint8_t* dst,
+                                   unsigned count, uint16_t crc, bool with_crc) override {
+        uint32_t start = cycleCount();
+        crc = cpuCopy(ring, index, mask, dst, count, crc, with_crc);
+
+        CopyStats& stats = copy_stats[COPY_CPU];
+        stats.copies++;
+        stats.bytes += count;
+        stats.cycles += cyclesSince(start);
+        return crc;
+    }
+
+    // Long copies go to DMA, when it is on and passed its self test
+    HOT_PATH bool startRingCopy(const uint8_t* ring, unsigned index, unsigned mask, uint8_t* dst,
+                                unsigned count, uint16_t crc) override {
+        if (!use_dma_copy || copy_dma_channel < 0 || count < DMA_COPY_MIN) {
+            return false;
+        }
+        uint32_t start = cycleCount();
+        startDmaCopy(&ring[index & mask], dst, count, crc, true);
+
+        CopyStats& stats = copy_stats[COPY_DMA];
+        stats.copies++;
+        stats.bytes += count;
+        stats.cycles += cyclesSince(start);
+        return true;
+    }
+
+    HOT_PATH bool ringCopyDone(uint16_t& crc) override {
+        CopyStats& stats = copy_stats[COPY_DMA];
+        if (dma_channel_is_busy(copy_dma_channel)) {
+            stats.busy++;
+            return false;
+        }
+        uint32_t start = cycleCount();
+        crc = (uint16_t)dma_sniffer_get_data_accumulator();
+        stats.cycles += cyclesSince(start);
+        return true;
+    }
+
+    bool handleCommand(const char* command) override {
+        switch (command[0]) {
+        case 'D':
+            use_dma_copy = (command[1] != '0');
+            printf("DMA frame copies %s\n", use_dma_copy ? "on" : "off");
+            return true;
+        case 'B':
+            benchmarkFrameCopy();
+            return true;
+        case 'U':
+            if (NUM_EXPANSION_CHANNELS > 0) {
+                printf("No UART link: the Qw/ST connector is the expansion bus\n");
+                return true;
+            }
+            if (command[1] != '?') {
+                uartSetBaud((unsigned)atoi(&command[1]));
+                if (uartStats().baud == 0) {
+                    input_link = LINK_USB;
+                    setHostLink(LINK_USB);
+                }
+            }
+            printf("UART link %s, %u baud\n", uartStats().baud ? "on" : "off", uartStats().baud);
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    void printStats() override {
+        const char* path_names[NUM_COPY_PATHS] = {"CPU", "DMA"};
+        for (auto path = 0u; path < NUM_COPY_PATHS; path++) {
+            const CopyStats& stats = copy_stats[path];
+            printf("Frame copy %s: %lu copies, %lu bytes, %lu CPU cycles/byte", path_names[path],
+                   (unsigned long)stats.copies, (unsigned long)stats.bytes,
+                   (unsigned long)(stats.bytes ? stats.cycles / stats.bytes : 0));
+            if (path == COPY_DMA) {
+                printf(", still running on %lu passes%s", (unsigned long)stats.busy,
+                       copy_dma_channel < 0 ? " (unavailable)" : "");
+            }
+            printf("\n");
+        }
+        const UsbStats& usb = usbStats();
+        const char* interface_names[NUM_USB_INTERFACES] = {"command port", "telemetry port", "commands (bulk)"};
+        for (auto itf = 0u; itf < NUM_USB_INTERFACES; itf++) {
+            printf("USB %s: %lu bytes in, %lu out, %lu dropped, %u queued at most%s\n", interface_names[itf],
+                   (unsigned long)usb.rx_bytes[itf], (unsigned long)usb.tx_bytes[itf],
+                   (unsigned long)usb.tx_dropped[itf], usb.tx_high_water[itf],
+                   usbInterfaceOpen((UsbInterface)itf) ? "" : " (not open)");
+        }
+        printf("USB output dropped: %lu telemetry frames, %lu log bytes, %lu reply bytes; input held %lu times\n",
+               (unsigned long)usb.telemetry_dropped, (unsigned long)usb.log_dropped,
+               (unsigned long)usb.reply_overflows, (unsigned long)usb.input_held);
+        const UartStats& uart = uartStats();
+        printf("UART%s: %u baud, %lu bytes in, %lu out, %lu overrun, %lu dropped, %lu bursts, %u queued at most\n",
+               host_link == LINK_UART ? " (host link)" : "", uart.baud, (unsigned long)uart.rx_bytes,
+               (unsigned long)uart.tx_bytes, (unsigned long)uart.rx_overruns, (unsigned long)uart.tx_dropped,
+               (unsigned long)uart.bursts, uart.tx_high_water);
+        if (bus_mode) {
+            printf("RS-485 bus: %lu frames sent, %lu late, %lu dropped while busy\n", (unsigned long)uart.bus_sends,
+                   (unsigned long)uart.bus_late, (unsigned long)uart.bus_busy);
+        }
+        if (NUM_EXPANSION_CHANNELS > 0) {
+            const ExpansionStats& expansion = expansionStats();
+            printf("Expansion: %u channels on %u boards (%u not answering), %lu updates, %lu writes, %lu bytes, "
+                   "%lu errors, %lu merged\n", NUM_EXPANSION_CHANNELS, expansion.boards, expansion.absent,
+                   (unsigned long)expansion.updates, (unsigned long)expansion.bursts, (unsigned long)expansion.bytes,
+                   (unsigned long)expansion.errors, (unsigned long)expansion.merged);
+            printf("Update latency: board outputs in the tick, expansion outputs %lu µs after (mean %lu, max %lu)\n",
+                   (unsigned long)expansion.latency_last_us,
+                   (unsigned long)(expansion.sent ? expansion.latency_total_us / expansion.sent : 0),
+                   (unsigned long)expansion.latency_max_us);
+        }
+        const LogStats& log = log_ring.stats();
+        printf("Deferred log: %lu records, %lu dropped, %u bytes queued at most\n", (unsigned long)log.records,
+               (unsigned long)log.dropped, log.high_water);
+        uint64_t loop_misses = xip_stats.loop_accesses - xip_stats.loop_hits;
+        printf("XIP cache, code in %s: %llu accesses, %llu misses; control loop %llu accesses, %llu misses, "
+               "%lu of %lu passes missed\n", HOT_PATH_PLACEMENTS[SERVO2040_RAM_HOT_PATH],
+               (unsigned long long)xip_stats.accesses, (unsigned long long)(xip_stats.accesses - xip_stats.hits),
+               (unsigned long long)xip_stats.loop_accesses, (unsigned long long)loop_misses,
+               (unsigned long)xip_stats.loop_passes_missed, (unsigned long)xip_stats.loop_passes);
+    }
+
+    void printMemory() override {
+        struct mallinfo heap = heapInfo();
+        printf("RAM: data %u, bss %u, heap %u in use (arena %u of %u), stack %u bytes\n",
+               (unsigned)(__data_end__ - __data_start__), (unsigned)(__bss_end__ - __bss_start__),
+               (unsigned)heap.uordblks, (unsigned)heap.arena, (unsigned)(__StackLimit - end),
+               (unsigned)(__StackTop - __StackBottom));
+        printf("Board: servos %u, LEDs %u, flash page buffer %u, copy benchmark %u, log ring %u bytes\n",
+               (unsigned)sizeof(servo_storage), (unsigned)(sizeof(led_buffer) + sizeof(led_bar)),
+               POSE_TABLE_FLASH_SIZE, 2 * MAX_FRAME_PAYLOAD, (unsigned)sizeof(log_ring));
+        printf("Heap %s, %lu calls after init\n", heap_sealed ? "sealed" : "not sealed",
+               (unsigned long)heap_calls_after_init);
+    }
+
+    void indicateCommand() override {
+        flashCommandLED();
+    }
+};
+
+BoardHal board;
+ControllerCore core(board);
+
+HOT_PATH void syncEdgeCallback(uint gpio, uint32_t events) {
+    if (gpio == SYNC_PIN && (events & GPIO_IRQ_EDGE_RISE)) {
+        core.syncEdge();
+    }
+}
+
+HOT_PATH void scheduleAlarmCallback(uint alarm_num) {
+    (void)alarm_num;
+    core.runScheduledFrames();
+}
+
+void initScheduler() {
+    schedule_alarm = hardware_alarm_claim_unused(true);
+    hardware_alarm_set_callback(schedule_alarm, &scheduleAlarmCallback);
+}
+
 void setup() {
-    // Initialize standard library (includes USB serial)
+    // Initialize standard library, then the USB console and command interfaces
     stdio_init_all();
-    
+    usbInit();
+#if SERVO2040_UART_BAUD
+    uartInit(SERVO2040_UART_BAUD);
+#endif
+
     // Start updating the LED bar
     led_bar.start();
-    
+
     // Initialize all servos following Pimoroni pattern
-    for(auto s = 0u; s < NUM_SERVOS; s++) {
-        servos[s] = new Servo(servo_pins[s]);
-        servos[s]->init();
-        
+    for(auto s = 0u; s < NUM_BOARD_SERVOS; s++) {
+        new (servo_storage[s]) Servo(servo_pins[s]);
+        servoAt(s).init();
+
         // Set custom calibration to match your original range (-140° to +140°)
-        Calibration& cal = servos[s]->calibration();
+        Calibration& cal = servoAt(s).calibration();
         cal.first_value((float)MIN_ANGLE);
         cal.last_value((float)MAX_ANGLE);
-        
-        currentPositions[s] = 0;
     }
-    
+
     // Enable all servos (this puts them at the middle)
-    for(auto s = 0u; s < NUM_SERVOS; s++) {
-        servos[s]->enable();
+    for(auto s = 0u; s < NUM_BOARD_SERVOS; s++) {
+        servoAt(s).enable();
     }
-    
+
+#if SERVO2040_RAM_HOT_PATH == 1
+    // From here on the control loop writes the PWM levels itself
+    initPwmOutputs();
+#endif
+
+    // PCA9685 boards for the channels past 17, set up before the core centres them
+    if (NUM_EXPANSION_CHANNELS > 0) {
+        expansionInit();
+    }
+
     // Set default LED status
     setDefaultLEDs();
-    
-    printf("Servo2040 Controller initialized with %d servos\n", NUM_SERVOS);
+
+    // Load stored poses and reset the tracked positions
+    core.begin();
+
+    // Claim the hardware alarm for scheduled frames
+    initScheduler();
+
+#if SERVO2040_BUS_NODE
+    core.setBusNode(SERVO2040_BUS_NODE);
+#endif
+
+    // Claim the DMA channel for frame copies
+    initFrameCopy();
+
+    printf("Servo2040 Controller initialized with %u servos (%u on expansion boards)\n", NUM_SERVOS,
+           NUM_EXPANSION_CHANNELS);
     printf("Range: %d° to %d°\n", MIN_ANGLE, MAX_ANGLE);
-    printf("Calibration: min=%.1f, max=%.1f\n", servos[0]->calibration().first_value(), servos[0]->calibration().last_value());
+    printf("Calibration: min=%.1f, max=%.1f\n", servoAt(0).calibration().first_value(), servoAt(0).calibration().last_value());
     printf("LED indicators: LED1=Green (Ready), LED2=Blue (Command received)\n");
     printf("Ready for commands (format: ch1,pos1;ch2,pos2;...)\n");
-}
+    printf("Pose commands: P<n> recall, P<a>,<b>,<t> blend, S<n>[,<name>] save, L list\n");
+    printf("Trajectory commands: T1 play, TL loop, T0 stop, TA arm, TG trigger\n");
+    printf("Sync commands: YM master, YS slave, Y0 off, YP align PWM, YC commit, Y? status\n");
+    printf("Bus commands: N<node> join an RS-485 bus as node 1-%u, N0 leave, N? status\n", BUS_MAX_NODES);
+    printf("V0/V1/V2 turns per-command debug output off/on/deferred, C1/C0 input coalescing on/off, K1/K0 require checksums, D1/D0 DMA copies, B benchmark, U<baud>/U0 UART link, ? stats, M memory\n");
 
-void handleCommands(const char* command) {
-    char* cmd_copy = (char*)malloc(strlen(command) + 1);
-    strcpy(cmd_copy, command);
-    
-    char* token = strtok(cmd_copy, ";");
-    bool changed = false;
-    
-    // Flash the command LED to indicate command received
-    flashCommandLED();
-    
-    while (token != NULL) {
-        char* comma = strchr(token, ',');
-        if (comma != NULL) {
-            *comma = '\0';  // Split at comma
-            int channel = atoi(token);
-            int position = atoi(comma + 1);
-            
-            // Validate channel and position
-            if (channel >= 0 && channel < (int)NUM_SERVOS && 
-                position >= MIN_ANGLE && position <= MAX_ANGLE) {
-                
-                // Debug: print what we're about to send
-                printf("Setting Ch %d to %d° (before: %.1f°)\n", 
-                       channel, position, servos[channel]->value());
-                
-                // Move servo to position - cast to float explicitly
-                // Alternative method - try this if calibration isn't working:
-                // Instead of: servos[channel]->value((float)position);
-                // Use direct pulse mapping:
-                float pulse_us = 1500.0f + (position * 500.0f / 140.0f); // Map -140→+140 to 1000→2000µs
-                servos[channel]->pulse(pulse_us);
-                currentPositions[channel] = position;
-                changed = true;
-                
-                // Debug: print what the servo thinks it's at now
-                printf("Ch %d → %4d° (actual: %.1f°)\n", 
-                       channel, position, servos[channel]->value());
-                       
-            } else {
-                printf("Invalid channel (%d) or angle (%d) out of range\n", channel, position);
-            }
-        }
-        token = strtok(NULL, ";");
-    }
-    
-    free(cmd_copy);
+    // From here on nothing may use the heap
+    heap_sealed = true;
 }
 
 // Function to display a welcome animation on the LEDs
@@ -169,96 +883,71 @@ void ledWelcomeAnimation() {
             led_bar.set_hsv(i, (float)i / NUM_LEDS, 1.0f, BRIGHTNESS);
         }
         sleep_ms(200);
-        
+
         led_bar.clear();
         sleep_ms(200);
     }
-    
+
     // Set default state after animation
     setDefaultLEDs();
 }
 
-char* readSerialLine() {
-    static char buffer[256];
-    static int pos = 0;
-    
-    // Read all available characters at once
-    while (true) {
-        int c = getchar_timeout_us(0); // Non-blocking read
-        
-        if (c == PICO_ERROR_TIMEOUT) {
-            break; // No more data available
-        }
-        
-        if (c == '\n' || c == '\r') {
-            if (pos > 0) {
-                buffer[pos] = '\0';
-                pos = 0;
-                return buffer;
-            }
-        } else if (c >= 32 && c <= 126 && pos < 255) { // Printable characters only
-            buffer[pos++] = c;
-        }
-    }
-    
-    return NULL; // No complete line yet
-}
-
 int main() {
     setup();
-    
+
     // Run the welcome animation
     ledWelcomeAnimation();
-    
+
     // Time tracking for LED updates and command LED timeout
     absolute_time_t next_led_update = make_timeout_time_ms(1000 / UPDATES);
     absolute_time_t command_led_off_time = get_absolute_time();
     bool command_led_active = false;
-    
+
     while (true) {
         // Process user button press (can be used to reset animation)
         if (user_sw.read()) {
             printf("User button pressed\n");
             ledWelcomeAnimation();
         }
-        
+
         // Turn off command LED after a short time
         if (command_led_active && absolute_time_diff_us(command_led_off_time, get_absolute_time()) > 0) {
             led_bar.set_rgb(COMMAND_LED, 0, 0, 0);
             command_led_active = false;
         }
-        
-        // Tight loop for maximum responsiveness
-        bool had_input = false;
-        
-        // Process all available input without delays
-        for (int i = 0; i < 100; i++) { // Check up to 100 times per cycle
-            char* command = readSerialLine();
-            if (command != NULL) {
-                handleCommands(command);
-                // Set timer to turn off command LED after 150ms
-                command_led_off_time = make_timeout_time_ms(150);
-                command_led_active = true;
-                had_input = true;
-            } else {
-                break; // No more input available
-            }
-        }
-        
-        // Only sleep if we had no input this cycle
-        if (!had_input) {
-            sleep_ms(1);
+
+        // Pick up anything the USB interrupt skipped while this loop held the stack
+        usbService();
+        uartService();
+
+        // Trajectory, telemetry and all waiting input, with the XIP cache
+        // counters sampled around it
+        collectXipCounters(false);
+        bool had_input = core.poll();
+        collectXipCounters(true);
+
+        flushDeferredLog();
+        reportHeapUse();
+
+        if (had_input) {
+            // Set timer to turn off command LED after 150ms
+            command_led_off_time = make_timeout_time_ms(150);
+            command_led_active = true;
+        } else {
+            // Only sleep if we had no input this cycle. A bus node must act on
+            // a commit within BUS_JITTER_US, so it barely sleeps.
+            sleep_us(bus_mode ? BUS_POLL_US : 1000);
         }
     }
-    
+
     // Cleanup (this won't be reached in normal operation)
-    for(auto s = 0u; s < NUM_SERVOS; s++) {
-        servos[s]->disable();
-        delete servos[s];
+    for(auto s = 0u; s < NUM_BOARD_SERVOS; s++) {
+        servoAt(s).disable();
+        servoAt(s).~Servo();
     }
-    
+
     // Turn off all LEDs
     led_bar.clear();
-    
+
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+/*
+TinyUSB configuration for the Servo2040's composite device (see usb_link.cpp):
+a CDC command port, a CDC telemetry port and a vendor-class bulk interface for
+host software. The Pico SDK sets the MCU and OS options.
+*/
+
+#define CFG_TUSB_RHPORT0_MODE       (OPT_MODE_DEVICE)
+#define CFG_TUD_ENDPOINT0_SIZE      64
+
+#define CFG_TUD_CDC                 2
+#define CFG_TUD_VENDOR              1
+#define CFG_TUD_MSC                 0
+#define CFG_TUD_HID                 0
+#define CFG_TUD_MIDI                0
+
+// Full-speed bulk packets
+#define CFG_TUD_CDC_EP_BUFSIZE      64
+#define CFG_TUD_CDC_RX_BUFSIZE      256
+#define CFG_TUD_CDC_TX_BUFSIZE      256
+#define CFG_TUD_VENDOR_EPSIZE       64
+#define CFG_TUD_VENDOR_RX_BUFSIZE   512
+#define CFG_TUD_VENDOR_TX_BUFSIZE   512
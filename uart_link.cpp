@@ -0,0 +1,303 @@
+#include "uart_link.hpp"
+
+#include "pico/stdlib.h"
+#include "pico/stdio/driver.h"
+#include "hardware/uart.h"
+#include "hardware/dma.h"
+#include "hardware/irq.h"
+#include "hardware/gpio.h"
+#include "hardware/timer.h"
+
+#include "hot_path.hpp"
+#include "protocol.hpp"
+
+// Nothing here may touch the heap once the board is running
+#pragma GCC poison malloc calloc realloc free strdup
+
+using namespace protocol;
+
+// Qw/ST connector
+#define LINK_UART uart1
+const uint UART_TX_PIN = 20;
+const uint UART_RX_PIN = 21;
+
+// Sizes (bytes). The receive ring must hold what arrives while the main loop
+// sleeps: 8 KB is 27 ms at 3 Mbaud.
+#ifndef SERVO2040_UART_RX_RING_SIZE
+#define SERVO2040_UART_RX_RING_SIZE 8192
+#endif
+const unsigned UART_RX_RING_SIZE = SERVO2040_UART_RX_RING_SIZE;
+const unsigned UART_TX_RING_SIZE = 2048;
+static_assert((UART_RX_RING_SIZE & (UART_RX_RING_SIZE - 1)) == 0, "UART ring sizes must be powers of two");
+static_assert((UART_TX_RING_SIZE & (UART_TX_RING_SIZE - 1)) == 0, "UART ring sizes must be powers of two");
+static_assert(UART_RX_RING_SIZE <= 32768, "DMA can only wrap writes within 32 KB");
+
+// Written by the receive DMA, wrapping at its own size
+alignas(UART_RX_RING_SIZE) uint8_t uart_rx_ring[UART_RX_RING_SIZE];
+uint32_t uart_rx_tail = 0;              // Next byte to read, counted from the start
+uint32_t uart_rx_head = 0;              // Last write position seen
+uint32_t uart_rx_seen = 0;              // Write position at the last idle check
+volatile uint32_t uart_rx_laps = 0;     // Receive DMA transfers completed (one ring each)
+int uart_rx_dma[2] = {-1, -1};          // Chained to each other
+
+uint8_t uart_tx_ring[UART_TX_RING_SIZE];
+uint32_t uart_tx_head = 0;              // Next byte to write
+uint32_t uart_tx_tail = 0;              // Next byte to send
+uint32_t uart_tx_sending = 0;           // Bytes the transmit DMA has in flight
+int uart_tx_dma = -1;
+
+bool uart_on = false;
+bool uart_console = false;
+bool uart_in_burst = false;
+uint64_t uart_last_rx_us = 0;
+UartStats uart_stats = {};
+stdio_driver_t uart_console_driver;
+
+// RS-485 bus mode: one frame at a time, sent from its own buffer by the
+// transmit DMA channel, which the ring doesn't use while the bus is on
+enum BusState { BUS_IDLE, BUS_WAITING, BUS_TALKING };
+
+int uart_bus_de = -1;
+int uart_bus_alarm = -1;
+volatile BusState uart_bus_state = BUS_IDLE;
+uint8_t uart_bus_frame[3 + MAX_FRAME_PAYLOAD];
+unsigned uart_bus_length = 0;
+
+static void uartDmaIrq() {
+    for (int ch : uart_rx_dma) {
+        if (dma_channel_get_irq1_status(ch)) {
+            dma_channel_acknowledge_irq1(ch);
+            uart_rx_laps = uart_rx_laps + 1;
+        }
+    }
+}
+
+// Bytes received since init, from the lap count and the running channel's
+// position. A lap whose interrupt is still pending reads as no progress.
+HOT_PATH static uint32_t rxHead() {
+    uint32_t laps;
+    uint32_t remaining;
+    do {
+        laps = uart_rx_laps;
+        int ch = dma_channel_is_busy(uart_rx_dma[0]) ? uart_rx_dma[0] : uart_rx_dma[1];
+        remaining = dma_channel_hw_addr(ch)->transfer_count;
+    } while (laps != uart_rx_laps);
+    uint32_t head = laps * UART_RX_RING_SIZE + (UART_RX_RING_SIZE - remaining);
+    if ((int32_t)(head - uart_rx_head) > 0) {
+        uart_stats.rx_bytes += head - uart_rx_head;
+        uart_rx_head = head;
+    }
+    return uart_rx_head;
+}
+
+static void consoleOutChars(const char* buf, int length) {
+    if (uart_console) {
+        uartWrite((const uint8_t*)buf, (unsigned)length);
+    }
+}
+
+// Drop DE once the shift register is empty: the alarm is set for when the
+// last stop bit should be out, so this waits a character at most
+HOT_PATH static void busRelease() {
+    while (dma_channel_is_busy(uart_tx_dma) || (uart_get_hw(LINK_UART)->fr & UART_UARTFR_BUSY_BITS)) {
+        tight_loop_contents();
+    }
+    gpio_put(uart_bus_de, false);
+    uart_bus_state = BUS_IDLE;
+}
+
+HOT_PATH static void busTalk() {
+    gpio_put(uart_bus_de, true);
+    uart_bus_state = BUS_TALKING;
+    dma_channel_transfer_from_buffer_now(uart_tx_dma, uart_bus_frame, uart_bus_length);
+    uint64_t end_us = time_us_64() + (uint64_t)uart_bus_length * 10 * 1000000 / uart_stats.baud + 1;
+    if (hardware_alarm_set_target(uart_bus_alarm, from_us_since_boot(end_us))) {
+        busRelease();
+    }
+}
+
+HOT_PATH static void busAlarm(uint alarm) {
+    (void)alarm;
+    if (uart_bus_state == BUS_WAITING) {
+        busTalk();
+    } else if (uart_bus_state == BUS_TALKING) {
+        busRelease();
+    }
+}
+
+void uartInit(unsigned baud) {
+    gpio_set_function(UART_TX_PIN, GPIO_FUNC_UART);
+    gpio_set_function(UART_RX_PIN, GPIO_FUNC_UART);
+    gpio_pull_up(UART_RX_PIN);  // Idle high when nothing is connected
+    uart_stats.baud = uart_init(LINK_UART, baud);
+    uart_set_format(LINK_UART, 8, 1, UART_PARITY_NONE);
+    uart_set_hw_flow(LINK_UART, false, false);
+    uart_set_fifo_enabled(LINK_UART, true);
+
+    uart_rx_dma[0] = dma_claim_unused_channel(true);
+    uart_rx_dma[1] = dma_claim_unused_channel(true);
+    for (int i = 0; i < 2; i++) {
+        dma_channel_config config = dma_channel_get_default_config(uart_rx_dma[i]);
+        channel_config_set_transfer_data_size(&config, DMA_SIZE_8);
+        channel_config_set_read_increment(&config, false);
+        channel_config_set_write_increment(&config, true);
+        channel_config_set_ring(&config, true, __builtin_ctz(UART_RX_RING_SIZE));
+        channel_config_set_dreq(&config, uart_get_dreq(LINK_UART, false));
+        channel_config_set_chain_to(&config, uart_rx_dma[1 - i]);
+        dma_channel_configure(uart_rx_dma[i], &config, uart_rx_ring, &uart_get_hw(LINK_UART)->dr,
+                              UART_RX_RING_SIZE, false);
+        dma_channel_set_irq1_enabled(uart_rx_dma[i], true);
+    }
+    irq_add_shared_handler(DMA_IRQ_1, uartDmaIrq, PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+    irq_set_enabled(DMA_IRQ_1, true);
+    dma_channel_start(uart_rx_dma[0]);
+
+    uart_tx_dma = dma_claim_unused_channel(true);
+    dma_channel_config config = dma_channel_get_default_config(uart_tx_dma);
+    channel_config_set_transfer_data_size(&config, DMA_SIZE_8);
+    channel_config_set_read_increment(&config, true);
+    channel_config_set_write_increment(&config, false);
+    channel_config_set_dreq(&config, uart_get_dreq(LINK_UART, true));
+    dma_channel_configure(uart_tx_dma, &config, &uart_get_hw(LINK_UART)->dr, uart_tx_ring, 0, false);
+
+    uart_console_driver.out_chars = consoleOutChars;
+#if PICO_STDIO_ENABLE_CRLF_SUPPORT
+    uart_console_driver.crlf_enabled = PICO_STDIO_DEFAULT_CRLF;
+#endif
+    stdio_set_driver_enabled(&uart_console_driver, true);
+
+    uart_on = true;
+}
+
+unsigned uartSetBaud(unsigned baud) {
+    if (uart_rx_dma[0] < 0) {
+        if (baud != 0) {
+            uartInit(baud);  // Not started at boot
+        }
+        return uart_stats.baud;
+    }
+    uart_on = baud != 0;
+    if (uart_on) {
+        uart_stats.baud = uart_set_baudrate(LINK_UART, baud);
+    } else {
+        uart_stats.baud = 0;
+        uart_console = false;
+    }
+    // Whatever arrived at the old rate is noise now
+    uart_rx_tail = rxHead();
+    return uart_stats.baud;
+}
+
+void uartService() {
+    if (uart_tx_dma < 0) {
+        return;
+    }
+    if (!dma_channel_is_busy(uart_tx_dma)) {
+        uart_tx_tail += uart_tx_sending;
+        uart_stats.tx_bytes += uart_tx_sending;
+        uart_tx_sending = 0;
+        uint32_t used = uart_tx_head - uart_tx_tail;
+        if (used > 0) {
+            // Up to the end of the ring, the rest goes next time
+            uint32_t offset = uart_tx_tail & (UART_TX_RING_SIZE - 1);
+            uart_tx_sending = used < UART_TX_RING_SIZE - offset ? used : UART_TX_RING_SIZE - offset;
+            dma_channel_transfer_from_buffer_now(uart_tx_dma, &uart_tx_ring[offset], uart_tx_sending);
+        }
+    }
+
+    uint64_t now = time_us_64();
+    uint32_t head = rxHead();
+    if (head - uart_rx_tail > UART_RX_RING_SIZE) {
+        // Lapped: what is left of the oldest data has been overwritten
+        uart_stats.rx_overruns += head - uart_rx_tail - UART_RX_RING_SIZE;
+        uart_rx_tail = head - UART_RX_RING_SIZE;
+    }
+    if (head != uart_rx_seen) {
+        uart_rx_seen = head;
+        uart_last_rx_us = now;
+        uart_in_burst = true;
+    } else if (uart_in_burst && now - uart_last_rx_us > UART_IDLE_US) {
+        uart_stats.bursts++;
+        uart_in_burst = false;
+    }
+}
+
+HOT_PATH int uartReadByte() {
+    if (!uart_on || (uart_rx_tail == uart_rx_head && uart_rx_tail == rxHead())) {
+        return -1;
+    }
+    __compiler_memory_barrier();
+    return uart_rx_ring[uart_rx_tail++ & (UART_RX_RING_SIZE - 1)];
+}
+
+void uartWrite(const uint8_t* data, unsigned length) {
+    if (!uart_on || uart_bus_de >= 0) {
+        return;
+    }
+    if (UART_TX_RING_SIZE - (uart_tx_head - uart_tx_tail) < length) {
+        uart_stats.tx_dropped += length;
+        return;
+    }
+    for (auto i = 0u; i < length; i++) {
+        uart_tx_ring[(uart_tx_head + i) & (UART_TX_RING_SIZE - 1)] = data[i];
+    }
+    uart_tx_head += length;
+    if (uart_tx_head - uart_tx_tail > uart_stats.tx_high_water) {
+        uart_stats.tx_high_water = uart_tx_head - uart_tx_tail;
+    }
+    uartService();
+}
+
+void uartConsole(bool on) {
+    uart_console = on && uart_on && uart_bus_de < 0;
+}
+
+void uartBusMode(int de_pin) {
+    if (uart_bus_alarm < 0) {
+        uart_bus_alarm = hardware_alarm_claim_unused(true);
+        hardware_alarm_set_callback(uart_bus_alarm, &busAlarm);
+    }
+    hardware_alarm_cancel(uart_bus_alarm);
+    if (uart_bus_de >= 0) {
+        gpio_put(uart_bus_de, false);
+        gpio_deinit(uart_bus_de);
+    }
+    uart_bus_state = BUS_IDLE;
+    uart_bus_de = de_pin;
+    if (de_pin >= 0) {
+        gpio_init(de_pin);
+        gpio_put(de_pin, false);
+        gpio_set_dir(de_pin, GPIO_OUT);
+        uart_console = false;
+        // Whatever the ring still holds was meant for a single host
+        uart_tx_head = uart_tx_tail + uart_tx_sending;
+    }
+}
+
+HOT_PATH void uartBusSend(const uint8_t* data, unsigned length, uint64_t at_us) {
+    if (!uart_on || uart_bus_de < 0) {
+        return;
+    }
+    if (uart_bus_state != BUS_IDLE || dma_channel_is_busy(uart_tx_dma) || length > sizeof(uart_bus_frame)) {
+        uart_stats.bus_busy++;
+        return;
+    }
+    for (auto i = 0u; i < length; i++) {
+        uart_bus_frame[i] = data[i];
+    }
+    uart_bus_length = length;
+    uart_stats.bus_sends++;
+    uart_stats.tx_bytes += length;
+    uart_bus_state = BUS_WAITING;
+    // hardware_alarm_set_target returns true if the time has already passed
+    if (hardware_alarm_set_target(uart_bus_alarm, from_us_since_boot(at_us))) {
+        if (at_us != 0) {
+            uart_stats.bus_late++;
+        }
+        busTalk();
+    }
+}
+
+const UartStats& uartStats() {
+    return uart_stats;
+}
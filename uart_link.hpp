@@ -0,0 +1,73 @@
+#pragma once
+#include <cstdint>
+
+/*
+UART link
+
+The same framed protocol as USB, over UART1 on the Qw/ST connector (GP20 TX,
+GP21 RX, 8N1, no flow control) at up to a few Mbaud. It is for hosts wired
+straight to the board, such as an SBC, which then skip USB enumeration and
+CDC latency. It starts at boot when SERVO2040_UART_BAUD is non-zero, and
+U<baud> starts it or changes the rate at run time (U0 turns it off).
+
+Received bytes are written into a ring by two DMA channels chained to each
+other, so reception never stops and costs no CPU time. An interrupt per lap
+of the ring keeps count, so input the firmware falls a whole ring behind on
+is counted as overrun rather than misread. Output is copied into a transmit
+ring and sent by a third DMA channel. Writing never waits: output that
+doesn't fit is dropped and counted.
+
+The line going idle (no bytes for UART_IDLE_US) marks the end of what the
+host sent. A binary frame must be sent in one go, and one that stops part way
+is dropped at the next idle line rather than after the USB frame timeout.
+
+In RS-485 bus mode the link goes through a half-duplex transceiver whose
+driver enable (DE, tied to /RE) is on a spare pin. The board only talks when
+the controller core sends a bus reply: the frame goes out from a hardware
+alarm at the time the core asked for, and DE drops as the last stop bit
+leaves, so the next talker can start a turnaround later. Ordinary output and
+the console never go on the bus.
+*/
+
+struct UartStats {
+    unsigned baud;          // Actual rate, 0 when off
+    uint32_t rx_bytes;
+    uint32_t tx_bytes;
+    uint32_t rx_overruns;   // Bytes overwritten before they were read
+    uint32_t tx_dropped;    // Bytes that didn't fit in the transmit ring
+    uint32_t bursts;        // Runs of input ended by an idle line
+    unsigned tx_high_water;
+    uint32_t bus_sends;     // Bus mode: frames sent
+    uint32_t bus_late;      // Sent late because their time had passed
+    uint32_t bus_busy;      // Dropped because the last one was still going out
+};
+
+// Claim UART1, its pins and three DMA channels, and start receiving.
+// Adds a stdio driver that copies console output here while uartConsole() is on.
+void uartInit(unsigned baud);
+
+// Change the rate (starting the link if it isn't), or turn it off with 0.
+// Returns the actual rate.
+unsigned uartSetBaud(unsigned baud);
+
+// Start the next transmit DMA and check for overruns and idle lines. Call
+// from the main loop.
+void uartService();
+
+// Next received byte, or -1 if none is waiting
+int uartReadByte();
+
+// Raw output, without CR/LF translation. Returns at once.
+void uartWrite(const uint8_t* data, unsigned length);
+
+// Send console output (printf) here too
+void uartConsole(bool on);
+
+// RS-485 bus mode: drive de_pin while talking, -1 turns it off
+void uartBusMode(int de_pin);
+
+// Send a frame on the bus at device time at_us (now if that has passed).
+// Returns at once.
+void uartBusSend(const uint8_t* data, unsigned length, uint64_t at_us);
+
+const UartStats& uartStats();
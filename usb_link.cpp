@@ -0,0 +1,488 @@
+#include "usb_link.hpp"
+
+#include "pico/stdlib.h"
+#include "pico/stdio/driver.h"
+#include "pico/mutex.h"
+#include "pico/bootrom.h"
+#include "pico/unique_id.h"
+#include "hardware/irq.h"
+#include "tusb.h"
+
+#include "hot_path.hpp"
+#include "protocol.hpp"
+
+// Nothing here may touch the heap once the board is running
+#pragma GCC poison malloc calloc realloc free strdup
+
+// The Pico SDK's stdio_usb IDs, so existing udev rules keep matching. Host
+// software tells this firmware apart by its interfaces.
+#ifndef SERVO2040_USB_VID
+#define SERVO2040_USB_VID 0x2E8A
+#endif
+#ifndef SERVO2040_USB_PID
+#define SERVO2040_USB_PID 0x000A
+#endif
+
+const uint32_t USB_TASK_INTERVAL_US = 1000;
+const unsigned USB_RX_RING_SIZE = 1024;
+const unsigned USB_TX_RING_SIZE = 2048;
+const unsigned USB_TELEMETRY_QUEUE_SIZE = 1024;
+static_assert((USB_RX_RING_SIZE & (USB_RX_RING_SIZE - 1)) == 0, "USB ring sizes must be powers of two");
+static_assert((USB_TX_RING_SIZE & (USB_TX_RING_SIZE - 1)) == 0, "USB ring sizes must be powers of two");
+static_assert((USB_TELEMETRY_QUEUE_SIZE & (USB_TELEMETRY_QUEUE_SIZE - 1)) == 0,
+              "USB ring sizes must be powers of two");
+
+// Transmit ring space only replies may use. Frames stop being parsed while an
+// interface has less than this free for its replies, so a reply always fits.
+const unsigned USB_REPLY_RESERVE = 2 * (3 + protocol::MAX_FRAME_PAYLOAD);
+static_assert(USB_REPLY_RESERVE < USB_TX_RING_SIZE / 2, "USB reply reserve must leave room for other output");
+
+// Order the USB task hands transmit rings to TinyUSB
+const UsbInterface tx_priority[NUM_USB_INTERFACES] = {USB_COMMAND_PORT, USB_COMMANDS, USB_TELEMETRY_PORT};
+
+// CDC instance of each CDC interface
+const uint8_t CDC_COMMAND = 0;
+const uint8_t CDC_TELEMETRY = 1;
+
+// Descriptors
+enum {
+    ITF_CDC_COMMAND_CONTROL,
+    ITF_CDC_COMMAND_DATA,
+    ITF_CDC_TELEMETRY_CONTROL,
+    ITF_CDC_TELEMETRY_DATA,
+    ITF_VENDOR,
+    ITF_COUNT,
+};
+
+enum {
+    STRID_LANGID,
+    STRID_MANUFACTURER,
+    STRID_PRODUCT,
+    STRID_SERIAL,
+    STRID_CDC_COMMAND,
+    STRID_CDC_TELEMETRY,
+    STRID_VENDOR,
+    STRID_COUNT,
+};
+
+const uint8_t EP_COMMAND_NOTIFY = 0x81;
+const uint8_t EP_COMMAND_OUT = 0x02;
+const uint8_t EP_COMMAND_IN = 0x82;
+const uint8_t EP_TELEMETRY_NOTIFY = 0x83;
+const uint8_t EP_TELEMETRY_OUT = 0x04;
+const uint8_t EP_TELEMETRY_IN = 0x84;
+const uint8_t EP_VENDOR_OUT = 0x05;
+const uint8_t EP_VENDOR_IN = 0x85;
+const uint16_t USB_BULK_SIZE = 64;
+
+// Misc/IAD class, so the host binds each CDC pair to one driver
+const tusb_desc_device_t device_descriptor = {
+    .bLength = sizeof(tusb_desc_device_t),
+    .bDescriptorType = TUSB_DESC_DEVICE,
+    .bcdUSB = 0x0200,
+    .bDeviceClass = TUSB_CLASS_MISC,
+    .bDeviceSubClass = MISC_SUBCLASS_COMMON,
+    .bDeviceProtocol = MISC_PROTOCOL_IAD,
+    .bMaxPacketSize0 = CFG_TUD_ENDPOINT0_SIZE,
+    .idVendor = SERVO2040_USB_VID,
+    .idProduct = SERVO2040_USB_PID,
+    .bcdDevice = 0x0201,  // Bumped with every interface change, so hosts don't reuse a cached list
+    .iManufacturer = STRID_MANUFACTURER,
+    .iProduct = STRID_PRODUCT,
+    .iSerialNumber = STRID_SERIAL,
+    .bNumConfigurations = 1,
+};
+
+const unsigned CONFIG_TOTAL_LEN = TUD_CONFIG_DESC_LEN + 2 * TUD_CDC_DESC_LEN + TUD_VENDOR_DESC_LEN;
+
+const uint8_t configuration_descriptor[] = {
+    TUD_CONFIG_DESCRIPTOR(1, ITF_COUNT, 0, CONFIG_TOTAL_LEN, 0, 250),
+    TUD_CDC_DESCRIPTOR(ITF_CDC_COMMAND_CONTROL, STRID_CDC_COMMAND, EP_COMMAND_NOTIFY, 8, EP_COMMAND_OUT,
+                       EP_COMMAND_IN, USB_BULK_SIZE),
+    TUD_CDC_DESCRIPTOR(ITF_CDC_TELEMETRY_CONTROL, STRID_CDC_TELEMETRY, EP_TELEMETRY_NOTIFY, 8, EP_TELEMETRY_OUT,
+                       EP_TELEMETRY_IN, USB_BULK_SIZE),
+    TUD_VENDOR_DESCRIPTOR(ITF_VENDOR, STRID_VENDOR, EP_VENDOR_OUT, EP_VENDOR_IN, USB_BULK_SIZE),
+};
+
+const char* const usb_strings[STRID_COUNT] = {
+    NULL,                         // Language, see tud_descriptor_string_cb()
+    "Pimoroni",
+    "Servo2040 hand controller",
+    NULL,                         // Board ID
+    "Servo2040 commands",
+    "Servo2040 telemetry",
+    "Servo2040 commands (bulk)",
+};
+
+// Byte rings between the main loop and the USB task. The receive rings are
+// filled by the task, the transmit rings emptied by it.
+template <unsigned SIZE>
+struct ByteRing {
+    uint8_t data[SIZE];
+    volatile uint32_t head;  // Next byte to write
+    volatile uint32_t tail;  // Next byte to read
+
+    uint32_t used() const { return head - tail; }
+};
+
+ByteRing<USB_RX_RING_SIZE> rx_rings[NUM_USB_INTERFACES];
+ByteRing<USB_TX_RING_SIZE> tx_rings[NUM_USB_INTERFACES];
+
+// Telemetry frames waiting for transmit ring space, each after a 16-bit
+// length. When full the oldest frame is dropped: only the latest state matters.
+ByteRing<USB_TELEMETRY_QUEUE_SIZE> telemetry_queue;
+UsbInterface rx_source = USB_COMMAND_PORT;        // Interface being drained
+UsbInterface reply_interface = USB_COMMAND_PORT;  // Where USB_REPLY goes
+bool vendor_active = false;
+bool input_held = false;  // Input is waiting for reply space
+UsbStats usb_stats = {};
+
+// TinyUSB isn't re-entrant. The interrupt and the timer skip their run if
+// the main loop is using the stack, as stdio_usb does.
+mutex_t usb_mutex;
+repeating_timer_t usb_timer;
+unsigned usb_task_irq;
+stdio_driver_t console_driver;
+
+extern "C" const uint8_t* tud_descriptor_device_cb(void) {
+    return (const uint8_t*)&device_descriptor;
+}
+
+extern "C" const uint8_t* tud_descriptor_configuration_cb(uint8_t index) {
+    (void)index;
+    return configuration_descriptor;
+}
+
+extern "C" const uint16_t* tud_descriptor_string_cb(uint8_t index, uint16_t langid) {
+    (void)langid;
+    static uint16_t descriptor[1 + 32];
+    unsigned length = 0;
+    if (index == STRID_LANGID) {
+        descriptor[1] = 0x0409;  // English
+        length = 1;
+    } else if (index < STRID_COUNT) {
+        char serial[2 * PICO_UNIQUE_BOARD_ID_SIZE_BYTES + 1];
+        const char* text = usb_strings[index];
+        if (index == STRID_SERIAL) {
+            pico_get_unique_board_id_string(serial, sizeof(serial));
+            text = serial;
+        }
+        for (; text[length] != '\0' && length < 32; length++) {
+            descriptor[1 + length] = (uint8_t)text[length];
+        }
+    } else {
+        return NULL;
+    }
+    descriptor[0] = (uint16_t)((TUSB_DESC_STRING << 8) | (2 * length + 2));
+    return descriptor;
+}
+
+// Opening either port at 1200 baud reboots into the bootloader, as with stdio_usb
+extern "C" void tud_cdc_line_coding_cb(uint8_t itf, const cdc_line_coding_t* line_coding) {
+    (void)itf;
+    if (line_coding->bit_rate == 1200) {
+        reset_usb_boot(0, 0);
+    }
+}
+
+bool usbInterfaceOpen(UsbInterface itf) {
+    switch (itf) {
+    case USB_COMMAND_PORT:
+        return tud_cdc_n_connected(CDC_COMMAND);
+    case USB_TELEMETRY_PORT:
+        return tud_cdc_n_connected(CDC_TELEMETRY);
+    default:
+        return tud_mounted() && vendor_active;
+    }
+}
+
+// Move what TinyUSB has received into an interface's ring. Caller holds usb_mutex.
+static void fillRxRing(UsbInterface itf) {
+    auto& ring = rx_rings[itf];
+    for (;;) {
+        uint32_t head = ring.head;
+        uint32_t offset = head & (USB_RX_RING_SIZE - 1);
+        uint32_t space = USB_RX_RING_SIZE - ring.used();
+        uint32_t chunk = space < USB_RX_RING_SIZE - offset ? space : USB_RX_RING_SIZE - offset;
+        if (chunk == 0) {
+            return; // Full, the rest waits in TinyUSB (and then the host)
+        }
+        uint32_t count;
+        if (itf == USB_COMMANDS) {
+            count = tud_vendor_read(&ring.data[offset], chunk);
+        } else {
+            count = tud_cdc_n_read(itf == USB_COMMAND_PORT ? CDC_COMMAND : CDC_TELEMETRY, &ring.data[offset], chunk);
+        }
+        if (count == 0) {
+            return;
+        }
+        __compiler_memory_barrier();
+        ring.head = head + count;
+        usb_stats.rx_bytes[itf] += count;
+    }
+}
+
+// Received data is moved into the rings as tud_task() handles the transfer,
+// straight after the USB interrupt. Called from tud_task(), with usb_mutex held.
+#if TUSB_VERSION_MAJOR > 0 || TUSB_VERSION_MINOR >= 17
+extern "C" void tud_vendor_rx_cb(uint8_t itf, const uint8_t* buffer, uint16_t bufsize) {
+    (void)itf;
+    (void)buffer;
+    (void)bufsize;
+    fillRxRing(USB_COMMANDS);
+}
+#else
+extern "C" void tud_vendor_rx_cb(uint8_t itf) {
+    (void)itf;
+    fillRxRing(USB_COMMANDS);
+}
+#endif
+
+extern "C" void tud_cdc_rx_cb(uint8_t itf) {
+    fillRxRing(itf == CDC_COMMAND ? USB_COMMAND_PORT : USB_TELEMETRY_PORT);
+}
+
+// Hand as much of an interface's transmit ring to TinyUSB as it will take.
+// Caller holds usb_mutex.
+static void drainTxRing(UsbInterface itf) {
+    auto& ring = tx_rings[itf];
+    bool sent = false;
+    while (ring.used() > 0) {
+        uint32_t tail = ring.tail;
+        uint32_t offset = tail & (USB_TX_RING_SIZE - 1);
+        uint32_t chunk = ring.used() < USB_TX_RING_SIZE - offset ? ring.used() : USB_TX_RING_SIZE - offset;
+        uint32_t count;
+        if (itf == USB_COMMANDS) {
+            count = tud_vendor_write(&ring.data[offset], chunk);
+        } else {
+            count = tud_cdc_n_write(itf == USB_COMMAND_PORT ? CDC_COMMAND : CDC_TELEMETRY, &ring.data[offset], chunk);
+        }
+        if (count == 0) {
+            break;
+        }
+        ring.tail = tail + count;
+        usb_stats.tx_bytes[itf] += count;
+        sent = true;
+    }
+    if (!sent) {
+        return;
+    }
+    if (itf == USB_COMMANDS) {
+#if TUSB_VERSION_MAJOR > 0 || TUSB_VERSION_MINOR >= 16
+        tud_vendor_write_flush();
+#endif
+    } else {
+        tud_cdc_n_write_flush(itf == USB_COMMAND_PORT ? CDC_COMMAND : CDC_TELEMETRY);
+    }
+}
+
+// Interface a stream goes out on
+static UsbInterface streamInterface(UsbStream stream) {
+    if (stream != USB_REPLY && usbInterfaceOpen(USB_TELEMETRY_PORT)) {
+        return USB_TELEMETRY_PORT;
+    }
+    return stream == USB_LOG ? USB_COMMAND_PORT : reply_interface;
+}
+
+// Transmit ring space a stream may still use
+static uint32_t txRoom(UsbInterface itf, UsbStream stream) {
+    uint32_t limit = stream == USB_REPLY ? USB_TX_RING_SIZE : USB_TX_RING_SIZE - USB_REPLY_RESERVE;
+    uint32_t used = tx_rings[itf].used();
+    return used < limit ? limit - used : 0;
+}
+
+// Caller holds usb_mutex and has checked txRoom()
+static void pushTx(UsbInterface itf, const uint8_t* data, unsigned length) {
+    auto& ring = tx_rings[itf];
+    for (auto i = 0u; i < length; i++) {
+        ring.data[(ring.head + i) & (USB_TX_RING_SIZE - 1)] = data[i];
+    }
+    ring.head = ring.head + length;
+    if (ring.used() > usb_stats.tx_high_water[itf]) {
+        usb_stats.tx_high_water[itf] = ring.used();
+    }
+}
+
+static uint16_t queuedFrameLength() {
+    auto& queue = telemetry_queue;
+    return (uint16_t)(queue.data[queue.tail & (USB_TELEMETRY_QUEUE_SIZE - 1)] |
+                      queue.data[(queue.tail + 1) & (USB_TELEMETRY_QUEUE_SIZE - 1)] << 8);
+}
+
+// Move queued telemetry, oldest first, into the transmit ring while there is
+// room for it. Caller holds usb_mutex.
+static void flushTelemetryQueue() {
+    auto& queue = telemetry_queue;
+    UsbInterface itf = streamInterface(USB_TELEMETRY);
+    while (queue.used() > 0) {
+        uint16_t length = queuedFrameLength();
+        if (!usbInterfaceOpen(itf)) {
+            // The host went away, don't send it stale frames when it's back
+            queue.tail = queue.tail + 2 + length;
+            usb_stats.telemetry_dropped++;
+            continue;
+        }
+        if (txRoom(itf, USB_TELEMETRY) < length) {
+            return;
+        }
+        auto& ring = tx_rings[itf];
+        for (auto i = 0u; i < length; i++) {
+            ring.data[(ring.head + i) & (USB_TX_RING_SIZE - 1)] =
+                queue.data[(queue.tail + 2 + i) & (USB_TELEMETRY_QUEUE_SIZE - 1)];
+        }
+        ring.head = ring.head + length;
+        queue.tail = queue.tail + 2 + length;
+        if (ring.used() > usb_stats.tx_high_water[itf]) {
+            usb_stats.tx_high_water[itf] = ring.used();
+        }
+    }
+}
+
+// Caller holds usb_mutex
+static void queueTelemetry(const uint8_t* data, unsigned length) {
+    auto& queue = telemetry_queue;
+    if (length + 2 > USB_TELEMETRY_QUEUE_SIZE) {
+        usb_stats.telemetry_dropped++;
+        return;
+    }
+    while (USB_TELEMETRY_QUEUE_SIZE - queue.used() < length + 2) {
+        queue.tail = queue.tail + 2 + queuedFrameLength();
+        usb_stats.telemetry_dropped++;
+    }
+    uint32_t head = queue.head;
+    queue.data[head & (USB_TELEMETRY_QUEUE_SIZE - 1)] = (uint8_t)length;
+    queue.data[(head + 1) & (USB_TELEMETRY_QUEUE_SIZE - 1)] = (uint8_t)(length >> 8);
+    for (auto i = 0u; i < length; i++) {
+        queue.data[(head + 2 + i) & (USB_TELEMETRY_QUEUE_SIZE - 1)] = data[i];
+    }
+    queue.head = head + 2 + length;
+    flushTelemetryQueue();
+}
+
+// Caller holds usb_mutex
+static void runUsbTask() {
+    tud_task();
+    // The receive callbacks stop when a ring fills; pick up the rest as it empties
+    for (auto itf = 0u; itf < NUM_USB_INTERFACES; itf++) {
+        fillRxRing((UsbInterface)itf);
+    }
+    flushTelemetryQueue();
+    for (UsbInterface itf : tx_priority) {
+        drainTxRing(itf);
+    }
+}
+
+static void consoleOutChars(const char* buf, int length) {
+    usbWrite(USB_LOG, (const uint8_t*)buf, (unsigned)length);
+}
+
+// TinyUSB's own handler only queues events. This runs after it and has the
+// task run from a low-priority interrupt, so received data reaches the rings
+// without waiting for the timer or the main loop.
+static void usbIrq() {
+    irq_set_pending(usb_task_irq);
+}
+
+static void usbTaskIrq() {
+    usbService();
+}
+
+// Backstop for when the interrupt found the main loop using the stack
+static bool usbTimerCallback(repeating_timer_t* timer) {
+    (void)timer;
+    usbService();
+    return true;
+}
+
+void usbInit() {
+    mutex_init(&usb_mutex);
+    tusb_init();
+
+    // Console input is read by the controller core, stdio only writes
+    console_driver.out_chars = consoleOutChars;
+#if PICO_STDIO_ENABLE_CRLF_SUPPORT
+    console_driver.crlf_enabled = PICO_STDIO_DEFAULT_CRLF;
+#endif
+    stdio_set_driver_enabled(&console_driver, true);
+
+    usb_task_irq = user_irq_claim_unused(true);
+    irq_set_exclusive_handler(usb_task_irq, usbTaskIrq);
+    irq_set_priority(usb_task_irq, PICO_LOWEST_IRQ_PRIORITY);
+    irq_set_enabled(usb_task_irq, true);
+    irq_add_shared_handler(USBCTRL_IRQ, usbIrq, PICO_SHARED_IRQ_HANDLER_LOWEST_ORDER_PRIORITY);
+
+    add_repeating_timer_us(-(int64_t)USB_TASK_INTERVAL_US, usbTimerCallback, NULL, &usb_timer);
+}
+
+void usbService() {
+    if (mutex_try_enter(&usb_mutex, NULL)) {
+        runUsbTask();
+        mutex_exit(&usb_mutex);
+    }
+}
+
+// Reply space isn't checked here: the core reads far ahead of the frames it
+// answers, so it checks usbReplyRoom() per frame instead
+HOT_PATH static bool inputReady(unsigned itf) {
+    return rx_rings[itf].used() > 0;
+}
+
+HOT_PATH int usbReadByte() {
+    unsigned itf = rx_source;
+    if (!inputReady(itf)) {
+        // Next interface with input, in order
+        do {
+            itf = (itf + 1) % NUM_USB_INTERFACES;
+        } while (itf != rx_source && !inputReady(itf));
+        if (itf == rx_source) {
+            return -1;
+        }
+        rx_source = (UsbInterface)itf;
+    }
+    auto& ring = rx_rings[itf];
+    __compiler_memory_barrier();
+    uint8_t c = ring.data[ring.tail & (USB_RX_RING_SIZE - 1)];
+    ring.tail = ring.tail + 1;
+    reply_interface = itf == USB_TELEMETRY_PORT ? USB_COMMAND_PORT : (UsbInterface)itf;
+    if (itf == USB_COMMANDS) {
+        vendor_active = true;
+    }
+    return c;
+}
+
+// Input then waits in the core's ring, the USB rings, TinyUSB and the host
+// until the host reads the replies already queued
+HOT_PATH bool usbReplyRoom() {
+    bool room = tx_rings[reply_interface].used() <= USB_TX_RING_SIZE - USB_REPLY_RESERVE;
+    if (!room && !input_held) {
+        usb_stats.input_held++;
+    }
+    input_held = !room;
+    return room;
+}
+
+// Never waits: output that doesn't fit is dropped by its stream's policy
+void usbWrite(UsbStream stream, const uint8_t* data, unsigned length) {
+    UsbInterface itf = streamInterface(stream);
+    if (!usbInterfaceOpen(itf)) {
+        usb_stats.tx_dropped[itf] += length;
+        return;
+    }
+    // Only contended by the USB timer, which never waits for it
+    mutex_enter_blocking(&usb_mutex);
+    if (stream == USB_TELEMETRY) {
+        queueTelemetry(data, length);
+    } else if (txRoom(itf, stream) >= length) {
+        pushTx(itf, data, length);
+    } else if (stream == USB_LOG) {
+        usb_stats.log_dropped += length;
+    } else {
+        usb_stats.reply_overflows += length;
+    }
+    drainTxRing(itf);
+    mutex_exit(&usb_mutex);
+}
+
+const UsbStats& usbStats() {
+    return usb_stats;
+}
@@ -0,0 +1,86 @@
+#pragma once
+#include <cstdint>
+
+/*
+USB link
+
+The board enumerates as a composite device with three interfaces:
+  - CDC 0, the command port: commands and their replies. It is also the
+    console while the telemetry port is closed, so a single terminal or an
+    older host sees everything.
+  - CDC 1, the telemetry port: telemetry frames and console output, once a
+    host has it open. Telemetry and printf then never hold up a reply.
+  - Vendor-class bulk IN/OUT, for host software using libusb (see
+    host/usb_port.hpp). It carries commands and replies, like the command port.
+
+The firmware runs TinyUSB itself instead of through stdio_usb. The USB task
+runs from a low-priority interrupt raised after every USB interrupt, with a
+1 ms timer and the top of every main-loop pass as backstops. TinyUSB's
+receive callbacks move what arrives into one receive ring per interface as
+the task handles it, and readByte() reads those rings without touching the
+USB stack. Output is copied into one transmit ring per interface. The task
+hands the rings to TinyUSB in priority order, so the command interfaces go
+before telemetry.
+
+Writing never waits for the host. When a ring is full, each stream has its
+own policy:
+  - replies are never dropped. The last USB_REPLY_RESERVE bytes of each ring
+    are kept for them. The controller core reads ahead of what it has
+    parsed, so it asks usbReplyRoom() before each frame and leaves input
+    unparsed while the reply ring has less than that free. A host that stops
+    reading stops being answered rather than losing answers.
+  - telemetry frames wait in their own queue, and the oldest is dropped to
+    make room for a new one.
+  - console output that doesn't fit is dropped.
+Everything dropped is counted in UsbStats.
+
+Input is taken from whichever interface has bytes, and that interface is
+drained before the next one is read.
+*/
+
+enum UsbInterface {
+    USB_COMMAND_PORT,    // CDC 0
+    USB_TELEMETRY_PORT,  // CDC 1
+    USB_COMMANDS,        // Vendor bulk
+    NUM_USB_INTERFACES,
+};
+
+// What is being sent, which decides the interface it goes out on
+enum UsbStream {
+    USB_REPLY,       // On the interface the last input came from
+    USB_TELEMETRY,   // On the telemetry port if it is open, else as USB_REPLY
+    USB_LOG,         // On the telemetry port if it is open, else the command port
+};
+
+struct UsbStats {
+    uint32_t rx_bytes[NUM_USB_INTERFACES];
+    uint32_t tx_bytes[NUM_USB_INTERFACES];
+    uint32_t tx_dropped[NUM_USB_INTERFACES];  // Bytes for an interface no host had open
+    unsigned tx_high_water[NUM_USB_INTERFACES];
+    uint32_t telemetry_dropped;  // Frames, oldest first
+    uint32_t log_dropped;        // Bytes
+    uint32_t reply_overflows;    // Bytes; replies larger than the reserve
+    uint32_t input_held;         // Times input was left unread for lack of reply space
+};
+
+// Start the USB device and send stdio output to it as USB_LOG.
+// Replaces stdio_init_all()'s USB part; call before printing anything.
+void usbInit();
+
+// Run the USB task now, unless it is already running
+void usbService();
+
+// Next received byte, or -1 if none is waiting
+int usbReadByte();
+
+// Room for the replies to one more command on the interface input last came
+// from. Called before each frame is parsed; false counts as input held.
+bool usbReplyRoom();
+
+// Raw output, without CR/LF translation. Returns at once.
+void usbWrite(UsbStream stream, const uint8_t* data, unsigned length);
+
+const UsbStats& usbStats();
+
+// A host has the interface open (CDC: DTR set; vendor: has sent something)
+bool usbInterfaceOpen(UsbInterface itf);